@@ -0,0 +1,75 @@
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "utl/verify.h"
+
+#include "osm/compress.h"
+#include "osm/decompress.h"
+#include "osm/osm.h"
+
+#include "synthetic.h"
+
+namespace {
+
+// osm::compress does not write LZ4 blobs, only LZ4 is compressed here.
+std::string compress(osm::compression const c, std::string const& in) {
+#ifdef OSM_WITH_LZ4
+  if (c == osm::compression::kLz4) {
+    auto out =
+        std::string(LZ4_compressBound(static_cast<int>(in.size())), '\0');
+    auto const n = LZ4_compress_default(in.data(), out.data(),
+                                        static_cast<int>(in.size()),
+                                        static_cast<int>(out.size()));
+    utl::verify(n > 0, "lz4 failed: {}", n);
+    out.resize(static_cast<std::size_t>(n));
+    return out;
+  }
+#endif
+  return osm::compress(c, in);
+}
+
+void bm_decompress(benchmark::State& state, osm::compression const c) {
+  auto const& blocks = osm::bench::raw_blocks();
+
+  auto compressed = std::vector<std::string>{};
+  auto bytes = std::size_t{0U};
+  auto compressed_bytes = std::size_t{0U};
+  for (auto const& b : blocks) {
+    compressed.emplace_back(compress(c, b));
+    bytes += b.size();
+    compressed_bytes += compressed.back().size();
+  }
+
+  auto d = osm::decompressor{};
+  auto out = std::string{};
+  for (auto _ : state) {
+    for (auto i = 0U; i != blocks.size(); ++i) {
+      auto const block = d.decompress(
+          osm::buf{.type_ = osm::blob_type::kData,
+                   .compression_ = c,
+                   .idx_ = i,
+                   .offset_ = 0U,
+                   .raw_size_ = blocks[i].size(),
+                   .compressed_ = compressed[i]},
+          out);
+      benchmark::DoNotOptimize(block.data());
+    }
+  }
+  state.SetBytesProcessed(
+      static_cast<std::int64_t>(state.iterations() * bytes));
+  state.counters["ratio"] =
+      static_cast<double>(bytes) / static_cast<double>(compressed_bytes);
+}
+
+}  // namespace
+
+BENCHMARK_CAPTURE(bm_decompress, raw, osm::compression::kRaw);
+BENCHMARK_CAPTURE(bm_decompress, zlib, osm::compression::kZlib);
+#ifdef OSM_WITH_ZSTD
+BENCHMARK_CAPTURE(bm_decompress, zstd, osm::compression::kZstd);
+#endif
+#ifdef OSM_WITH_LZ4
+BENCHMARK_CAPTURE(bm_decompress, lz4, osm::compression::kLz4);
+#endif
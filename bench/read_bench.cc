@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "protozero/pbf_message.hpp"
+
+#include "osm/bulk_varint.h"
+#include "osm/decoder.h"
+#include "osm/decompress.h"
+#include "osm/osm.h"
+#include "osm/parallel_reader.h"
+#include "osm/varint.h"
+
+#include "synthetic.h"
+
+namespace {
+
+osm::raw_reader open_bench_pbf() {
+  return osm::raw_reader{
+      .file_ = cista::mmap{osm::bench::bench_pbf().string().c_str(),
+                           cista::mmap::protection::READ}};
+}
+
+// Packed delta coded fields (dense node ids / lats / lons, way refs).
+std::vector<std::string_view> const& packed_fields() {
+  static auto const fields = []() {
+    auto fields = std::vector<std::string_view>{};
+    for (auto const& block : osm::bench::raw_blocks()) {
+      auto pbf_block = protozero::pbf_message<osm::primitive_block>{block};
+      while (pbf_block.next(
+          osm::primitive_block::repeated_PrimitiveGroup_primitivegroup,
+          protozero::pbf_wire_type::length_delimited)) {
+        auto group = protozero::pbf_message<osm::primitive_group>{
+            pbf_block.get_message()};
+        while (group.next()) {
+          switch (group.tag_and_type()) {
+            case protozero::tag_and_type(
+                osm::primitive_group::optional_DenseNodes_dense,
+                protozero::pbf_wire_type::length_delimited): {
+              auto const dense = osm::parse_dense_nodes(group.get_view());
+              fields.insert(end(fields),
+                            {dense.ids_, dense.lats_, dense.lons_});
+              break;
+            }
+
+            case protozero::tag_and_type(
+                osm::primitive_group::repeated_Way_ways,
+                protozero::pbf_wire_type::length_delimited): {
+              auto way = protozero::pbf_message<osm::way>{group.get_message()};
+              while (way.next(osm::way::packed_sint64_refs,
+                              protozero::pbf_wire_type::length_delimited)) {
+                fields.emplace_back(way.get_view());
+              }
+              break;
+            }
+
+            default: group.skip();
+          }
+        }
+      }
+    }
+    return fields;
+  }();
+  return fields;
+}
+
+std::size_t total_size(std::vector<std::string_view> const& v) {
+  auto n = std::size_t{0U};
+  for (auto const& x : v) {
+    n += x.size();
+  }
+  return n;
+}
+
+// Blob header and blob parsing only (the file is memory mapped).
+void bm_framing(benchmark::State& state) {
+  auto r = open_bench_pbf();
+  auto n_blobs = std::size_t{0U};
+  for (auto _ : state) {
+    r.seek(0U, 0U);
+    while (auto const b = r.read()) {
+      benchmark::DoNotOptimize(b->compressed_.data());
+      ++n_blobs;
+    }
+  }
+  state.SetBytesProcessed(
+      static_cast<std::int64_t>(state.iterations() * r.size()));
+  state.SetItemsProcessed(static_cast<std::int64_t>(n_blobs));
+}
+
+// Decompression of all data blobs of the file (bytes: uncompressed).
+void bm_inflate(benchmark::State& state) {
+  auto r = open_bench_pbf();
+  auto blobs = std::vector<osm::buf>{};
+  auto bytes = std::size_t{0U};
+  while (auto const b = r.read()) {
+    if (b->type_ == osm::blob_type::kData) {
+      blobs.emplace_back(*b);
+      bytes += b->raw_size_;
+    }
+  }
+
+  auto d = osm::decompressor{};
+  auto out = std::string{};
+  for (auto _ : state) {
+    for (auto const& b : blobs) {
+      benchmark::DoNotOptimize(d.decompress(b, out).data());
+    }
+  }
+  state.SetBytesProcessed(
+      static_cast<std::int64_t>(state.iterations() * bytes));
+}
+
+void bm_string_table(benchmark::State& state) {
+  auto const& blocks = osm::bench::raw_blocks();
+  auto strings = std::vector<std::string_view>{};
+  auto n_strings = std::size_t{0U};
+  for (auto _ : state) {
+    for (auto const& block : blocks) {
+      strings.clear();
+      benchmark::DoNotOptimize(
+          osm::decode_primitive_block_metadata(block, strings));
+      n_strings += strings.size();
+    }
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(n_strings));
+}
+
+void bm_varint_bulk(benchmark::State& state) {
+  auto const& fields = packed_fields();
+  auto buf = osm::int_buffer{};
+  auto n_values = std::size_t{0U};
+  for (auto _ : state) {
+    for (auto const f : fields) {
+      auto const values = osm::decode_packed<true, true>(f, buf);
+      benchmark::DoNotOptimize(values.data());
+      n_values += values.size();
+    }
+  }
+  state.SetBytesProcessed(
+      static_cast<std::int64_t>(state.iterations() * total_size(fields)));
+  state.SetItemsProcessed(static_cast<std::int64_t>(n_values));
+}
+
+void bm_varint_scalar(benchmark::State& state) {
+  auto const& fields = packed_fields();
+  auto n_values = std::size_t{0U};
+  for (auto _ : state) {
+    for (auto const f : fields) {
+      auto sum = std::int64_t{0};
+      for (auto const x : osm::delta_varint<std::int64_t>{f}) {
+        sum += x;
+        ++n_values;
+      }
+      benchmark::DoNotOptimize(sum);
+    }
+  }
+  state.SetBytesProcessed(
+      static_cast<std::int64_t>(state.iterations() * total_size(fields)));
+  state.SetItemsProcessed(static_cast<std::int64_t>(n_values));
+}
+
+// Full block decoding with trivial callbacks, per entity.
+void bm_dispatch(benchmark::State& state) {
+  auto const& blocks = osm::bench::raw_blocks();
+  auto s = osm::decode_state{};
+  auto n = std::size_t{0U};
+  for (auto _ : state) {
+    for (auto const& block : blocks) {
+      osm::decode_primitive(
+          block, s, true, true, true, [&](auto&&, auto&&, auto&&) { ++n; },
+          [&](auto&&, auto&&, auto&&) { ++n; },
+          [&](auto&&, auto&&, auto&&) { ++n; });
+    }
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(n));
+}
+
+// Same with the columnar node_batch callback.
+void bm_dispatch_batch(benchmark::State& state) {
+  auto const& blocks = osm::bench::raw_blocks();
+  auto s = osm::decode_state{};
+  auto n = std::size_t{0U};
+  for (auto _ : state) {
+    for (auto const& block : blocks) {
+      osm::decode_primitive(
+          block, s, true, true, true,
+          [&](osm::node_batch const& b) { n += b.size(); },
+          [&](auto&&, auto&&, auto&&) { ++n; },
+          [&](auto&&, auto&&, auto&&) { ++n; });
+    }
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(n));
+}
+
+// IDs and positions only: tags, refs and members are skipped.
+void bm_dispatch_ids(benchmark::State& state) {
+  auto const& blocks = osm::bench::raw_blocks();
+  auto s = osm::decode_state{};
+  auto n = std::size_t{0U};
+  for (auto _ : state) {
+    for (auto const& block : blocks) {
+      osm::decode_primitive<osm::field::kNodes | osm::field::kWays |
+                            osm::field::kRelations>(
+          block, s, [&](std::int64_t, geo::latlng const&) { ++n; },
+          [&](std::uint64_t, auto&&) { ++n; },
+          [&](std::uint64_t, auto&&) { ++n; });
+    }
+  }
+  state.SetItemsProcessed(static_cast<std::int64_t>(n));
+}
+
+// Node positions as fixed point instead of geo::latlng.
+void bm_dispatch_fixed(benchmark::State& state) {
+  auto const& blocks = osm::bench::raw_blocks();
+  auto s = osm::decode_state{};
+  auto n = std::size_t{0U};
+  auto sum = std::int64_t{0};
+  for (auto _ : state) {
+    for (auto const& block : blocks) {
+      osm::decode_primitive<osm::field::kNodes | osm::field::kFixedPoint>(
+          block, s,
+          [&](std::int64_t, osm::location const l) {
+            sum += l.lat_;
+            ++n;
+          },
+          osm::no_callback{}, osm::no_callback{});
+    }
+  }
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(static_cast<std::int64_t>(n));
+}
+
+// End to end read() of the whole file with state.range(0) decoder threads.
+void bm_read_threads(benchmark::State& state) {
+  auto const path = osm::bench::bench_pbf().string();
+  auto n = std::atomic_size_t{0U};
+  auto file_size = std::size_t{0U};
+  for (auto _ : state) {
+    osm::read(
+        path.c_str(),
+        {.n_threads_ = static_cast<unsigned>(state.range(0)),
+         .progress_ = [&](std::size_t, std::size_t const size) {
+           file_size = size;
+         }},
+        [&](osm::node_batch const& b) {
+          n.fetch_add(b.size(), std::memory_order_relaxed);
+        },
+        [&](auto&&, auto&&, auto&&) {
+          n.fetch_add(1U, std::memory_order_relaxed);
+        },
+        [&](auto&&, auto&&, auto&&) {
+          n.fetch_add(1U, std::memory_order_relaxed);
+        });
+  }
+  state.SetBytesProcessed(
+      static_cast<std::int64_t>(state.iterations() * file_size));
+  state.SetItemsProcessed(static_cast<std::int64_t>(n.load()));
+}
+
+}  // namespace
+
+BENCHMARK(bm_framing);
+BENCHMARK(bm_inflate);
+BENCHMARK(bm_string_table);
+BENCHMARK(bm_varint_bulk);
+BENCHMARK(bm_varint_scalar);
+BENCHMARK(bm_dispatch);
+BENCHMARK(bm_dispatch_batch);
+BENCHMARK(bm_dispatch_ids);
+BENCHMARK(bm_dispatch_fixed);
+BENCHMARK(bm_read_threads)
+    ->RangeMultiplier(2)
+    ->Range(1, std::max(1U, std::thread::hardware_concurrency()))
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,355 @@
+#include "synthetic.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <string_view>
+
+#include "fmt/format.h"
+
+#include "protozero/pbf_builder.hpp"
+
+#include "utl/verify.h"
+
+#include "osm/compress.h"
+#include "osm/decompress.h"
+#include "osm/tags.h"
+
+namespace fs = std::filesystem;
+
+namespace osm::bench {
+
+namespace {
+
+constexpr auto const kMaxBlocks = 64U;
+
+// String table of every block: "" (index 0), keys, values, roles.
+constexpr auto const kKeys = std::array<std::string_view, 16U>{
+    "highway", "name",    "building", "amenity",          "surface",
+    "oneway",  "lanes",   "maxspeed", "addr:street",      "addr:housenumber",
+    "landuse", "natural", "source",   "ref",              "type",
+    "route"};
+constexpr auto const kValues = std::array<std::string_view, 24U>{
+    "yes",         "no",          "residential", "primary",  "secondary",
+    "tertiary",    "service",     "footway",     "asphalt",  "paved",
+    "gravel",      "house",       "parking",     "bench",    "restaurant",
+    "30",          "50",          "2",           "forest",   "grass",
+    "Hauptstraße", "Bahnhofstr.", "multipolygon", "bus"};
+constexpr auto const kRoles =
+    std::array<std::string_view, 4U>{"outer", "inner", "stop", "platform"};
+
+constexpr auto const kFirstKey = 1U;
+constexpr auto const kFirstValue = kFirstKey + kKeys.size();
+constexpr auto const kFirstRole = kFirstValue + kValues.size();
+
+struct generator {
+  explicit generator(synthetic_config const& c) : c_{c}, rng_{c.seed_} {}
+
+  std::uint64_t uniform(std::uint64_t const n) { return rng_() % n; }
+
+  void tags(std::vector<std::uint32_t>& keys,
+            std::vector<std::uint32_t>& values) {
+    keys.clear();
+    values.clear();
+    auto const n = 1U + uniform(c_.tags_per_entity_ * 2U - 1U);
+    for (auto i = 0U; i != n; ++i) {
+      keys.emplace_back(kFirstKey + uniform(kKeys.size()));
+      values.emplace_back(kFirstValue + uniform(kValues.size()));
+    }
+  }
+
+  template <typename Builder>
+  static void add_string_table(Builder& block) {
+    auto table = protozero::pbf_builder<string_table>{
+        block, primitive_block::required_StringTable_stringtable};
+    table.add_string(string_table::repeated_bytes_s, "");
+    for (auto const s : kKeys) {
+      table.add_string(string_table::repeated_bytes_s, s.data(), s.size());
+    }
+    for (auto const s : kValues) {
+      table.add_string(string_table::repeated_bytes_s, s.data(), s.size());
+    }
+    for (auto const s : kRoles) {
+      table.add_string(string_table::repeated_bytes_s, s.data(), s.size());
+    }
+  }
+
+  static void delta(std::vector<std::int64_t>& v) {
+    for (auto i = v.size(); i > 1U; --i) {
+      v[i - 1U] -= v[i - 2U];
+    }
+  }
+
+  std::string compress(std::string const& raw) const {
+    auto out = std::string{};
+    auto pb = protozero::pbf_builder<blob>{out};
+    switch (c_.compression_) {
+      case compression::kRaw:
+        pb.add_bytes(blob::optional_bytes_raw, raw);
+        break;
+
+      case compression::kZlib:
+      case compression::kZstd:
+        pb.add_int32(blob::optional_int32_raw_size,
+                     static_cast<std::int32_t>(raw.size()));
+        pb.add_bytes(c_.compression_ == compression::kZlib
+                         ? blob::optional_bytes_zlib_data
+                         : blob::optional_bytes_zstd_data,
+                     osm::compress(c_.compression_, raw));
+        break;
+
+      default:
+        throw utl::fail("synthetic: unsupported compression {}",
+                        static_cast<int>(c_.compression_));
+    }
+    return out;
+  }
+
+  void write_blob(std::string_view type, std::string const& raw) {
+    auto const data = compress(raw);
+    auto header = std::string{};
+    auto pb = protozero::pbf_builder<blob_header>{header};
+    pb.add_string(blob_header::required_string_type, type.data(), type.size());
+    pb.add_int32(blob_header::required_int32_datasize,
+                 static_cast<std::int32_t>(data.size()));
+
+    auto const size = static_cast<std::uint32_t>(header.size());
+    for (auto shift = 24; shift >= 0; shift -= 8) {
+      out_.push_back(static_cast<char>((size >> shift) & 0xFFU));
+    }
+    out_ += header;
+    out_ += data;
+  }
+
+  void header() {
+    auto block = std::string{};
+    auto pb = protozero::pbf_builder<header_block>{block};
+    pb.add_string(header_block::repeated_string_required_features,
+                  "OsmSchema-V0.6");
+    pb.add_string(header_block::repeated_string_required_features,
+                  "DenseNodes");
+    pb.add_string(header_block::repeated_string_optional_features,
+                  "Sort.Type_then_ID");
+    pb.add_string(header_block::optional_string_writingprogram, "osm-bench");
+    write_blob("OSMHeader", block);
+  }
+
+  void nodes(std::size_t const first, std::size_t const n) {
+    auto ids = std::vector<std::int64_t>{};
+    auto lats = std::vector<std::int64_t>{};
+    auto lons = std::vector<std::int64_t>{};
+    auto keys_vals = std::vector<std::int32_t>{};
+    auto keys = std::vector<std::uint32_t>{};
+    auto values = std::vector<std::uint32_t>{};
+    for (auto i = first; i != first + n; ++i) {
+      lat_ += static_cast<std::int64_t>(uniform(2001U)) - 1000;
+      lon_ += static_cast<std::int64_t>(uniform(2001U)) - 1000;
+      ids.emplace_back(node_ids_[i]);
+      lats.emplace_back(lat_);
+      lons.emplace_back(lon_);
+      if (uniform(100U) < c_.tagged_nodes_percent_) {
+        tags(keys, values);
+        for (auto j = 0U; j != keys.size(); ++j) {
+          keys_vals.emplace_back(keys[j]);
+          keys_vals.emplace_back(values[j]);
+        }
+      }
+      keys_vals.emplace_back(0);
+    }
+    delta(ids);
+    delta(lats);
+    delta(lons);
+
+    auto block = std::string{};
+    {
+      auto pb = protozero::pbf_builder<primitive_block>{block};
+      add_string_table(pb);
+      auto group = protozero::pbf_builder<primitive_group>{
+          pb, primitive_block::repeated_PrimitiveGroup_primitivegroup};
+      auto dense = protozero::pbf_builder<dense_nodes>{
+          group, primitive_group::optional_DenseNodes_dense};
+      dense.add_packed_sint64(dense_nodes::packed_sint64_id, begin(ids),
+                              end(ids));
+      dense.add_packed_sint64(dense_nodes::packed_sint64_lat, begin(lats),
+                              end(lats));
+      dense.add_packed_sint64(dense_nodes::packed_sint64_lon, begin(lons),
+                              end(lons));
+      dense.add_packed_int32(dense_nodes::packed_int32_keys_vals,
+                             begin(keys_vals), end(keys_vals));
+    }
+    write_blob("OSMData", block);
+  }
+
+  void ways(std::size_t const first, std::size_t const n) {
+    auto block = std::string{};
+    {
+      auto pb = protozero::pbf_builder<primitive_block>{block};
+      add_string_table(pb);
+      auto group = protozero::pbf_builder<primitive_group>{
+          pb, primitive_block::repeated_PrimitiveGroup_primitivegroup};
+      auto keys = std::vector<std::uint32_t>{};
+      auto values = std::vector<std::uint32_t>{};
+      auto refs = std::vector<std::int64_t>{};
+      for (auto i = first; i != first + n; ++i) {
+        // Runs of consecutive nodes, like real ways.
+        auto const length = 2U + uniform(c_.nodes_per_way_ * 2U - 3U);
+        auto const start = uniform(node_ids_.size() - length);
+        refs.assign(begin(node_ids_) + static_cast<std::ptrdiff_t>(start),
+                    begin(node_ids_) +
+                        static_cast<std::ptrdiff_t>(start + length));
+        delta(refs);
+        tags(keys, values);
+
+        auto w = protozero::pbf_builder<way>{
+            group, primitive_group::repeated_Way_ways};
+        w.add_int64(way::required_int64_id, way_ids_[i]);
+        w.add_packed_uint32(way::packed_uint32_keys, begin(keys), end(keys));
+        w.add_packed_uint32(way::packed_uint32_vals, begin(values),
+                            end(values));
+        w.add_packed_sint64(way::packed_sint64_refs, begin(refs), end(refs));
+      }
+    }
+    write_blob("OSMData", block);
+  }
+
+  void relations(std::size_t const first, std::size_t const n) {
+    auto block = std::string{};
+    {
+      auto pb = protozero::pbf_builder<primitive_block>{block};
+      add_string_table(pb);
+      auto group = protozero::pbf_builder<primitive_group>{
+          pb, primitive_block::repeated_PrimitiveGroup_primitivegroup};
+      auto keys = std::vector<std::uint32_t>{};
+      auto values = std::vector<std::uint32_t>{};
+      auto roles = std::vector<std::int32_t>{};
+      auto memids = std::vector<std::int64_t>{};
+      auto types = std::vector<std::int32_t>{};
+      for (auto i = first; i != first + n; ++i) {
+        roles.clear();
+        memids.clear();
+        types.clear();
+        auto const n_members = 1U + uniform(c_.members_per_relation_ * 2U - 1U);
+        for (auto j = 0U; j != n_members; ++j) {
+          auto const is_way = uniform(4U) != 0U;
+          auto const& ids = is_way ? way_ids_ : node_ids_;
+          memids.emplace_back(ids[uniform(ids.size())]);
+          types.emplace_back(is_way ? 1 : 0);
+          roles.emplace_back(
+              static_cast<std::int32_t>(kFirstRole + uniform(kRoles.size())));
+        }
+        delta(memids);
+        tags(keys, values);
+
+        auto r = protozero::pbf_builder<relation>{
+            group, primitive_group::repeated_Relation_relations};
+        r.add_int64(relation::required_int64_id,
+                    static_cast<std::int64_t>(i + 1U));
+        r.add_packed_uint32(relation::packed_uint32_keys, begin(keys),
+                            end(keys));
+        r.add_packed_uint32(relation::packed_uint32_vals, begin(values),
+                            end(values));
+        r.add_packed_int32(relation::packed_int32_roles_sid, begin(roles),
+                           end(roles));
+        r.add_packed_sint64(relation::packed_sint64_memids, begin(memids),
+                            end(memids));
+        r.add_packed_int32(relation::packed_MemberType_types, begin(types),
+                           end(types));
+      }
+    }
+    write_blob("OSMData", block);
+  }
+
+  std::string generate() {
+    auto const ids = [&](std::size_t const n) {
+      auto v = std::vector<std::int64_t>(n);
+      auto id = std::int64_t{0};
+      for (auto& x : v) {
+        x = (id += 1 + static_cast<std::int64_t>(uniform(3U)));
+      }
+      return v;
+    };
+    node_ids_ = ids(std::max(c_.n_nodes_, std::size_t{64U}));
+    way_ids_ = ids(std::max(c_.n_ways_, std::size_t{1U}));
+
+    auto const blocks = [&](std::size_t const n, auto&& write) {
+      for (auto i = std::size_t{0U}; i < n; i += c_.entities_per_block_) {
+        write(i, std::min(c_.entities_per_block_, n - i));
+      }
+    };
+
+    header();
+    blocks(node_ids_.size(), [&](auto i, auto n) { nodes(i, n); });
+    blocks(c_.n_ways_, [&](auto i, auto n) { ways(i, n); });
+    blocks(c_.n_relations_, [&](auto i, auto n) { relations(i, n); });
+    return std::move(out_);
+  }
+
+  synthetic_config const& c_;
+  std::mt19937_64 rng_;
+  std::vector<std::int64_t> node_ids_, way_ids_;
+  std::int64_t lat_{500'000'000}, lon_{80'000'000};  // 50N 8E
+  std::string out_;
+};
+
+}  // namespace
+
+std::string generate_pbf(synthetic_config const& c) {
+  return generator{c}.generate();
+}
+
+fs::path synthetic_pbf(synthetic_config const& c) {
+  auto const path =
+      fs::temp_directory_path() /
+      fmt::format("osm-bench-{}-{}-{}-{}-{}-{}-{}-{}-{}-{}.osm.pbf",
+                  c.n_nodes_, c.n_ways_, c.n_relations_, c.entities_per_block_,
+                  c.tagged_nodes_percent_, c.tags_per_entity_,
+                  c.nodes_per_way_, c.members_per_relation_,
+                  static_cast<int>(c.compression_), c.seed_);
+  if (!fs::exists(path)) {
+    auto tmp = path;
+    tmp += fmt::format(".{}.tmp", std::random_device{}());
+    {
+      auto const pbf = generate_pbf(c);
+      auto out = std::ofstream{tmp, std::ios::binary};
+      out.write(pbf.data(), static_cast<std::streamsize>(pbf.size()));
+      utl::verify(out.good(), "synthetic: could not write {}", tmp.string());
+    }
+    fs::rename(tmp, path);
+  }
+  return path;
+}
+
+fs::path bench_pbf() {
+  auto const path = std::getenv("OSM_BENCH_PBF");
+  return path == nullptr ? synthetic_pbf() : fs::path{path};
+}
+
+std::vector<std::string> const& raw_blocks() {
+  static auto const blocks = []() {
+    auto r = raw_reader{.file_ = cista::mmap{bench_pbf().string().c_str(),
+                                             cista::mmap::protection::READ}};
+    auto bufs = std::vector<buf>{};
+    auto b = std::optional<buf>{};
+    while ((b = r.read()).has_value()) {
+      if (b->type_ == blob_type::kData) {
+        bufs.emplace_back(*b);
+      }
+    }
+
+    // Evenly spread over the file: nodes, ways and relations.
+    auto blocks = std::vector<std::string>{};
+    auto d = decompressor{};
+    auto const n = std::min(bufs.size(), std::size_t{kMaxBlocks});
+    for (auto i = std::size_t{0U}; i != n; ++i) {
+      auto out = std::string{};
+      blocks.emplace_back(d.decompress(bufs[i * bufs.size() / n], out));
+    }
+    return blocks;
+  }();
+  return blocks;
+}
+
+}  // namespace osm::bench
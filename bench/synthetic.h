@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cinttypes>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "osm/osm.h"
+
+namespace osm::bench {
+
+// Deterministic synthetic PBF file: same config, same uncompressed blocks on
+// every platform (the compressed bytes depend on the zlib / zstd version).
+// Nodes (DenseNodes), then ways, then relations, sorted by ID.
+struct synthetic_config {
+  std::size_t n_nodes_{2'000'000U};
+  std::size_t n_ways_{250'000U};
+  std::size_t n_relations_{10'000U};
+  std::size_t entities_per_block_{8'000U};
+
+  unsigned tagged_nodes_percent_{10U};
+  unsigned tags_per_entity_{4U};
+  unsigned nodes_per_way_{12U};
+  unsigned members_per_relation_{10U};
+
+  compression compression_{compression::kZlib};
+  std::uint64_t seed_{42U};
+};
+
+std::string generate_pbf(synthetic_config const&);
+
+// Writes the file to the temp directory (once per config and process).
+std::filesystem::path synthetic_pbf(synthetic_config const& = {});
+
+// Decompressed data blocks of the file given by the OSM_BENCH_PBF
+// environment variable, or of synthetic_pbf() if it is not set (identical
+// on every platform).
+std::vector<std::string> const& raw_blocks();
+
+// OSM_BENCH_PBF or synthetic_pbf().
+std::filesystem::path bench_pbf();
+
+}  // namespace osm::bench
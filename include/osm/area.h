@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cinttypes>
+#include <filesystem>
+#include <functional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "geo/polygon.h"
+
+#include "osm/location.h"
+#include "osm/read_config.h"
+
+namespace osm {
+
+// Area of a multipolygon / boundary relation: one polygon per outer ring,
+// each with the inner rings directly inside it.
+struct area {
+  std::int64_t relation_id_;
+  std::vector<std::pair<std::string, std::string>> tags_;
+  std::vector<geo::polygon> polygons_;
+};
+
+struct area_config {
+  // Threads, index use, etc. for all passes. The tag filter (if any) only
+  // selects relations.
+  read_config read_{};
+
+  // Values of the relation's "type" tag to assemble.
+  std::vector<std::string> types_{"multipolygon", "boundary"};
+};
+
+struct area_stats {
+  std::size_t relations_{0U};
+  std::size_t assembled_{0U};
+  std::size_t incomplete_{0U};  // member way or node missing (extracts)
+  std::size_t invalid_{0U};  // rings could not be closed
+};
+
+// Rings from member ways, given as node ID sequences with their locations.
+// Ways are joined at shared end nodes. Nesting (not the member roles)
+// decides inner / outer: rings at even depth are outer, rings at odd depth
+// are inner rings of the smallest enclosing ring. Returns no polygon if a
+// ring cannot be closed.
+std::vector<geo::polygon> assemble_rings(
+    std::span<std::vector<std::int64_t> const> way_nodes,
+    std::span<std::vector<location> const> way_locations);
+
+// Multi-pass assembler:
+//   1. relations: keeps the relations of the configured types and the IDs
+//      of their member ways,
+//   2. ways: keeps only member ways (with their locations if the file has
+//      LocationsOnWays),
+//   3. nodes: keeps only locations of nodes of member ways (skipped for
+//      LocationsOnWays),
+//   4. assembles the rings of all relations on read_.n_threads_ threads.
+// `f` is called concurrently from the assembly threads.
+area_stats assemble_areas(std::filesystem::path const& pbf,
+                          area_config const&,
+                          std::function<void(area const&)> const& f);
+
+}  // namespace osm
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cinttypes>
+#include <filesystem>
+#include <optional>
+
+#include "cista/containers/vector.h"
+#include "cista/mmap.h"
+
+#include "osm/osm.h"
+#include "osm/read_config.h"
+
+namespace osm {
+
+// Blob of the cached file. Data blobs are stored inflated (kRaw) or zstd
+// compressed, the OSMHeader blob as in the file.
+struct cached_blob {
+  blob_type type_;
+  compression compression_;
+  std::uint64_t idx_;  // buf::idx_
+  std::uint64_t offset_;  // buf::offset_ (in the PBF file)
+  std::uint64_t begin_;  // in the data file
+  std::uint64_t size_;
+  std::uint64_t raw_size_;
+};
+
+// Cache entry of one PBF file: "<key>.idx" (this, cista serialized) and
+// "<key>.blocks" (blob data). The key is derived from the canonical path,
+// size and modification time of the PBF file.
+struct block_cache_index {
+  std::uint64_t file_size_;
+  std::int64_t file_mtime_;
+
+  // Also stored in the first 8 bytes of the data file: an index is only
+  // used with the data file written in the same run.
+  std::uint64_t nonce_;
+  std::uint64_t data_size_;
+
+  cista::offset::vector<cached_blob> blobs_;
+};
+
+// Memory mapped cache entry.
+struct block_cache_file {
+  block_cache_index const* operator->() const { return index_; }
+  block_cache_index const& operator*() const { return *index_; }
+
+  cista::mmap index_mem_;
+  block_cache_index const* index_;
+  cista::mmap data_;
+};
+
+// Returns nullopt if there is no valid entry for the PBF file. Marks the
+// entry as recently used.
+std::optional<block_cache_file> read_block_cache(
+    std::filesystem::path const& pbf, block_cache_config const&);
+
+// Reads the entry, builds it first if necessary (inflating all blocks on
+// c.n_threads_ threads). Processes wanting the same entry wait for the one
+// building it (flock). Evicts least recently used entries afterwards.
+// Returns nullopt if the entry alone exceeds max_size_.
+std::optional<block_cache_file> ensure_block_cache(
+    std::filesystem::path const& pbf,
+    block_cache_config const&,
+    read_config const& c = {});
+
+// Deletes least recently used entries until all entries fit max_size_.
+// Also removes lock files of entries that no longer exist.
+void evict(block_cache_config const&);
+
+// Reads the cached blobs in file order. Usable with read() /
+// read_ordered() in place of a raw_reader.
+struct block_cache_reader {
+  std::optional<buf> read() {
+    if (next_ == f_->blobs_.size()) {
+      return std::nullopt;
+    }
+    auto const& b = f_->blobs_[next_++];
+    return buf{.type_ = b.type_,
+               .compression_ = b.compression_,
+               .idx_ = b.idx_,
+               .offset_ = b.offset_,
+               .raw_size_ = b.raw_size_,
+               .compressed_ = f_.data_.view().substr(b.begin_, b.size_)};
+  }
+
+  std::size_t offset() const {
+    return next_ == f_->blobs_.size() ? size() : f_->blobs_[next_].begin_;
+  }
+  std::size_t size() const { return f_.data_.size(); }
+
+  block_cache_file const& f_;
+  std::size_t next_{0U};
+};
+
+}  // namespace osm
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cinttypes>
+#include <filesystem>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "cista/containers/vector.h"
+#include "cista/mmap.h"
+
+#include "osm/decoder.h"
+#include "osm/osm.h"
+#include "osm/read_config.h"
+
+namespace osm {
+
+struct block_info {
+  bool contains(std::int64_t const id) const {
+    return id >= min_id_ && id <= max_id_;
+  }
+
+  osm::bbox box() const {
+    return {.min_ = {min_lat_, min_lon_}, .max_ = {max_lat_, max_lon_}};
+  }
+
+  std::uint64_t offset_;  // buf::offset_
+  std::uint64_t idx_;  // buf::idx_
+  std::uint32_t compressed_size_;
+  std::uint32_t raw_size_;
+  entity_kind kinds_;
+  std::int64_t min_id_{std::numeric_limits<std::int64_t>::max()};
+  std::int64_t max_id_{std::numeric_limits<std::int64_t>::min()};
+
+  // Bounding box of the nodes in the block (empty for way/relation blocks),
+  // fixed point with kFixedPointFactor.
+  std::int32_t min_lat_{std::numeric_limits<std::int32_t>::max()};
+  std::int32_t min_lon_{std::numeric_limits<std::int32_t>::max()};
+  std::int32_t max_lat_{std::numeric_limits<std::int32_t>::min()};
+  std::int32_t max_lon_{std::numeric_limits<std::int32_t>::min()};
+};
+
+// Sidecar index over the data blobs of a PBF file.
+// Only valid as long as size and modification time of the PBF match.
+struct block_index {
+  std::uint64_t file_size_;
+  std::int64_t file_mtime_;
+  cista::offset::vector<block_info> blocks_;
+};
+
+// Read-only view of a memory mapped block index file.
+struct block_index_file {
+  block_index const* operator->() const { return index_; }
+  block_index const& operator*() const { return *index_; }
+
+  cista::mmap mem_;
+  block_index const* index_;
+};
+
+std::filesystem::path default_index_path(std::filesystem::path const& pbf);
+
+// Decodes every block of the file (in parallel) to collect the block info.
+// Only threading and buffer settings of the config are used: kinds, filter
+// and bbox are ignored.
+block_index build_block_index(std::filesystem::path const& pbf,
+                              read_config const& = {});
+
+void write_block_index(block_index const&, std::filesystem::path const& out);
+
+// Returns nullopt if the index file does not exist, cannot be read or does
+// not match the PBF file (size / modification time).
+std::optional<block_index_file> read_block_index(
+    std::filesystem::path const& index, std::filesystem::path const& pbf);
+
+// Reads the index from default_index_path(pbf), (re)builds it if necessary.
+block_index_file ensure_block_index(std::filesystem::path const& pbf,
+                                    read_config const& = {});
+
+template <typename Pred>
+std::vector<block_info> select_blocks(block_index const& idx, Pred&& pred) {
+  auto selected = std::vector<block_info>{};
+  for (auto const& b : idx.blocks_) {
+    if (pred(b)) {
+      selected.emplace_back(b);
+    }
+  }
+  return selected;
+}
+
+inline std::vector<block_info> select_blocks(block_index const& idx,
+                                             entity_kind const kinds) {
+  return select_blocks(
+      idx, [&](block_info const& b) { return intersects(b.kinds_, kinds); });
+}
+
+// Blocks that (may) contain IDs in [from, to] of the given kinds.
+inline std::vector<block_info> select_blocks(block_index const& idx,
+                                             entity_kind const kinds,
+                                             std::int64_t const from,
+                                             std::int64_t const to) {
+  return select_blocks(idx, [&](block_info const& b) {
+    return intersects(b.kinds_, kinds) && b.min_id_ <= to && b.max_id_ >= from;
+  });
+}
+
+// Reads only the selected blobs, without touching the ones in between.
+// Usable with read() / read_ordered() in place of a raw_reader.
+struct indexed_reader {
+  std::optional<buf> read() {
+    if (next_ == selected_.size()) {
+      return std::nullopt;
+    }
+    auto const& b = selected_[next_++];
+    r_.seek(b.offset_, b.idx_);
+    return r_.read();
+  }
+
+  std::size_t offset() const { return r_.offset(); }
+  std::size_t size() const { return r_.size(); }
+
+  raw_reader& r_;
+  std::vector<block_info> selected_;
+  std::size_t next_{0U};
+};
+
+}  // namespace osm
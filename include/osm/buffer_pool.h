@@ -0,0 +1,83 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace osm {
+
+// Decompression buffers under a global byte budget, shareable between
+// several concurrent read() calls.
+//
+// acquire(n) blocks while the bytes leased out plus n exceed the budget
+// (backpressure on the reading thread). A single request larger than the
+// budget is granted once nothing else is leased out. Released buffers keep
+// their capacity for reuse as long as leased + idle capacity stays within
+// the budget, otherwise they are freed.
+struct buffer_pool {
+  struct lease {
+    lease() = default;
+    lease(buffer_pool* pool, std::size_t size, std::string buf)
+        : pool_{pool}, size_{size}, buf_{std::move(buf)} {}
+
+    lease(lease const&) = delete;
+    lease& operator=(lease const&) = delete;
+
+    lease(lease&& o) noexcept
+        : pool_{std::exchange(o.pool_, nullptr)},
+          size_{o.size_},
+          buf_{std::move(o.buf_)} {}
+
+    lease& operator=(lease&& o) noexcept {
+      if (this != &o) {
+        reset();
+        pool_ = std::exchange(o.pool_, nullptr);
+        size_ = o.size_;
+        buf_ = std::move(o.buf_);
+      }
+      return *this;
+    }
+
+    ~lease() { reset(); }
+
+    void reset() {
+      if (pool_ != nullptr) {
+        std::exchange(pool_, nullptr)->release(size_, std::move(buf_));
+      }
+    }
+
+    buffer_pool* pool_{nullptr};
+    std::size_t size_{0U};
+    std::string buf_;
+  };
+
+  explicit buffer_pool(std::size_t budget) : budget_{budget} {}
+
+  buffer_pool(buffer_pool const&) = delete;
+  buffer_pool& operator=(buffer_pool const&) = delete;
+
+  // Blocks until n bytes are available. Returns nullopt if stop was
+  // requested while waiting.
+  std::optional<lease> acquire(std::size_t n, std::stop_token stop = {});
+
+  std::size_t leased() const;
+  std::size_t idle() const;  // capacity of the cached buffers
+  std::size_t peak() const;  // maximum of leased()
+
+private:
+  void release(std::size_t n, std::string buf);
+
+  std::size_t budget_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable_any cv_;
+  std::size_t leased_{0U}, idle_{0U}, peak_{0U};
+  std::vector<std::string> free_;
+};
+
+}  // namespace osm
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cinttypes>
+#include <memory>
+#include <span>
+#include <string_view>
+
+namespace osm {
+
+// Decodes all varints of a packed field into `out`, which needs room for
+// in.size() values (each varint has at least one byte). Returns the number
+// of decoded values. Uses an AVX2/BMI2 decoder if the CPU supports it
+// (checked once at runtime, without pext on AMD Zen 1 / Zen 2), a scalar
+// loop otherwise.
+std::size_t decode_varints(std::string_view in, std::int64_t* out);
+
+// In place zigzag decoding of raw varint values.
+void decode_zigzag(std::int64_t* data, std::size_t n);
+
+// In place inclusive prefix sum: delta coded values to absolute values.
+void prefix_sum(std::int64_t* data, std::size_t n);
+
+// Growable array that leaves its contents uninitialized. Reused across
+// blocks so decoding a packed field does not allocate.
+struct int_buffer {
+  std::int64_t* get(std::size_t const n) {
+    if (n > capacity_) {
+      data_ = std::make_unique_for_overwrite<std::int64_t[]>(n);
+      capacity_ = n;
+    }
+    return data_.get();
+  }
+
+  std::unique_ptr<std::int64_t[]> data_;
+  std::size_t capacity_{0U};
+};
+
+// Bulk replacement for iterating varint<T, Delta>.
+template <bool ZigZag, bool Delta>
+std::span<std::int64_t const> decode_packed(std::string_view in,
+                                            int_buffer& buf) {
+  auto const data = buf.get(in.size());
+  auto const n = decode_varints(in, data);
+  if constexpr (ZigZag) {
+    decode_zigzag(data, n);
+  }
+  if constexpr (Delta) {
+    prefix_sum(data, n);
+  }
+  return {data, n};
+}
+
+}  // namespace osm
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "osm/osm.h"
+
+namespace osm {
+
+// Compresses a block for a blob with the given compression (kRaw: copy).
+// Supported: kRaw, kZlib and kZstd (OSM_WITH_ZSTD). level < 0 selects the
+// backend's default level.
+std::string compress(compression, std::string_view block, int level = -1);
+
+}  // namespace osm
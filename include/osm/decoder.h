@@ -1,6 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <ranges>
+#include <span>
+#include <type_traits>
 #include <string_view>
 #include <vector>
 
@@ -11,6 +16,10 @@
 #include "utl/verify.h"
 #include "utl/zip.h"
 
+#include "osm/bulk_varint.h"
+#include "osm/location.h"
+#include "osm/string_interner.h"
+#include "osm/tag_filter.h"
 #include "osm/tags.h"
 #include "osm/varint.h"
 
@@ -21,30 +30,366 @@ constexpr auto const kNanoDegree = 1'000'000'000.0;
 
 enum member_type : std::uint32_t { kNode, kWay, kRelation };
 
+// Bit set of entity kinds contained in a primitive block.
+enum class entity_kind : std::uint8_t {
+  kNone = 0U,
+  kNodes = 1U << 0U,
+  kWays = 1U << 1U,
+  kRelations = 1U << 2U,
+  kAll = kNodes | kWays | kRelations
+};
+
+constexpr entity_kind operator|(entity_kind const a, entity_kind const b) {
+  return static_cast<entity_kind>(static_cast<std::uint8_t>(a) |
+                                  static_cast<std::uint8_t>(b));
+}
+
+constexpr entity_kind operator&(entity_kind const a, entity_kind const b) {
+  return static_cast<entity_kind>(static_cast<std::uint8_t>(a) &
+                                  static_cast<std::uint8_t>(b));
+}
+
+constexpr bool intersects(entity_kind const a, entity_kind const b) {
+  return (a & b) != entity_kind::kNone;
+}
+
+// In files sorted by type (nodes, ways, relations): whether no block after
+// one containing `block` can contain any of `wanted`.
+constexpr bool all_after(entity_kind const block, entity_kind const wanted) {
+  auto const b = static_cast<std::uint8_t>(block);
+  auto const w = static_cast<std::uint8_t>(wanted);
+  return b != 0U && w != 0U && (b & (~b + 1U)) > std::bit_floor(w);
+}
+
+// Entity kinds and fields decode_primitive passes to the callbacks. Fields
+// outside the mask are skipped at the protobuf level and passed empty.
+enum class field : std::uint16_t {
+  kNone = 0U,
+  kNodes = 1U << 0U,
+  kNodeTags = 1U << 1U,
+  kWays = 1U << 2U,
+  kWayRefs = 1U << 3U,
+  kWayTags = 1U << 4U,
+  kRelations = 1U << 5U,
+  kRelationMembers = 1U << 6U,
+  kRelationTags = 1U << 7U,
+  kAll = (1U << 8U) - 1U,
+
+  // Representation flags, not in kAll:
+  //   kTagIds: tags as (key_id, value_id) pairs of decode_state::interner_
+  //            instead of strings,
+  //   kFixedPoint: node positions as fixed point `location` instead of
+  //            geo::latlng.
+  kTagIds = 1U << 8U,
+  kFixedPoint = 1U << 9U
+};
+
+constexpr field operator|(field const a, field const b) {
+  return static_cast<field>(static_cast<std::uint16_t>(a) |
+                            static_cast<std::uint16_t>(b));
+}
+
+constexpr field operator&(field const a, field const b) {
+  return static_cast<field>(static_cast<std::uint16_t>(a) &
+                            static_cast<std::uint16_t>(b));
+}
+
+constexpr bool has(field const mask, field const f) {
+  return (mask & f) != field::kNone;
+}
+
+// Raw block coordinates to fixed point (kFixedPointFactor) coordinates.
+inline void to_fixed(std::span<std::int64_t const> in,
+                     std::int64_t const offset,
+                     std::int64_t const granularity,
+                     std::int32_t* out) {
+  if (offset % kNanoPerFixed == 0 && granularity % kNanoPerFixed == 0) {
+    // Common case (granularity 100, offset 0): no division, vectorizes.
+    auto const o = offset / kNanoPerFixed;
+    auto const g = granularity / kNanoPerFixed;
+    for (auto i = std::size_t{0U}; i != in.size(); ++i) {
+      out[i] = static_cast<std::int32_t>(o + in[i] * g);
+    }
+  } else {
+    for (auto i = std::size_t{0U}; i != in.size(); ++i) {
+      out[i] = nano_to_fixed(offset + in[i] * granularity);
+    }
+  }
+}
+
 struct meta_data {
   geo::latlng to_latlng(std::int64_t const lat, std::int64_t const lon) const {
     return {(lat_offset_ + lat * granularity_) / kNanoDegree,
             (lon_offset_ + lon * granularity_) / kNanoDegree};
   }
 
+  location to_location(std::int64_t const lat, std::int64_t const lon) const {
+    return {nano_to_fixed(lat_offset_ + lat * granularity_),
+            nano_to_fixed(lon_offset_ + lon * granularity_)};
+  }
+
+  // Node position as passed to node callbacks.
+  template <field Fields>
+  auto position(std::int64_t const lat, std::int64_t const lon) const {
+    if constexpr (has(Fields, field::kFixedPoint)) {
+      return to_location(lat, lon);
+    } else {
+      return to_latlng(lat, lon);
+    }
+  }
+
   std::int32_t granularity_{100U};
   std::int64_t lat_offset_;
   std::int64_t lon_offset_;
 };
 
-void decode_string_table(std::string_view s,
-                         std::vector<std::string_view>& strings) {
+// Nodes of a primitive group as columns, for node callbacks taking
+// `node_batch const&` instead of (id, position, tags).
+struct node_batch {
+  std::size_t size() const { return ids_.size(); }
+
+  // Tags of the i-th node as (key, value) string pairs.
+  auto tags(std::size_t const i) const {
+    return std::views::iota(tag_offsets_[i], tag_offsets_[i + 1U]) |
+           std::views::transform(
+               [kv = keys_vals_, strings = strings_](std::uint32_t const j) {
+                 return std::tuple{strings[kv[2U * j]],
+                                   strings[kv[2U * j + 1U]]};
+               });
+  }
+
+  std::span<std::int64_t const> ids_;
+
+  // Fixed point, see kFixedPointFactor.
+  std::span<std::int32_t const> lats_;
+  std::span<std::int32_t const> lons_;
+
+  // Tags of the i-th node as (key_id, value_id) pairs (field::kTagIds).
+  auto tag_ids(std::size_t const i) const {
+    return std::views::iota(tag_offsets_[i], tag_offsets_[i + 1U]) |
+           std::views::transform(
+               [kv = keys_vals_, ids = string_ids_](std::uint32_t const j) {
+                 return std::tuple{ids[kv[2U * j]], ids[kv[2U * j + 1U]]};
+               });
+  }
+
+  // Tags of node i: pairs [tag_offsets_[i], tag_offsets_[i + 1]) in
+  // keys_vals_, which holds (key, value) string table indices.
+  std::span<std::uint32_t const> tag_offsets_;
+  std::span<std::uint32_t const> keys_vals_;
+  std::span<std::string_view const> strings_;
+
+  // String table index -> interned ID, only with field::kTagIds.
+  std::span<std::uint32_t const> string_ids_;
+};
+
+// Node callbacks taking one node_batch. Variadic callbacks, like
+// [](auto&&...) {}, also accept a second argument and do not count.
+template <typename Fn>
+constexpr auto const is_node_batch_fn =
+    std::is_invocable_v<Fn&, node_batch const&> &&
+    !std::is_invocable_v<Fn&, node_batch const&, node_batch const&>;
+
+// Tags as (key, value) strings from key / value string table indices.
+inline auto make_tags(varint<std::uint32_t> keys,
+                      varint<std::uint32_t> values,
+                      std::vector<std::string_view> const& strings) {
+  return std::views::zip(std::move(keys), std::move(values)) |
+         std::views::transform([&strings](auto&& x) {
+           return std::tuple{strings.at(std::get<0>(x)),
+                             strings.at(std::get<1>(x))};
+         });
+}
+
+using tags_t = decltype(make_tags(
+    {}, {}, std::declval<std::vector<std::string_view> const&>()));
+
+// Tags as (key_id, value_id) from key / value string table indices and the
+// interned IDs of the string table.
+inline auto make_tag_ids(varint<std::uint32_t> keys,
+                         varint<std::uint32_t> values,
+                         std::vector<std::uint32_t> const& ids) {
+  return std::views::zip(std::move(keys), std::move(values)) |
+         std::views::transform([&ids](auto&& x) {
+           return std::tuple{ids.at(std::get<0>(x)), ids.at(std::get<1>(x))};
+         });
+}
+
+using tag_ids_t = decltype(make_tag_ids(
+    {}, {}, std::declval<std::vector<std::uint32_t> const&>()));
+
+// Relation members as (ref, role, member_type).
+inline auto make_members(std::span<std::int64_t const> refs,
+                         varint<std::uint32_t> roles,
+                         varint<std::uint32_t> types,
+                         std::vector<std::string_view> const& strings) {
+  return std::views::zip(refs, std::move(roles), std::move(types)) |
+         std::views::transform([&strings](auto&& x) {
+           auto const [ref, role, type] = x;
+           return std::tuple{ref, strings.at(role), member_type{type}};
+         });
+}
+
+using members_t = decltype(make_members(
+    {}, {}, {}, std::declval<std::vector<std::string_view> const&>()));
+
+// Dense node tags: interleaved key / value indices of one node.
+inline auto make_dense_tags(varint<std::uint32_t> keys_vals,
+                            std::vector<std::string_view> const& strings) {
+  return std::move(keys_vals) | std::views::chunk(2) |
+         std::views::transform([&strings](auto&& y) {
+           auto it = std::ranges::begin(y);
+           auto const k = *it;
+           auto const v = *++it;
+           return std::tuple{strings.at(k), strings.at(v)};
+         });
+}
+
+inline auto make_dense_tag_ids(varint<std::uint32_t> keys_vals,
+                               std::vector<std::uint32_t> const& ids) {
+  return std::move(keys_vals) | std::views::chunk(2) |
+         std::views::transform([&ids](auto&& y) {
+           auto it = std::ranges::begin(y);
+           auto const k = *it;
+           auto const v = *++it;
+           return std::tuple{ids.at(k), ids.at(v)};
+         });
+}
+
+// Callbacks accepting any number of arguments, like [](auto&&...) {}.
+// Checked with one argument too many: fixed arity callbacks fail on the
+// arity alone, without instantiating their body.
+template <typename Fn>
+constexpr auto const is_variadic_fn =
+    std::is_invocable_v<Fn&, std::uint64_t, std::span<std::int64_t const>,
+                        std::span<location const>, tags_t const&,
+                        std::span<location const>>;
+
+// Way callbacks taking (id, refs, locations, tags) get the inline way
+// geometry of LocationsOnWays files. Variadic callbacks do not count.
+template <typename Fn>
+constexpr auto const is_way_locations_fn =
+    !is_variadic_fn<Fn> &&
+    (std::is_invocable_v<Fn&, std::uint64_t, std::span<std::int64_t const>,
+                         std::span<location const>, tags_t const&> ||
+     std::is_invocable_v<Fn&, std::uint64_t, std::span<std::int64_t const>,
+                         std::span<location const>, tag_ids_t const&>);
+
+// Callback for entity kinds that should not be decoded at all.
+struct no_callback {};
+
+template <typename Fn>
+constexpr auto const is_no_callback =
+    std::is_same_v<std::remove_cvref_t<Fn>, no_callback>;
+
+// Callbacks without the tags parameter: (id, position), (id, refs) and
+// (id, members).
+template <typename Fn>
+constexpr auto const is_node_fn_without_tags =
+    std::is_invocable_v<Fn&, std::int64_t, geo::latlng const&> ||
+    std::is_invocable_v<Fn&, std::int64_t, location>;
+
+template <typename Fn>
+constexpr auto const is_way_fn_without_tags =
+    std::is_invocable_v<Fn&, std::uint64_t, std::span<std::int64_t const>>;
+
+template <typename Fn>
+constexpr auto const is_relation_fn_without_tags =
+    std::is_invocable_v<Fn&, std::uint64_t, members_t const&>;
+
+// Fields the callbacks can consume: no_callback drops the kind, callbacks
+// without tags parameter drop the tags.
+template <typename NodeFn, typename WayFn, typename RelFn>
+constexpr field detect_fields() {
+  auto f = field::kNone;
+  if constexpr (!is_no_callback<NodeFn>) {
+    f = f | field::kNodes;
+    if constexpr (is_node_batch_fn<NodeFn> ||
+                  !is_node_fn_without_tags<NodeFn>) {
+      f = f | field::kNodeTags;
+    }
+  }
+  if constexpr (!is_no_callback<WayFn>) {
+    f = f | field::kWays | field::kWayRefs;
+    if constexpr (!is_way_fn_without_tags<WayFn>) {
+      f = f | field::kWayTags;
+    }
+  }
+  if constexpr (!is_no_callback<RelFn>) {
+    f = f | field::kRelations | field::kRelationMembers;
+    if constexpr (!is_relation_fn_without_tags<RelFn>) {
+      f = f | field::kRelationTags;
+    }
+  }
+  return f;
+}
+
+// Fields & detect_fields<...>(), keeping the representation flags.
+template <field Fields, typename NodeFn, typename WayFn, typename RelFn>
+constexpr field effective_fields() {
+  return Fields & (detect_fields<NodeFn, WayFn, RelFn>() | field::kTagIds |
+                   field::kFixedPoint);
+}
+
+// Per-thread state of decode_primitive, reused across blocks.
+struct decode_state {
+  std::vector<std::string_view> strings_;
+
+  // Required for field::kTagIds: string table index -> interned ID.
+  string_interner* interner_{nullptr};
+  std::vector<std::uint32_t> string_ids_;
+
+  int_buffer ids_, lats_, lons_, refs_, tags_;
+  std::vector<std::int32_t> fixed_lats_, fixed_lons_;
+  std::vector<std::uint32_t> tag_offsets_, keys_vals_;
+  std::vector<location> way_locations_;
+
+  // Optional: only entities with a matching tag are passed to the callbacks.
+  tag_filter const* filter_{nullptr};
+  block_tag_filter block_filter_;
+};
+
+// Tags in the representation selected by Fields.
+template <field Fields>
+auto make_entity_tags(varint<std::uint32_t> keys,
+                      varint<std::uint32_t> values,
+                      decode_state const& state) {
+  if constexpr (has(Fields, field::kTagIds)) {
+    return make_tag_ids(std::move(keys), std::move(values), state.string_ids_);
+  } else {
+    return make_tags(std::move(keys), std::move(values), state.strings_);
+  }
+}
+
+template <field Fields>
+auto make_entity_dense_tags(varint<std::uint32_t> keys_vals,
+                            decode_state const& state) {
+  if constexpr (has(Fields, field::kTagIds)) {
+    return make_dense_tag_ids(std::move(keys_vals), state.string_ids_);
+  } else {
+    return make_dense_tags(std::move(keys_vals), state.strings_);
+  }
+}
+
+inline void decode_string_table(std::string_view s,
+                                std::vector<std::string_view>& strings,
+                                block_tag_filter* filter = nullptr) {
   auto pbf_string_table = protozero::pbf_message<string_table>{s};
   while (pbf_string_table.next(string_table::repeated_bytes_s,
                                protozero::pbf_wire_type::length_delimited)) {
     const auto str_view = pbf_string_table.get_view();
     utl_verify(str_view.length() < kMaxStringLength, "bad string {}", str_view);
+    if (filter != nullptr) {
+      filter->add_string(static_cast<std::uint32_t>(strings.size()), str_view);
+    }
     strings.emplace_back(str_view);
   }
 }
 
-meta_data decode_primitive_block_metadata(
-    std::string_view s, std::vector<std::string_view>& strings) {
+inline meta_data decode_primitive_block_metadata(
+    std::string_view s,
+    std::vector<std::string_view>& strings,
+    block_tag_filter* filter = nullptr) {
   auto m = meta_data{};
   auto pbf_primitive_block = protozero::pbf_message<primitive_block>{s};
   while (pbf_primitive_block.next()) {
@@ -52,7 +397,7 @@ meta_data decode_primitive_block_metadata(
       case protozero::tag_and_type(
           primitive_block::required_StringTable_stringtable,
           protozero::pbf_wire_type::length_delimited):
-        decode_string_table(pbf_primitive_block.get_view(), strings);
+        decode_string_table(pbf_primitive_block.get_view(), strings, filter);
         break;
 
       case protozero::tag_and_type(primitive_block::optional_int32_granularity,
@@ -73,67 +418,205 @@ meta_data decode_primitive_block_metadata(
       default: pbf_primitive_block.skip();
     }
   }
+  if (filter != nullptr) {
+    filter->finish(strings.size());
+  }
   return m;
 }
 
-template <typename Fn>
-void decode_dense_nodes(std::string_view s,
-                        std::vector<std::string_view> const& strings,
-                        meta_data const& meta,
-                        Fn&& f) {
-  auto ids = delta_varint<std::int64_t>{};
-  auto lats = delta_varint<std::int64_t>{};
-  auto lons = delta_varint<std::int64_t>{};
-  auto tags = std::string_view{};
+struct dense_nodes_fields {
+  std::string_view ids_, lats_, lons_, tags_;
+};
 
+inline dense_nodes_fields parse_dense_nodes(std::string_view s) {
+  auto fields = dense_nodes_fields{};
   auto pbf_dense_nodes = protozero::pbf_message<dense_nodes>{s};
   while (pbf_dense_nodes.next()) {
     switch (pbf_dense_nodes.tag_and_type()) {
       case protozero::tag_and_type(dense_nodes::packed_sint64_id,
                                    protozero::pbf_wire_type::length_delimited):
-        ids = {pbf_dense_nodes.get_view()};
+        fields.ids_ = pbf_dense_nodes.get_view();
         break;
 
       case protozero::tag_and_type(dense_nodes::packed_sint64_lat,
                                    protozero::pbf_wire_type::length_delimited):
-        lats = {pbf_dense_nodes.get_view()};
+        fields.lats_ = pbf_dense_nodes.get_view();
         break;
 
       case protozero::tag_and_type(dense_nodes::packed_sint64_lon,
                                    protozero::pbf_wire_type::length_delimited):
-        lons = {pbf_dense_nodes.get_view()};
+        fields.lons_ = pbf_dense_nodes.get_view();
         break;
 
       case protozero::tag_and_type(dense_nodes::packed_int32_keys_vals,
                                    protozero::pbf_wire_type::length_delimited):
-        tags = pbf_dense_nodes.get_view();
+        fields.tags_ = pbf_dense_nodes.get_view();
         break;
 
       default: pbf_dense_nodes.skip();
     }
   }
+  return fields;
+}
+
+template <field Fields, typename Fn>
+void decode_dense_nodes(std::string_view s,
+                        decode_state& state,
+                        meta_data const& meta,
+                        Fn&& f) {
+  constexpr auto const kTags = has(Fields, field::kNodeTags);
+  auto const fields = parse_dense_nodes(s);
+  auto const id = decode_packed<true, true>(fields.ids_, state.ids_);
+  auto const lat = decode_packed<true, true>(fields.lats_, state.lats_);
+  auto const lon = decode_packed<true, true>(fields.lons_, state.lons_);
+  utl::verify(id.size() == lat.size() && id.size() == lon.size(),
+              "dense nodes: {} ids, {} lats, {} lons", id.size(), lat.size(),
+              lon.size());
+
+  // Fixed point: convert the whole group at once (vectorized to_fixed).
+  if constexpr (has(Fields, field::kFixedPoint)) {
+    state.fixed_lats_.resize(lat.size());
+    state.fixed_lons_.resize(lon.size());
+    to_fixed(lat, meta.lat_offset_, meta.granularity_,
+             state.fixed_lats_.data());
+    to_fixed(lon, meta.lon_offset_, meta.granularity_,
+             state.fixed_lons_.data());
+  }
+  auto const pos = [&](std::size_t const i) {
+    if constexpr (has(Fields, field::kFixedPoint)) {
+      return location{state.fixed_lats_[i], state.fixed_lons_[i]};
+    } else {
+      return meta.to_latlng(lat[i], lon[i]);
+    }
+  };
+
+  if (!kTags && state.filter_ == nullptr) {
+    for (auto i = 0U; i != id.size(); ++i) {
+      if constexpr (is_node_fn_without_tags<Fn>) {
+        f(id[i], pos(i));
+      } else {
+        f(id[i], pos(i), make_entity_dense_tags<Fields>({}, state));
+      }
+    }
+    return;
+  }
 
-  for (auto const [id, lat, lon] : std::views::zip(ids, lats, lons)) {
+  auto tags = fields.tags_;
+  for (auto i = 0U; i != id.size(); ++i) {
     auto const separator_pos = tags.find('\0');
-    auto const node_tags =
-        varint<std::uint32_t>{separator_pos == std::string_view::npos
-                                  ? std::string_view{}
-                                  : tags.substr(0, separator_pos)} |
-        std::views::chunk(2) | std::views::transform([&](auto&& y) {
-          auto it = std::ranges::begin(y);
-          auto const k = *it;
-          auto const v = *++it;
-          return std::tuple{strings.at(k), strings.at(v)};
-        });
+    auto const keys_vals = varint<std::uint32_t>{
+        separator_pos == std::string_view::npos
+            ? std::string_view{}
+            : tags.substr(0, separator_pos)};
     tags = tags.substr(separator_pos + 1U);
-    f(id, meta.to_latlng(lat, lon), node_tags);
+    if (state.filter_ != nullptr &&
+        !state.block_filter_.matches_interleaved(keys_vals)) {
+      continue;
+    }
+
+    if constexpr (is_node_fn_without_tags<Fn>) {
+      f(id[i], pos(i));
+    } else {
+      f(id[i], pos(i),
+        make_entity_dense_tags<Fields>(
+            kTags ? keys_vals : varint<std::uint32_t>{}, state));
+    }
   }
 }
 
-template <typename Fn>
+// Decodes all dense nodes of the group with bulk passes and calls
+// f(node_batch const&) once. Without field::kNodeTags (and filter), all
+// nodes have no tags.
+template <field Fields, typename Fn>
+void decode_dense_nodes_batch(std::string_view s,
+                              decode_state& state,
+                              meta_data const& meta,
+                              Fn&& f) {
+  constexpr auto const kTags = has(Fields, field::kNodeTags);
+  auto const fields = parse_dense_nodes(s);
+  auto const n = decode_packed<true, true>(fields.ids_, state.ids_).size();
+  auto const lat = decode_packed<true, true>(fields.lats_, state.lats_);
+  auto const lon = decode_packed<true, true>(fields.lons_, state.lons_);
+  utl::verify(n == lat.size() && n == lon.size(),
+              "dense nodes: {} ids, {} lats, {} lons", n, lat.size(),
+              lon.size());
+
+  state.fixed_lats_.resize(n);
+  state.fixed_lons_.resize(n);
+  to_fixed(lat, meta.lat_offset_, meta.granularity_, state.fixed_lats_.data());
+  to_fixed(lon, meta.lon_offset_, meta.granularity_, state.fixed_lons_.data());
+
+  auto const ids = state.ids_.data_.get();
+  auto& offsets = state.tag_offsets_;
+  auto& keys_vals = state.keys_vals_;
+  offsets.resize(n + 1U);
+  offsets[0] = 0U;
+  keys_vals.clear();
+
+  if (!kTags && state.filter_ == nullptr) {
+    if (n != 0U) {
+      std::ranges::fill(offsets, 0U);
+      f(node_batch{.ids_ = {ids, n},
+                   .lats_ = state.fixed_lats_,
+                   .lons_ = state.fixed_lons_,
+                   .tag_offsets_ = offsets,
+                   .keys_vals_ = keys_vals,
+                   .strings_ = state.strings_,
+                   .string_ids_ = state.string_ids_});
+    }
+    return;
+  }
+
+  // keys_vals: k v k v ... 0 per node (no tags at all: field missing).
+  // Nodes rejected by the tag filter are removed from all columns.
+  auto const kv = decode_packed<false, false>(fields.tags_, state.tags_);
+  auto const filter = state.filter_ == nullptr ? nullptr : &state.block_filter_;
+
+  auto kept = std::size_t{0U};
+  for (auto i = std::size_t{0U}, j = std::size_t{0U}; i != n; ++i, ++j) {
+    auto const first = keys_vals.size();
+    auto match = filter == nullptr;
+    for (; j < kv.size() && kv[j] != 0; j += 2U) {
+      utl_verify(j + 1U < kv.size(), "dense nodes: dangling tag key");
+      auto const k = static_cast<std::uint32_t>(kv[j]);
+      auto const v = static_cast<std::uint32_t>(kv[j + 1U]);
+      utl_verify(k < state.strings_.size() && v < state.strings_.size(),
+                 "bad tag {}={}", k, v);
+      match = match || filter->matches(k, v);
+      keys_vals.push_back(k);
+      keys_vals.push_back(v);
+    }
+
+    if (!match || !kTags) {
+      keys_vals.resize(first);
+    }
+    if (!match) {
+      continue;
+    }
+
+    ids[kept] = ids[i];
+    state.fixed_lats_[kept] = state.fixed_lats_[i];
+    state.fixed_lons_[kept] = state.fixed_lons_[i];
+    offsets[++kept] = static_cast<std::uint32_t>(keys_vals.size() / 2U);
+  }
+
+  if (kept == 0U) {
+    return;
+  }
+
+  f(node_batch{.ids_ = {ids, kept},
+               .lats_ = {state.fixed_lats_.data(), kept},
+               .lons_ = {state.fixed_lons_.data(), kept},
+               .tag_offsets_ = {offsets.data(), kept + 1U},
+               .keys_vals_ = keys_vals,
+               .strings_ = state.strings_,
+               .string_ids_ = state.string_ids_});
+}
+
+template <field Fields, typename Fn>
 void decode_node(std::string_view s,
+                 decode_state& state,
                  meta_data const& m,
-                 std::vector<std::string_view> const& strings,
                  Fn&& f) {
   auto keys = varint<std::uint32_t>{};
   auto values = varint<std::uint32_t>{};
@@ -173,22 +656,59 @@ void decode_node(std::string_view s,
     }
   }
 
-  using namespace std::views;
-  auto const tags =
-      zip(keys, values) | transform([&](auto&& x) {
-        return std::tuple{strings.at(get<0>(x)), strings.at(get<1>(x))};
-      });
-  f(id, m.to_latlng(lat, lon), tags);
+  if (state.filter_ != nullptr &&
+      !state.block_filter_.matches_any(keys, values)) {
+    return;
+  }
+  if constexpr (!has(Fields, field::kNodeTags)) {
+    keys = {};
+    values = {};
+  }
+
+  if constexpr (is_node_batch_fn<Fn>) {
+    auto const lat_in = std::array{lat};
+    auto const lon_in = std::array{lon};
+    auto fixed_lat = std::int32_t{};
+    auto fixed_lon = std::int32_t{};
+    to_fixed(lat_in, m.lat_offset_, m.granularity_, &fixed_lat);
+    to_fixed(lon_in, m.lon_offset_, m.granularity_, &fixed_lon);
+
+    state.keys_vals_.clear();
+    for (auto const [k, v] : std::views::zip(keys, values)) {
+      utl_verify(k < state.strings_.size() && v < state.strings_.size(),
+                 "bad tag {}={}", k, v);
+      state.keys_vals_.push_back(static_cast<std::uint32_t>(k));
+      state.keys_vals_.push_back(static_cast<std::uint32_t>(v));
+    }
+    auto const offsets = std::array{
+        0U, static_cast<std::uint32_t>(state.keys_vals_.size() / 2U)};
+
+    f(node_batch{.ids_ = std::span{&id, 1U},
+                 .lats_ = std::span{&fixed_lat, 1U},
+                 .lons_ = std::span{&fixed_lon, 1U},
+                 .tag_offsets_ = offsets,
+                 .keys_vals_ = state.keys_vals_,
+                 .strings_ = state.strings_,
+                 .string_ids_ = state.string_ids_});
+  } else if constexpr (is_node_fn_without_tags<Fn>) {
+    f(id, m.position<Fields>(lat, lon));
+  } else {
+    auto const tags = make_entity_tags<Fields>(keys, values, state);
+    f(id, m.position<Fields>(lat, lon), tags);
+  }
 }
 
-template <typename Fn>
+template <field Fields, typename Fn>
 void decode_way(std::string_view s,
-                std::vector<std::string_view> const& strings,
+                decode_state& state,
+                meta_data const& m,
                 Fn&& f) {
   auto id = std::uint64_t{};
   auto keys = varint<std::uint32_t>{};
   auto values = varint<std::uint32_t>{};
-  auto refs = varint<std::int64_t>{};
+  auto refs = std::string_view{};
+  auto lats = std::string_view{};
+  auto lons = std::string_view{};
 
   protozero::pbf_message<way> pbf_way{s};
   while (pbf_way.next()) {
@@ -210,31 +730,76 @@ void decode_way(std::string_view s,
 
       case protozero::tag_and_type(way::packed_sint64_refs,
                                    protozero::pbf_wire_type::length_delimited):
-        refs = {pbf_way.get_view()};
+        if constexpr (has(Fields, field::kWayRefs)) {
+          refs = pbf_way.get_view();
+        } else {
+          pbf_way.skip();
+        }
+        break;
+
+      case protozero::tag_and_type(way::packed_sint64_lat,
+                                   protozero::pbf_wire_type::length_delimited):
+        lats = pbf_way.get_view();
+        break;
+
+      case protozero::tag_and_type(way::packed_sint64_lon,
+                                   protozero::pbf_wire_type::length_delimited):
+        lons = pbf_way.get_view();
         break;
 
       default: pbf_way.skip();
     }
   }
 
-  using namespace std::views;
-  auto const tags =
-      zip(keys, values) | transform([&](auto&& x) {
-        return std::tuple{strings.at(get<0>(x)), strings.at(get<1>(x))};
-      });
-  f(id, refs, tags);
+  if (state.filter_ != nullptr &&
+      !state.block_filter_.matches_any(keys, values)) {
+    return;
+  }
+  if constexpr (!has(Fields, field::kWayTags)) {
+    keys = {};
+    values = {};
+  }
+
+  auto const tags = make_entity_tags<Fields>(keys, values, state);
+  auto const way_refs = decode_packed<true, true>(refs, state.refs_);
+  if constexpr (is_way_locations_fn<Fn>) {
+    // Same delta coding and granularity as dense nodes.
+    auto const lat = decode_packed<true, true>(lats, state.lats_);
+    auto const lon = decode_packed<true, true>(lons, state.lons_);
+    utl::verify(lat.size() == lon.size() &&
+                    (!has(Fields, field::kWayRefs) || lat.empty() ||
+                     lat.size() == way_refs.size()),
+                "way {}: {} refs, {} lats, {} lons", id, way_refs.size(),
+                lat.size(), lon.size());
+
+    state.fixed_lats_.resize(lat.size());
+    state.fixed_lons_.resize(lon.size());
+    to_fixed(lat, m.lat_offset_, m.granularity_, state.fixed_lats_.data());
+    to_fixed(lon, m.lon_offset_, m.granularity_, state.fixed_lons_.data());
+
+    auto& locations = state.way_locations_;
+    locations.resize(lat.size());
+    for (auto i = std::size_t{0U}; i != locations.size(); ++i) {
+      locations[i] = {state.fixed_lats_[i], state.fixed_lons_[i]};
+    }
+
+    f(id, way_refs, std::span<location const>{locations}, tags);
+  } else if constexpr (is_way_fn_without_tags<Fn>) {
+    f(id, way_refs);
+  } else {
+    f(id, way_refs, tags);
+  }
 }
 
-template <typename Fn>
-void decode_relation(std::string_view s,
-                     std::vector<std::string_view> const& strings,
-                     Fn&& f) {
+template <field Fields, typename Fn>
+void decode_relation(std::string_view s, decode_state& state, Fn&& f) {
+  constexpr auto const kMembers = has(Fields, field::kRelationMembers);
   auto id = std::uint64_t{};
   auto keys = varint<std::uint32_t>{};
   auto values = varint<std::uint32_t>{};
   auto roles = varint<std::uint32_t>{};
   auto types = varint<std::uint32_t>{};
-  auto refs = varint<std::int64_t>{};
+  auto refs = std::string_view{};
 
   auto pbf_relation = protozero::pbf_message<relation>{s};
   while (pbf_relation.next()) {
@@ -256,47 +821,93 @@ void decode_relation(std::string_view s,
 
       case protozero::tag_and_type(relation::packed_int32_roles_sid,
                                    protozero::pbf_wire_type::length_delimited):
-        roles = {pbf_relation.get_view()};
+        if constexpr (kMembers) {
+          roles = {pbf_relation.get_view()};
+        } else {
+          pbf_relation.skip();
+        }
         break;
 
       case protozero::tag_and_type(relation::packed_sint64_memids,
                                    protozero::pbf_wire_type::length_delimited):
-        refs = {pbf_relation.get_view()};
+        if constexpr (kMembers) {
+          refs = pbf_relation.get_view();
+        } else {
+          pbf_relation.skip();
+        }
         break;
 
       case protozero::tag_and_type(relation::packed_MemberType_types,
                                    protozero::pbf_wire_type::length_delimited):
-        types = {pbf_relation.get_view()};
+        if constexpr (kMembers) {
+          types = {pbf_relation.get_view()};
+        } else {
+          pbf_relation.skip();
+        }
         break;
 
       default: pbf_relation.skip();
     }
   }
 
-  using namespace std::views;
-  auto const tags =
-      zip(keys, values) | transform([&](auto&& x) {
-        return std::tuple{strings.at(get<0>(x)), strings.at(get<1>(x))};
-      });
-  auto const members =
-      zip(refs, roles, types) | transform([&](auto&& x) {
-        auto const [ref, role, type] = x;
-        return std::tuple{ref, strings.at(role), member_type{type}};
-      });
-  f(id, members, tags);
+  if (state.filter_ != nullptr &&
+      !state.block_filter_.matches_any(keys, values)) {
+    return;
+  }
+
+  if constexpr (!has(Fields, field::kRelationTags)) {
+    keys = {};
+    values = {};
+  }
+
+  auto const& strings = state.strings_;
+  auto const members = make_members(
+      decode_packed<true, true>(refs, state.refs_), roles, types, strings);
+  if constexpr (is_relation_fn_without_tags<Fn>) {
+    f(id, members);
+  } else {
+    auto const tags = make_entity_tags<Fields>(keys, values, state);
+    f(id, members, tags);
+  }
 }
 
-template <typename NodeFn, typename WayFn, typename RelFn>
+// Decodes the entities of a primitive block. The decoder is specialized at
+// compile time for Fields & detect_fields<...>(): kinds outside the mask are
+// skipped without decoding, as are tags, way refs and relation members. The
+// read_* flags additionally select kinds at runtime. With field::kTagIds,
+// the block's string table is interned into state.interner_ first.
+template <field Fields = field::kAll,
+          typename NodeFn,
+          typename WayFn,
+          typename RelFn>
 void decode_primitive(std::string_view s,
-                      std::vector<std::string_view>& strings,
+                      decode_state& state,
                       bool const read_nodes,
                       bool const read_ways,
                       bool const read_relations,
                       NodeFn&& on_node,
                       WayFn&& on_way,
                       RelFn&& on_rel) {
-  strings.clear();
-  auto const meta = decode_primitive_block_metadata(s, strings);
+  constexpr auto const kFields =
+      effective_fields<Fields, NodeFn, WayFn, RelFn>();
+
+  state.strings_.clear();
+  auto filter = static_cast<block_tag_filter*>(nullptr);
+  if (state.filter_ != nullptr) {
+    state.block_filter_.reset(*state.filter_);
+    filter = &state.block_filter_;
+  }
+  auto const meta = decode_primitive_block_metadata(s, state.strings_, filter);
+  if (filter != nullptr && !filter->matchable()) {
+    return;  // no string of the filter in this block
+  }
+  if constexpr (has(kFields, field::kTagIds)) {
+    utl::verify(state.interner_ != nullptr, "field::kTagIds without interner");
+    state.string_ids_.resize(state.strings_.size());
+    for (auto i = std::size_t{0U}; i != state.strings_.size(); ++i) {
+      state.string_ids_[i] = state.interner_->intern(state.strings_[i]);
+    }
+  }
   auto pbf_primitive_block = protozero::pbf_message<primitive_block>{s};
   while (pbf_primitive_block.next(
       primitive_block::repeated_PrimitiveGroup_primitivegroup,
@@ -308,42 +919,58 @@ void decode_primitive(std::string_view s,
         case protozero::tag_and_type(
             primitive_group::repeated_Node_nodes,
             protozero::pbf_wire_type::length_delimited):
-          if (read_nodes) {
-            decode_node(pbf_primitive_group.get_view(), meta, strings, on_node);
-          } else {
-            pbf_primitive_group.skip();
+          if constexpr (has(kFields, field::kNodes)) {
+            if (read_nodes) {
+              decode_node<kFields>(pbf_primitive_group.get_view(), state,
+                                   meta, on_node);
+              break;
+            }
           }
+          pbf_primitive_group.skip();
           break;
 
         case protozero::tag_and_type(
             primitive_group::optional_DenseNodes_dense,
             protozero::pbf_wire_type::length_delimited):
-          if (read_nodes) {
-            decode_dense_nodes(pbf_primitive_group.get_view(), strings, meta,
-                               on_node);
-          } else {
-            pbf_primitive_group.skip();
+          if constexpr (has(kFields, field::kNodes)) {
+            if (read_nodes) {
+              if constexpr (is_node_batch_fn<NodeFn>) {
+                decode_dense_nodes_batch<kFields>(
+                    pbf_primitive_group.get_view(), state, meta, on_node);
+              } else {
+                decode_dense_nodes<kFields>(pbf_primitive_group.get_view(),
+                                            state, meta, on_node);
+              }
+              break;
+            }
           }
+          pbf_primitive_group.skip();
           break;
 
         case protozero::tag_and_type(
             primitive_group::repeated_Way_ways,
             protozero::pbf_wire_type::length_delimited):
-          if (read_ways) {
-            decode_way(pbf_primitive_group.get_view(), strings, on_way);
-          } else {
-            pbf_primitive_group.skip();
+          if constexpr (has(kFields, field::kWays)) {
+            if (read_ways) {
+              decode_way<kFields>(pbf_primitive_group.get_view(), state, meta,
+                                  on_way);
+              break;
+            }
           }
+          pbf_primitive_group.skip();
           break;
 
         case protozero::tag_and_type(
             primitive_group::repeated_Relation_relations,
             protozero::pbf_wire_type::length_delimited):
-          if (read_relations) {
-            decode_relation(pbf_primitive_group.get_view(), strings, on_rel);
-          } else {
-            pbf_primitive_group.skip();
+          if constexpr (has(kFields, field::kRelations)) {
+            if (read_relations) {
+              decode_relation<kFields>(pbf_primitive_group.get_view(), state,
+                                       on_rel);
+              break;
+            }
           }
+          pbf_primitive_group.skip();
           break;
 
         default: pbf_primitive_group.skip();
@@ -352,4 +979,15 @@ void decode_primitive(std::string_view s,
   }
 }
 
-}  // namespace osm
\ No newline at end of file
+// All kinds in Fields, no runtime selection.
+template <field Fields, typename NodeFn, typename WayFn, typename RelFn>
+void decode_primitive(std::string_view s,
+                      decode_state& state,
+                      NodeFn&& on_node,
+                      WayFn&& on_way,
+                      RelFn&& on_rel) {
+  decode_primitive<Fields>(s, state, true, true, true, on_node, on_way,
+                           on_rel);
+}
+
+}  // namespace osm
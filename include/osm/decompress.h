@@ -0,0 +1,127 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "utl/verify.h"
+
+#ifdef OSM_WITH_ZSTD
+#include "zstd.h"
+#endif
+
+#ifdef OSM_WITH_LZ4
+#include "lz4.h"
+#endif
+
+#include "osm/inflate.h"
+#include "osm/osm.h"
+
+namespace osm {
+
+#ifdef OSM_WITH_ZSTD
+struct zstd {
+  zstd() : ctx_{ZSTD_createDCtx()} {
+    utl::verify(ctx_ != nullptr, "zstd: could not create context");
+  }
+
+  zstd(zstd const&) = delete;
+  zstd(zstd&&) = delete;
+  zstd& operator=(zstd const&) = delete;
+  zstd& operator=(zstd&&) = delete;
+
+  ~zstd() {
+    ZSTD_freeDCtx(ctx_);
+    if (stream_ != nullptr) {
+      ZSTD_freeDStream(stream_);
+    }
+  }
+
+  void decompress(std::string_view in, std::string& out) {
+    auto const n =
+        ZSTD_decompressDCtx(ctx_, out.data(), out.size(), in.data(), in.size());
+    utl_verify(!ZSTD_isError(n), "zstd failed: {}", ZSTD_getErrorName(n));
+    out.resize(n);
+  }
+
+  // Incremental decompression, same protocol as inflate::begin/read_some/end.
+  void begin(std::string_view in) {
+    if (stream_ == nullptr) {
+      stream_ = ZSTD_createDStream();
+      utl::verify(stream_ != nullptr, "zstd: could not create stream");
+    }
+    ZSTD_initDStream(stream_);
+    in_ = ZSTD_inBuffer{.src = in.data(), .size = in.size(), .pos = 0U};
+  }
+
+  std::size_t read_some(char* out, std::size_t const n) {
+    auto o = ZSTD_outBuffer{.dst = out, .size = n, .pos = 0U};
+    while (o.pos == 0U) {
+      auto const in_pos = in_.pos;
+      auto const ec = ZSTD_decompressStream(stream_, &o, &in_);
+      utl_verify(!ZSTD_isError(ec), "zstd failed: {}", ZSTD_getErrorName(ec));
+      if (ec == 0U || (o.pos == 0U && in_.pos == in_pos)) {
+        break;  // end of frame or no progress possible
+      }
+    }
+    return o.pos;
+  }
+
+  void end() {}
+
+  ZSTD_DCtx* ctx_;
+  ZSTD_DStream* stream_{nullptr};
+  ZSTD_inBuffer in_{};
+};
+#endif
+
+#ifdef OSM_WITH_LZ4
+struct lz4 {
+  static void decompress(std::string_view in, std::string& out) {
+    auto const n = LZ4_decompress_safe(in.data(), out.data(),
+                                       static_cast<int>(in.size()),
+                                       static_cast<int>(out.size()));
+    utl_verify(n >= 0, "lz4 failed: {}", n);
+    out.resize(static_cast<std::size_t>(n));
+  }
+};
+#endif
+
+// Decompresses blobs with the backend matching their compression.
+// Holds one (reusable) state per backend. Raw blobs are not copied.
+struct decompressor {
+  // Returns the decompressed block: a view of `out`, or of the blob itself
+  // for uncompressed blobs.
+  std::string_view decompress(buf const& b, std::string& out) {
+    if (b.compression_ == compression::kRaw) {
+      return b.compressed_;
+    }
+
+    out.resize(b.raw_size_);
+    switch (b.compression_) {
+      case compression::kZlib: zlib_.decompress(b.compressed_, out); break;
+
+#ifdef OSM_WITH_ZSTD
+      case compression::kZstd: zstd_.decompress(b.compressed_, out); break;
+#endif
+
+#ifdef OSM_WITH_LZ4
+      case compression::kLz4: lz4::decompress(b.compressed_, out); break;
+#endif
+
+      default:
+        throw utl::fail("unsupported blob compression {}",
+                        static_cast<int>(b.compression_));
+    }
+    utl_verify(out.size() == b.raw_size_, "raw size mismatch: {} != {}",
+               out.size(), b.raw_size_);
+    return out;
+  }
+
+  inflate zlib_;
+
+#ifdef OSM_WITH_ZSTD
+  zstd zstd_;
+#endif
+};
+
+}  // namespace osm
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <ranges>
+#include <utility>
+
+namespace osm {
+
+// Minimal synchronous generator (std::generator is not available with all
+// supported standard libraries). Yielded values are passed by reference and
+// are valid until the next increment. Destroying the generator (e.g. by
+// leaving a range-for loop early) destroys the coroutine frame, including
+// all of its locals.
+template <typename T>
+struct generator : std::ranges::view_base {
+  struct promise_type {
+    generator get_return_object() {
+      return generator{handle_t::from_promise(*this)};
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+
+    // Temporaries live until the coroutine is resumed.
+    std::suspend_always yield_value(T const& x) noexcept {
+      value_ = std::addressof(x);
+      return {};
+    }
+
+    void return_void() noexcept {}
+    void unhandled_exception() { exception_ = std::current_exception(); }
+
+    template <typename U>
+    std::suspend_never await_transform(U&&) = delete;
+
+    T const* value_{nullptr};
+    std::exception_ptr exception_;
+  };
+
+  using handle_t = std::coroutine_handle<promise_type>;
+
+  struct iterator {
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+
+    T const& operator*() const { return *h_.promise().value_; }
+    T const* operator->() const { return h_.promise().value_; }
+
+    iterator& operator++() {
+      resume(h_);
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    friend bool operator==(iterator const& it, std::default_sentinel_t) {
+      return it.h_.done();
+    }
+
+    handle_t h_{};
+  };
+
+  generator() = default;
+  explicit generator(handle_t h) : h_{h} {}
+
+  generator(generator const&) = delete;
+  generator& operator=(generator const&) = delete;
+
+  generator(generator&& o) noexcept : h_{std::exchange(o.h_, {})} {}
+  generator& operator=(generator&& o) noexcept {
+    if (this != &o) {
+      if (h_) {
+        h_.destroy();
+      }
+      h_ = std::exchange(o.h_, {});
+    }
+    return *this;
+  }
+
+  ~generator() {
+    if (h_) {
+      h_.destroy();
+    }
+  }
+
+  iterator begin() {
+    resume(h_);
+    return iterator{h_};
+  }
+
+  std::default_sentinel_t end() const noexcept { return {}; }
+
+private:
+  static void resume(handle_t h) {
+    h.resume();
+    if (h.done() && h.promise().exception_) {
+      std::rethrow_exception(h.promise().exception_);
+    }
+  }
+
+  handle_t h_{};
+};
+
+}  // namespace osm
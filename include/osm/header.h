@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cinttypes>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "osm/location.h"
+#include "osm/osm.h"
+
+namespace osm {
+
+constexpr auto const kLocationsOnWays = std::string_view{"LocationsOnWays"};
+constexpr auto const kSortTypeThenId = std::string_view{"Sort.Type_then_ID"};
+
+// Decoded OSMHeader block.
+struct header {
+  bool has_feature(std::string_view) const;
+
+  // Nodes, then ways, then relations, each sorted by ID.
+  bool sorted() const { return has_feature(kSortTypeThenId); }
+
+  // Ways carry their node locations (see is_way_locations_fn).
+  bool locations_on_ways() const { return has_feature(kLocationsOnWays); }
+
+  std::optional<bbox> bbox_;
+  std::vector<std::string> required_features_;
+  std::vector<std::string> optional_features_;
+  std::string writing_program_;
+  std::string source_;
+
+  // Osmosis replication state, 0 / empty if not set.
+  std::int64_t replication_timestamp_{0};  // seconds since epoch
+  std::int64_t replication_sequence_{0};
+  std::string replication_base_url_;
+};
+
+header parse_header(std::string_view block);
+
+// Decompresses and parses an OSMHeader blob.
+// Throws if the file requires a feature this reader does not support.
+header read_header(buf const&);
+
+// Header of the file (its first blob).
+header read_header(char const* path);
+
+}  // namespace osm
@@ -18,7 +18,17 @@ struct inflate {
     utl::verify(ec == Z_OK, "inflate init failed: {}", ec);
   }
 
+  // zlib keeps a back pointer to the stream: no copy / move.
+  inflate(inflate const&) = delete;
+  inflate(inflate&&) = delete;
+  inflate& operator=(inflate const&) = delete;
+  inflate& operator=(inflate&&) = delete;
+
+  ~inflate() { inflateEnd(&z_); }
+
+  // Resets the stream first: a failed call leaves it in the middle.
   void decompress(std::string_view in, std::string& out) {
+    inflateReset(&z_);
     z_.next_in = const_cast<unsigned char*>(
         reinterpret_cast<unsigned char const*>(in.data()));
     z_.avail_in = in.size();
@@ -28,10 +38,31 @@ struct inflate {
     auto const ec = ::inflate(&z_, Z_FINISH);
     utl_verify(ec == Z_STREAM_END, "inflate failed: {}", ec);
     out.resize(z_.total_out);
+  }
+
+  // Incremental decompression for reading only a prefix of the output:
+  // begin(in), read_some() until enough output was produced, then end().
+  // begin() resets the stream: a throwing read_some() skips end().
+  void begin(std::string_view in) {
     inflateReset(&z_);
+    z_.next_in = const_cast<unsigned char*>(
+        reinterpret_cast<unsigned char const*>(in.data()));
+    z_.avail_in = in.size();
   }
 
+  // Returns the number of bytes written to `out`, 0 at the end of the stream.
+  std::size_t read_some(char* out, std::size_t const n) {
+    z_.next_out = reinterpret_cast<unsigned char*>(out);
+    z_.avail_out = n;
+    auto const ec = ::inflate(&z_, Z_SYNC_FLUSH);
+    utl_verify(ec == Z_OK || ec == Z_STREAM_END || ec == Z_BUF_ERROR,
+               "inflate failed: {}", ec);
+    return n - z_.avail_out;
+  }
+
+  void end() { inflateReset(&z_); }
+
   z_stream z_;
 };
 
-}  // namespace osm
\ No newline at end of file
+}  // namespace osm
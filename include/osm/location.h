@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cinttypes>
+#include <limits>
+
+#include "geo/latlng.h"
+
+namespace osm {
+
+constexpr auto const kFixedPointFactor = 10'000'000.0;  // 1e-7 degrees
+constexpr auto const kNanoPerFixed = std::int64_t{100};
+
+// Nanodegrees to fixed point, rounded half away from zero (the same for both
+// signs, unlike integer division which rounds negatives up).
+constexpr std::int32_t nano_to_fixed(std::int64_t const nano) {
+  constexpr auto const kHalf = kNanoPerFixed / 2;
+  return static_cast<std::int32_t>((nano < 0 ? nano - kHalf : nano + kHalf) /
+                                   kNanoPerFixed);
+}
+
+// Node position, fixed point with kFixedPointFactor.
+struct location {
+  static constexpr auto const kInvalid =
+      std::numeric_limits<std::int32_t>::min();
+
+  bool valid() const { return lat_ != kInvalid; }
+
+  geo::latlng to_latlng() const {
+    return {lat_ / kFixedPointFactor, lon_ / kFixedPointFactor};
+  }
+
+  friend bool operator==(location, location) = default;
+
+  std::int32_t lat_{kInvalid};
+  std::int32_t lon_{kInvalid};
+};
+
+// Inclusive bounding box.
+struct bbox {
+  bool contains(location const l) const {
+    return l.lat_ >= min_.lat_ && l.lat_ <= max_.lat_ && l.lon_ >= min_.lon_ &&
+           l.lon_ <= max_.lon_;
+  }
+
+  bool intersects(bbox const& o) const {
+    return min_.lat_ <= o.max_.lat_ && o.min_.lat_ <= max_.lat_ &&
+           min_.lon_ <= o.max_.lon_ && o.min_.lon_ <= max_.lon_;
+  }
+
+  location min_, max_;
+};
+
+}  // namespace osm
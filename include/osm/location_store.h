@@ -0,0 +1,196 @@
+#pragma once
+
+#include <atomic>
+#include <cinttypes>
+#include <concepts>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ranges>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "cista/mmap.h"
+
+#include "osm/decoder.h"
+#include "osm/location.h"
+#include "osm/parallel_reader.h"
+#include "osm/read_config.h"
+
+namespace osm {
+
+namespace detail {
+
+// Both coordinates with flipped sign bits: zero (fresh pages) is invalid.
+inline std::uint64_t encode(location const l) {
+  return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(l.lat_) ^
+                                     0x8000'0000U)
+          << 32U) |
+         (static_cast<std::uint32_t>(l.lon_) ^ 0x8000'0000U);
+}
+
+inline location decode(std::uint64_t const x) {
+  return {.lat_ = static_cast<std::int32_t>(
+              static_cast<std::uint32_t>(x >> 32U) ^ 0x8000'0000U),
+          .lon_ = static_cast<std::int32_t>(static_cast<std::uint32_t>(x) ^
+                                            0x8000'0000U)};
+}
+
+}  // namespace detail
+
+// set() is called concurrently from the decoder threads (once per node),
+// get() after finish().
+template <typename T>
+concept location_store =
+    requires(T& s, T const& cs, std::int64_t const id, location const l) {
+      s.set(id, l);
+      s.finish();
+      { cs.get(id) } -> std::same_as<location>;
+    };
+
+// Array indexed by node ID in a memory mapped (sparse) file.
+// For planet files: 8 bytes per ID up to max_id, only touched pages are
+// backed by memory / disk.
+struct dense_location_store {
+  dense_location_store(char const* path, std::uint64_t max_id);
+
+  void set(std::int64_t const id, location const l) {
+    utl_verify(static_cast<std::uint64_t>(id) < size_,
+               "dense location store: node id {} out of range", id);
+    std::atomic_ref{data_[id]}.store(detail::encode(l),
+                                     std::memory_order_relaxed);
+  }
+
+  location get(std::int64_t const id) const {
+    return static_cast<std::uint64_t>(id) < size_ ? detail::decode(data_[id])
+                                                  : location{};
+  }
+
+  void finish() {}
+
+  cista::mmap mem_;
+  std::uint64_t* data_;
+  std::size_t size_;
+};
+
+// Sorted (id, location) array for extracts. Every writing thread appends
+// to its own buffer, finish() merges and sorts them.
+struct sparse_location_store {
+  struct entry {
+    std::int64_t id_;
+    location l_;
+  };
+
+  void set(std::int64_t const id, location const l) {
+    local().push_back({id, l});
+  }
+
+  location get(std::int64_t id) const;
+
+  void finish();
+
+  std::vector<entry>& local() {
+    thread_local auto cache =
+        std::pair<std::uint64_t, std::vector<entry>*>{0U, nullptr};
+    if (cache.first != instance_) {
+      auto const lock = std::scoped_lock{mutex_};
+      cache = {instance_,
+               buffers_.emplace_back(std::make_unique<std::vector<entry>>())
+                   .get()};
+    }
+    return *cache.second;
+  }
+
+  static std::uint64_t next_instance();
+
+  std::uint64_t const instance_{next_instance()};
+  std::mutex mutex_;  // registration of thread buffers
+  std::vector<std::unique_ptr<std::vector<entry>>> buffers_;
+  std::vector<entry> entries_;
+};
+
+// Page table over ID ranges of kPageSize nodes. Pages are allocated (lock
+// free) on first write: compact for extracts, dense array for planets.
+struct paged_location_store {
+  static constexpr auto const kPageBits = 16U;
+  static constexpr auto const kPageSize = std::size_t{1U} << kPageBits;
+
+  explicit paged_location_store(std::uint64_t max_id = 1ULL << 34U);
+  ~paged_location_store();
+
+  paged_location_store(paged_location_store const&) = delete;
+  paged_location_store(paged_location_store&&) = delete;
+  paged_location_store& operator=(paged_location_store const&) = delete;
+  paged_location_store& operator=(paged_location_store&&) = delete;
+
+  void set(std::int64_t const id, location const l) {
+    auto const page_idx = static_cast<std::uint64_t>(id) >> kPageBits;
+    utl_verify(page_idx < n_pages_,
+               "paged location store: node id {} out of range", id);
+    auto page = pages_[page_idx].load(std::memory_order_acquire);
+    if (page == nullptr) {
+      page = allocate(page_idx);
+    }
+    std::atomic_ref{page[id & (kPageSize - 1U)]}.store(
+        detail::encode(l), std::memory_order_relaxed);
+  }
+
+  location get(std::int64_t const id) const {
+    auto const page_idx = static_cast<std::uint64_t>(id) >> kPageBits;
+    if (page_idx >= n_pages_) {
+      return {};
+    }
+    auto const page = pages_[page_idx].load(std::memory_order_relaxed);
+    return page == nullptr ? location{}
+                           : detail::decode(page[id & (kPageSize - 1U)]);
+  }
+
+  void finish() {}
+
+  std::uint64_t* allocate(std::size_t page_idx);
+
+  std::size_t n_pages_;
+  std::unique_ptr<std::atomic<std::uint64_t*>[]> pages_;
+};
+
+// Node callback (node_batch) writing all node locations to the store.
+template <location_store Store>
+auto store_locations(Store& s) {
+  return [&s](node_batch const& b) {
+    for (auto i = std::size_t{0U}; i != b.size(); ++i) {
+      s.set(b.ids_[i], location{b.lats_[i], b.lons_[i]});
+    }
+  };
+}
+
+// (ref, location) for all node refs of a way.
+template <location_store Store>
+auto resolve(Store const& s, std::span<std::int64_t const> refs) {
+  return refs | std::views::transform([&s](std::int64_t const ref) {
+           return std::pair{ref, s.get(ref)};
+         });
+}
+
+// Way callback adapter: fn(id, resolve(s, refs), tags). Keeps a copy of
+// fn (moved if it is an rvalue), only the store has to outlive the adapter.
+template <location_store Store, typename Fn>
+auto with_locations(Store const& s, Fn&& fn) {
+  return [&s, fn = std::forward<Fn>(fn)](auto const id,
+                                         std::span<std::int64_t const> refs,
+                                         auto&& tags) mutable {
+    fn(id, resolve(s, refs), tags);
+  };
+}
+
+// First pass: reads all node locations of the file into the store.
+template <location_store Store>
+void read_locations(char const* path, Store& s, read_config c = {}) {
+  c.read_nodes_ = true;
+  c.read_ways_ = false;
+  c.read_relations_ = false;
+  read(path, c, store_locations(s), no_callback{}, no_callback{});
+  s.finish();
+}
+
+}  // namespace osm
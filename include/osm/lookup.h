@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <cinttypes>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "osm/block_index.h"
+#include "osm/decoder.h"
+#include "osm/decompress.h"
+#include "osm/osm.h"
+#include "osm/peek.h"
+
+namespace osm {
+
+// Random access by ID to files sorted by type and ID (Sort.Type_then_ID).
+//
+// Blocks are located with the block index sidecar if there is an up to date
+// one. Otherwise the blob headers are scanned once and blocks are found by
+// binary search over the first entity ID of each block (inflating only the
+// block prefix, see peek_head). Only blocks containing requested IDs are
+// decoded, each one once per call.
+//
+// Callbacks have the same signature as for read(), except for node_batch.
+// Not thread safe.
+struct lookup {
+  explicit lookup(std::filesystem::path const& pbf);
+
+  template <typename Fn>
+  void get_nodes(std::span<std::int64_t const> ids, Fn&& f) {
+    get(entity_kind::kNodes, ids,
+        [&](std::span<std::int64_t const> wanted, std::string_view block) {
+          decode_primitive(
+              block, state_, true, false, false,
+              [&](std::int64_t const id, auto&& pos, auto&& tags) {
+                if (std::ranges::binary_search(wanted, id)) {
+                  f(id, pos, tags);
+                }
+              },
+              no_callback{}, no_callback{});
+        });
+  }
+
+  template <typename Fn>
+  void get_ways(std::span<std::int64_t const> ids, Fn&& f) {
+    get(entity_kind::kWays, ids,
+        [&](std::span<std::int64_t const> wanted, std::string_view block) {
+          auto const is_wanted = [&](std::uint64_t const id) {
+            return std::ranges::binary_search(wanted,
+                                              static_cast<std::int64_t>(id));
+          };
+          auto const on_way = [&]() {
+            if constexpr (is_way_locations_fn<Fn>) {
+              return [&](std::uint64_t const id,
+                         std::span<std::int64_t const> refs,
+                         std::span<location const> locations,
+                         tags_t const& tags) {
+                if (is_wanted(id)) {
+                  f(id, refs, locations, tags);
+                }
+              };
+            } else {
+              return [&](std::uint64_t const id, auto&& refs, auto&& tags) {
+                if (is_wanted(id)) {
+                  f(id, refs, tags);
+                }
+              };
+            }
+          }();
+          decode_primitive(block, state_, false, true, false, no_callback{},
+                           on_way, no_callback{});
+        });
+  }
+
+  template <typename Fn>
+  void get_relations(std::span<std::int64_t const> ids, Fn&& f) {
+    get(entity_kind::kRelations, ids,
+        [&](std::span<std::int64_t const> wanted, std::string_view block) {
+          decode_primitive(
+              block, state_, false, false, true, no_callback{}, no_callback{},
+              [&](std::uint64_t const id, auto&& members, auto&& tags) {
+                if (std::ranges::binary_search(
+                        wanted, static_cast<std::int64_t>(id))) {
+                  f(id, members, tags);
+                }
+              });
+        });
+  }
+
+  // Sorts and groups the IDs by the block that may contain them, then calls
+  // fn(sorted IDs of the block, decompressed block) once per block.
+  void get(entity_kind,
+           std::span<std::int64_t const> ids,
+           std::function<void(std::span<std::int64_t const>,
+                              std::string_view)> const& fn);
+
+  // Candidate block for the ID: position in blocks_ (index) or blobs_.
+  std::optional<std::size_t> find_block(entity_kind, std::int64_t id);
+
+  block_head const& head(std::size_t blob);
+
+  raw_reader r_;
+  std::optional<block_index_file> index_;
+  std::vector<block_info> blocks_;  // index: blocks of the requested kind
+  entity_kind blocks_kind_{entity_kind::kNone};
+  std::vector<std::pair<std::size_t, std::size_t>> blobs_;  // (offset, idx)
+  std::vector<std::optional<block_head>> heads_;  // of blobs_, lazy
+  decompressor decompressor_;
+  std::string out_;
+  decode_state state_;
+};
+
+}  // namespace osm
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace osm {
+
+// Physical memory of the current process in bytes (Linux only, all zero
+// elsewhere). Unlike the virtual size, this does not count the untouched
+// parts of memory mapped files.
+//
+// PSS splits shared pages among the processes mapping them, so the PSS of
+// several imports running side by side on the same file sums up to the
+// actual memory used.
+struct memory_usage {
+  std::size_t rss_{0U};
+  std::size_t peak_rss_{0U};
+  std::size_t pss_{0U};
+  std::size_t pss_anon_{0U};  // heap, stacks, anonymous mappings
+  std::size_t pss_file_{0U};  // file mappings (page cache)
+  std::size_t swap_{0U};
+};
+
+memory_usage get_memory_usage();
+
+// Bytes of [data, data + size) currently resident in the page cache,
+// e.g. of a cista::mmap.
+std::size_t resident_bytes(void const* data, std::size_t size);
+
+// Human readable summary in MB.
+std::string to_string(memory_usage const&);
+
+}  // namespace osm
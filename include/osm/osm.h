@@ -1,6 +1,10 @@
 #pragma once
 
 #include <cinttypes>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string_view>
 
 #include "protozero/pbf_message.hpp"
 #include "protozero/types.hpp"
@@ -14,20 +18,149 @@
 
 namespace osm {
 
+enum class blob_type : std::uint8_t { kHeader, kData };
+
+enum class compression : std::uint8_t { kRaw, kZlib, kLzma, kLz4, kZstd };
+
 struct buf {
+  blob_type type_;
+  compression compression_;
+  std::size_t idx_;  // position of the blob in the file
+  std::size_t offset_;  // file offset of the blob header size prefix
   std::size_t raw_size_;
   std::string_view compressed_;
+
+  // Keeps the memory of compressed_ alive if it is not part of a mapped
+  // file (see stream_reader).
+  std::shared_ptr<void const> owner_{};
 };
 
+constexpr auto const kMaxBlobHeaderSize = 64U * 1024U;
+constexpr auto const kMaxBlobSize = 32U * 1024U * 1024U;
+constexpr auto const kMaxUncompressedBlobSize = 32U * 1024U * 1024U;
+
+// Network byte order blob header size prefix.
+inline std::uint32_t parse_blob_header_size(std::string_view s) {
+  auto size = std::uint32_t{};
+  std::memcpy(&size, s.data(), sizeof(size));
+  if constexpr (cista::endian_conversion_necessary<
+                    cista::mode::SERIALIZE_BIG_ENDIAN>()) {
+    size = cista::endian_swap(size);
+  }
+  utl::verify(size <= kMaxBlobHeaderSize, "blob header size {} >= {}", size,
+              kMaxBlobHeaderSize);
+  return size;
+}
+
+struct blob_header_info {
+  std::string_view type_;
+  std::size_t data_size_;
+};
+
+inline blob_header_info parse_blob_header(std::string_view s) {
+  auto data_size = 0;
+  auto blob_header_type = protozero::data_view{};
+  auto hdr = protozero::pbf_message<blob_header>{s};
+  while (hdr.next()) {
+    switch (hdr.tag_and_type()) {
+      case protozero::tag_and_type(blob_header::required_string_type,
+                                   protozero::pbf_wire_type::length_delimited):
+        blob_header_type = hdr.get_view();
+        break;
+
+      case protozero::tag_and_type(blob_header::required_int32_datasize,
+                                   protozero::pbf_wire_type::varint):
+        data_size = hdr.get_int32();
+        break;
+
+      default: hdr.skip();
+    }
+  }
+  utl::verify(data_size >= 0, "invalid blob data size {}", data_size);
+  return {.type_ = std::string_view{blob_header_type},
+          .data_size_ = static_cast<std::size_t>(data_size)};
+}
+
+// Blob of the `idx`-th blob in the file, buf::offset_ left to the caller.
+inline buf parse_blob(std::string_view const type,
+                      std::size_t const idx,
+                      std::string_view s) {
+  auto raw_size = 0;
+  auto method = compression::kRaw;
+  auto compressed = std::optional<std::string_view>{};
+  auto blob = protozero::pbf_message<osm::blob>{s};
+  while (blob.next()) {
+    switch (blob.tag_and_type()) {
+      case protozero::tag_and_type(blob::optional_bytes_raw,
+                                   protozero::pbf_wire_type::length_delimited):
+        method = compression::kRaw;
+        compressed = blob.get_view();
+        break;
+
+      case protozero::tag_and_type(blob::optional_bytes_zlib_data,
+                                   protozero::pbf_wire_type::length_delimited):
+        method = compression::kZlib;
+        compressed = blob.get_view();
+        break;
+
+      case protozero::tag_and_type(blob::optional_bytes_lzma_data,
+                                   protozero::pbf_wire_type::length_delimited):
+        method = compression::kLzma;
+        compressed = blob.get_view();
+        break;
+
+      case protozero::tag_and_type(blob::optional_bytes_lz4_data,
+                                   protozero::pbf_wire_type::length_delimited):
+        method = compression::kLz4;
+        compressed = blob.get_view();
+        break;
+
+      case protozero::tag_and_type(blob::optional_bytes_zstd_data,
+                                   protozero::pbf_wire_type::length_delimited):
+        method = compression::kZstd;
+        compressed = blob.get_view();
+        break;
+
+      case protozero::tag_and_type(blob::optional_int32_raw_size,
+                                   protozero::pbf_wire_type::varint):
+        raw_size = blob.get_int32();
+        utl::verify(raw_size >= 0 && raw_size <= kMaxUncompressedBlobSize,
+                    "invalid raw size {}", raw_size);
+        break;
+
+      default: blob.skip();
+    }
+  }
+  utl::verify(compressed.has_value(), "blob without data");
+  if (method == compression::kRaw) {
+    raw_size = static_cast<int>(compressed->size());
+  }
+
+  utl::verify(type == "OSMHeader" || type == "OSMData",
+              "unknown blob header type {}", type);
+  utl::verify(idx != 0U || type == "OSMHeader",
+              "first blob is {}, not OSMHeader", type);
+
+  return buf{
+      .type_ = type == "OSMHeader" ? blob_type::kHeader : blob_type::kData,
+      .compression_ = method,
+      .idx_ = idx,
+      .offset_ = 0U,
+      .raw_size_ = static_cast<std::size_t>(raw_size),
+      .compressed_ = *compressed};
+}
+
 struct raw_reader {
-  static constexpr auto const kMaxBlobHeaderSize = 64U * 1024U;
-  static constexpr auto const kMaxUncompressedBlobSize = 32U * 1024U * 1024U;
+  static constexpr auto const kMaxBlobHeaderSize = osm::kMaxBlobHeaderSize;
+  static constexpr auto const kMaxUncompressedBlobSize =
+      osm::kMaxUncompressedBlobSize;
 
   std::optional<buf> read() {
     if (rest_.empty()) {
       return std::nullopt;
     }
 
+    auto const blob_offset = offset();
     auto const read = [&](std::size_t n) {
       utl::verify(n <= rest_.size(), "bytes left {} < {}", rest_.size(), n);
       auto buf = rest_.substr(0, n);
@@ -35,67 +168,29 @@ struct raw_reader {
       return buf;
     };
 
-    // Read blob header size.
-    auto size = std::uint32_t{};
-    auto size_buf = read(sizeof(size));
-    std::memcpy(&size, size_buf.data(), sizeof(size));
-    if constexpr (cista::endian_conversion_necessary<
-                      cista::mode::SERIALIZE_BIG_ENDIAN>()) {
-      size = cista::endian_swap(size);
-    }
-    utl::verify(size <= kMaxBlobHeaderSize, "blob header size {} >= {}", size,
-                kMaxBlobHeaderSize);
-
-    // Parse blob header.
-    auto data_size = 0;
-    auto blob_header_type = protozero::data_view{};
-    auto hdr = protozero::pbf_message<blob_header>{read(size)};
-    while (hdr.next()) {
-      switch (hdr.tag_and_type()) {
-        case protozero::tag_and_type(
-            blob_header::required_string_type,
-            protozero::pbf_wire_type::length_delimited):
-          blob_header_type = hdr.get_view();
-          break;
-
-        case protozero::tag_and_type(blob_header::required_int32_datasize,
-                                     protozero::pbf_wire_type::varint):
-          data_size = hdr.get_int32();
-          break;
-
-        default: hdr.skip();
-      }
-    }
+    auto const size = parse_blob_header_size(read(sizeof(std::uint32_t)));
+    auto const header = parse_blob_header(read(size));
+    auto b = parse_blob(header.type_, next_idx_, read(header.data_size_));
+    b.offset_ = blob_offset;
+    ++next_idx_;
+    return b;
+  }
 
-    // Parse blob.
-    auto raw_size = 0;
-    auto compressed = std::optional<std::string_view>{};
-    auto blob = protozero::pbf_message<blob_header>{read(data_size)};
-    while (blob.next()) {
-      switch (blob.tag_and_type()) {
-        case protozero::tag_and_type(
-            blob::optional_bytes_zlib_data,
-            protozero::pbf_wire_type::length_delimited):
-          compressed = blob.get_view();
-          break;
-
-        case protozero::tag_and_type(blob::optional_int32_raw_size,
-                                     protozero::pbf_wire_type::varint):
-          raw_size = blob.get_int32();
-          utl::verify(raw_size >= 0 && raw_size <= kMaxUncompressedBlobSize,
-                      "invalid raw size {}", raw_size);
-          break;
-
-        default: blob.skip();
-      }
-    }
-    utl::verify(compressed.has_value(), "unsupported blob type");
+  std::size_t offset() const { return file_.size() - rest_.size(); }
+  std::size_t size() const { return file_.size(); }
 
-    return buf{raw_size, *compressed};
+  // Continues reading at the blob starting at `offset` (known from a previous
+  // read() or an index) which is the `idx`-th blob in the file.
+  void seek(std::size_t const offset, std::size_t const idx) {
+    utl::verify(offset <= file_.size(), "seek {} > file size {}", offset,
+                file_.size());
+    rest_ = file_.view().substr(offset);
+    next_idx_ = idx;
   }
 
   cista::mmap file_;
   std::string_view rest_{file_.view()};
+  std::size_t next_idx_{0U};
 };
 
-}  // namespace osm
\ No newline at end of file
+}  // namespace osm
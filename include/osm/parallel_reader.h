@@ -0,0 +1,487 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "boost/fiber/buffered_channel.hpp"
+
+#include "cista/mmap.h"
+
+#include "osm/block_cache.h"
+#include "osm/block_index.h"
+#include "osm/buffer_pool.h"
+#include "osm/decoder.h"
+#include "osm/decompress.h"
+#include "osm/header.h"
+#include "osm/osm.h"
+#include "osm/peek.h"
+#include "osm/read_config.h"
+#include "osm/reorder_buffer.h"
+#include "osm/shard.h"
+#include "osm/stats.h"
+#include "osm/stream_reader.h"
+
+namespace osm {
+
+// Per-worker state, reused across blocks.
+struct block_decoder {
+  // The block if it can contain entities of the requested kinds (see
+  // decompress_wanted), decompressed into the leased buffer, if any.
+  std::optional<std::string_view> decompress(buf const& b,
+                                             read_config const& c,
+                                             buffer_pool::lease& l) {
+    auto& out = l.pool_ == nullptr ? out_ : l.buf_;
+    auto const kinds = c.kinds();
+    if (!c.peek_kinds_ || kinds == entity_kind::kAll) {
+      last_kind_ = entity_kind::kAll;
+      return decompressor_.decompress(b, out);
+    }
+    auto const p = decompress_wanted(decompressor_, b, kinds, out);
+    last_kind_ = p.kind_;
+    return p.block_;
+  }
+
+  decompressor decompressor_;
+  std::string out_;
+  decode_state state_;
+  entity_kind last_kind_{entity_kind::kAll};  // of the last block
+};
+
+namespace detail {
+
+struct first_error {
+  void set(std::exception_ptr e) {
+    auto const lock = std::scoped_lock{mutex_};
+    if (!e_) {
+      e_ = std::move(e);
+    }
+  }
+
+  void rethrow() const {
+    if (e_) {
+      std::rethrow_exception(e_);
+    }
+  }
+
+  std::mutex mutex_;
+  std::exception_ptr e_;
+};
+
+// Channel capacity for queue_size blobs: boost requires 2^N, at least 2.
+inline std::size_t channel_size(std::size_t const queue_size) {
+  return std::bit_ceil(std::max(std::size_t{2U}, queue_size));
+}
+
+// Checks the OSMHeader against the config and the way callback. False if
+// the file has nothing of interest (header bbox disjoint from c.bbox_).
+template <typename WayFn>
+bool check_header(header const& h, read_config const& c) {
+  if constexpr (is_way_locations_fn<WayFn>) {
+    utl::verify(!c.read_ways_ || h.locations_on_ways(),
+                "way locations requested, file is not {}", kLocationsOnWays);
+  }
+  return !c.bbox_.has_value() || !h.bbox_.has_value() ||
+         c.bbox_->intersects(*h.bbox_);
+}
+
+struct job {
+  buf b_;
+  buffer_pool::lease lease_;
+};
+
+// Leases the decompression buffer for b from c.pool_ (no-op without pool).
+// Returns nullopt if stopped while waiting for the budget.
+inline std::optional<buffer_pool::lease> lease_buffer(read_config const& c,
+                                                      buf const& b,
+                                                      std::stop_token stop,
+                                                      thread_stats* s) {
+  if (c.pool_ == nullptr) {
+    return buffer_pool::lease{};
+  }
+  auto const t = scoped_timer{get(s, &thread_stats::producer_stall_ns_)};
+  return c.pool_->acquire(
+      b.compression_ == compression::kRaw ? 0U : b.raw_size_, stop);
+}
+
+}  // namespace detail
+
+// Decodes all data blobs on c.n_threads_ threads. Callbacks are called
+// concurrently from the worker threads. The first exception thrown by the
+// reader, the decompression or a callback stops the pipeline and is rethrown.
+//
+// Reader: raw_reader or anything with the same read() / offset() / size()
+// interface (e.g. indexed_reader, stream_reader, block_cache_reader).
+//
+// Fields: see decode_primitive. Kinds outside Fields (or with no_callback)
+// are not read, as if disabled in the config.
+template <field Fields = field::kAll,
+          typename Reader,
+          typename NodeFn,
+          typename WayFn,
+          typename RelFn>
+  requires requires(Reader& r) { r.read(); }
+void read(Reader& r,
+          read_config const& config,
+          NodeFn&& on_node,
+          WayFn&& on_way,
+          RelFn&& on_rel) {
+  namespace bf = boost::fibers;
+
+  constexpr auto const kFields =
+      effective_fields<Fields, NodeFn, WayFn, RelFn>();
+  auto const c = config.masked(kFields);
+
+  auto ch =
+      bf::buffered_channel<detail::job>{detail::channel_size(c.queue_size_)};
+  auto error = detail::first_error{};
+  auto stop = std::stop_source{};
+
+  // Sort.Type_then_ID: reading stops after the last block of wanted kind.
+  auto sorted = std::atomic_bool{false};
+  auto done = std::atomic_bool{false};
+
+  auto const n_threads = c.n_threads_ == 0U ? 1U : c.n_threads_;
+  auto workers = std::vector<std::thread>{};
+  workers.reserve(n_threads);
+  for (auto i = 0U; i != n_threads; ++i) {
+    workers.emplace_back([&]() {
+      try {
+        using detail::get;
+        using detail::scoped_timer;
+
+        auto const s =
+            c.stats_ == nullptr ? nullptr : &c.stats_->add_thread();
+        auto node_fn = detail::instrument(on_node, s, &thread_stats::nodes_);
+        auto way_fn = detail::instrument(on_way, s, &thread_stats::ways_);
+        auto rel_fn =
+            detail::instrument(on_rel, s, &thread_stats::relations_);
+
+        auto d = block_decoder{};
+        d.state_.filter_ = c.filter_;
+        d.state_.interner_ = c.interner_;
+        auto j = detail::job{};
+        auto const& b = j.b_;
+        auto const pop = [&]() {
+          auto const t =
+              scoped_timer{get(s, &thread_stats::consumer_stall_ns_)};
+          return ch.pop(j) == bf::channel_op_status::success;
+        };
+        while (pop()) {
+          auto const start =
+              s == nullptr ? stats::clock::time_point{} : stats::clock::now();
+          if (c.stats_ != nullptr) {
+            c.stats_->dequeued();
+          }
+
+          auto block = std::optional<std::string_view>{};
+          {
+            auto const t = scoped_timer{get(s, &thread_stats::inflate_ns_)};
+            block = d.decompress(b, c, j.lease_);
+          }
+
+          if (!block.has_value()) {
+            if (sorted && all_after(d.last_kind_, c.kinds())) {
+              done = true;
+            }
+          } else {
+            auto const t = scoped_timer{get(s, &thread_stats::decode_ns_)};
+            decode_primitive<kFields>(*block, d.state_, c.read_nodes_,
+                                      c.read_ways_, c.read_relations_, node_fn,
+                                      way_fn, rel_fn);
+          }
+
+          j.lease_.reset();  // don't hold the budget while waiting
+
+          if (s != nullptr) {
+            s->bytes_inflated_.add(block.has_value() ? block->size() : 0U);
+            detail::record_latency(s, start);
+          }
+        }
+      } catch (...) {
+        error.set(std::current_exception());
+        ch.close();
+        stop.request_stop();
+      }
+    });
+  }
+
+  try {
+    auto const s = c.stats_ == nullptr ? nullptr : &c.stats_->add_thread();
+    auto const push = [&](detail::job&& x) {
+      auto const t = detail::scoped_timer{
+          detail::get(s, &thread_stats::producer_stall_ns_)};
+      if (ch.push(std::move(x)) != bf::channel_op_status::success) {
+        return false;
+      }
+      if (c.stats_ != nullptr) {
+        c.stats_->enqueued();
+      }
+      return true;
+    };
+
+    auto b = std::optional<buf>{};
+    while (!done && (b = r.read()).has_value()) {
+      if (s != nullptr) {
+        s->blobs_read_.add(1U);
+        s->bytes_read_.add(b->compressed_.size());
+        c.stats_->maybe_sample();
+      }
+
+      if (b->type_ == blob_type::kHeader) {
+        auto const h = read_header(*b);
+        if (!detail::check_header<WayFn>(h, c)) {
+          break;  // nothing of interest in this file
+        }
+        sorted = h.sorted();
+      } else {
+        auto l = detail::lease_buffer(c, *b, stop.get_token(), s);
+        if (!l.has_value() || !push(detail::job{*b, std::move(*l)})) {
+          break;  // stopped by a failing worker
+        }
+      }
+      if (c.progress_) {
+        c.progress_(r.offset(), r.size());
+      }
+    }
+  } catch (...) {
+    error.set(std::current_exception());
+  }
+
+  ch.close();
+  for (auto& w : workers) {
+    w.join();
+  }
+  if (c.stats_ != nullptr) {
+    c.stats_->maybe_sample(true);
+  }
+  error.rethrow();
+}
+
+// Ordered mode: `map(buf, block, decode_state&)` runs on the worker threads for
+// each decompressed primitive block (typically calling decode_primitive and
+// collecting what it needs), `reduce(result)` receives the map results in the
+// order the reader returned the blobs. reduce is never called concurrently.
+// At most c.reorder_window_ blobs are dispatched ahead of the oldest one not
+// yet reduced, so a slow block stalls the reader instead of growing the
+// reorder buffer.
+template <typename Reader, typename MapFn, typename ReduceFn>
+  requires requires(Reader& r) { r.read(); }
+void read_ordered(Reader& r,
+                  read_config const& c,
+                  MapFn&& map,
+                  ReduceFn&& reduce) {
+  namespace bf = boost::fibers;
+
+  using result_t =
+      std::invoke_result_t<MapFn&, buf const&, std::string_view,
+                           decode_state&>;
+
+  // Sequence numbers count the blobs returned by the reader. They differ from
+  // buf::idx_ when the reader skips blobs.
+  struct task {
+    std::size_t seq_;
+    buf b_;
+    buffer_pool::lease lease_;
+  };
+
+  auto ch = bf::buffered_channel<task>{detail::channel_size(c.queue_size_)};
+  auto reorder = reorder_buffer<result_t>{c.reorder_window_};
+  auto error = detail::first_error{};
+  auto stop_source = std::stop_source{};
+  auto const stop = [&]() {
+    error.set(std::current_exception());
+    ch.close();
+    reorder.close();
+    stop_source.request_stop();
+  };
+
+  auto const n_threads = c.n_threads_ == 0U ? 1U : c.n_threads_;
+  auto workers = std::vector<std::thread>{};
+  workers.reserve(n_threads);
+  for (auto i = 0U; i != n_threads; ++i) {
+    workers.emplace_back([&]() {
+      try {
+        using detail::get;
+        using detail::scoped_timer;
+
+        auto const s =
+            c.stats_ == nullptr ? nullptr : &c.stats_->add_thread();
+        auto d = block_decoder{};
+        d.state_.filter_ = c.filter_;
+        d.state_.interner_ = c.interner_;
+        auto t = task{};
+        auto const pop = [&]() {
+          auto const timer =
+              scoped_timer{get(s, &thread_stats::consumer_stall_ns_)};
+          return ch.pop(t) == bf::channel_op_status::success;
+        };
+        while (pop()) {
+          auto const start =
+              s == nullptr ? stats::clock::time_point{} : stats::clock::now();
+          if (c.stats_ != nullptr) {
+            c.stats_->dequeued();
+          }
+
+          auto block = std::optional<std::string_view>{};
+          {
+            auto const timer = scoped_timer{get(s, &thread_stats::inflate_ns_)};
+            block = d.decompress(t.b_, c, t.lease_);
+          }
+
+          auto result = std::optional<result_t>{};
+          if (block.has_value()) {
+            auto const timer = scoped_timer{get(s, &thread_stats::decode_ns_)};
+            result = map(t.b_, *block, d.state_);
+          }
+          t.lease_.reset();
+
+          if (s != nullptr) {
+            s->bytes_inflated_.add(block.has_value() ? block->size() : 0U);
+            detail::record_latency(s, start);
+          }
+          reorder.complete(t.seq_, std::move(result), reduce);
+        }
+      } catch (...) {
+        stop();
+      }
+    });
+  }
+
+  try {
+    auto const s = c.stats_ == nullptr ? nullptr : &c.stats_->add_thread();
+    auto const stall = detail::get(s, &thread_stats::producer_stall_ns_);
+    auto const acquire = [&](std::size_t const seq) {
+      auto const t = detail::scoped_timer{stall};
+      return reorder.acquire(seq);
+    };
+    auto const push = [&](task&& x) {
+      auto const t = detail::scoped_timer{stall};
+      if (ch.push(std::move(x)) != bf::channel_op_status::success) {
+        return false;
+      }
+      if (c.stats_ != nullptr) {
+        c.stats_->enqueued();
+      }
+      return true;
+    };
+
+    auto b = std::optional<buf>{};
+    for (auto seq = std::size_t{0U}; (b = r.read()).has_value(); ++seq) {
+      if (s != nullptr) {
+        s->blobs_read_.add(1U);
+        s->bytes_read_.add(b->compressed_.size());
+        c.stats_->maybe_sample();
+      }
+      if (!acquire(seq)) {
+        break;
+      }
+      if (b->type_ != blob_type::kData) {
+        reorder.complete(seq, std::nullopt, reduce);
+      } else {
+        auto l = detail::lease_buffer(c, *b, stop_source.get_token(), s);
+        if (!l.has_value() || !push(task{seq, *b, std::move(*l)})) {
+          break;
+        }
+      }
+      if (c.progress_) {
+        c.progress_(r.offset(), r.size());
+      }
+    }
+  } catch (...) {
+    stop();
+  }
+
+  ch.close();
+  for (auto& w : workers) {
+    w.join();
+  }
+  if (c.stats_ != nullptr) {
+    c.stats_->maybe_sample(true);
+  }
+  error.rethrow();
+}
+
+template <field Fields = field::kAll,
+          typename NodeFn,
+          typename WayFn,
+          typename RelFn>
+void read(char const* path,
+          read_config const& config,
+          NodeFn&& on_node,
+          WayFn&& on_way,
+          RelFn&& on_rel) {
+  constexpr auto const kFields =
+      effective_fields<Fields, NodeFn, WayFn, RelFn>();
+  auto const c = config.masked(kFields);
+
+  auto ec = std::error_code{};
+  if (c.stream_.has_value() || !std::filesystem::is_regular_file(path, ec)) {
+    utl::verify(!c.shard_.has_value(), "shards require a seekable file");
+    auto sr = stream_reader{path, c.stream_.value_or(stream_config{})};
+    read<kFields>(sr, c, std::forward<NodeFn>(on_node),
+                  std::forward<WayFn>(on_way), std::forward<RelFn>(on_rel));
+    return;
+  }
+
+  if (c.cache_.has_value() && !c.shard_.has_value()) {
+    auto const f = ensure_block_cache(path, *c.cache_, c);
+    if (f.has_value()) {
+      auto cr = block_cache_reader{.f_ = *f};
+      read<kFields>(cr, c, std::forward<NodeFn>(on_node),
+                    std::forward<WayFn>(on_way), std::forward<RelFn>(on_rel));
+      return;
+    }
+  }
+
+  auto r =
+      raw_reader{.file_ = cista::mmap{path, cista::mmap::protection::READ}};
+
+  if (c.shard_.has_value()) {
+    auto const idx = c.use_index_
+                         ? read_block_index(default_index_path(path), path)
+                         : std::nullopt;
+    auto const range = idx.has_value() ? get_shard(**idx, *c.shard_)
+                                       : get_shard(r.file_.view(), *c.shard_);
+    auto sr = shard_reader{.r_ = r, .range_ = range};
+    read<kFields>(sr, c, std::forward<NodeFn>(on_node),
+                  std::forward<WayFn>(on_way), std::forward<RelFn>(on_rel));
+    return;
+  }
+
+  auto const kinds = c.kinds();
+  if (c.use_index_ && (kinds != entity_kind::kAll || c.bbox_.has_value())) {
+    auto const idx = read_block_index(default_index_path(path), path);
+    if (idx.has_value()) {
+      // The index selects data blocks only: check the OSMHeader here.
+      if (!detail::check_header<WayFn>(read_header(path), c)) {
+        return;
+      }
+      auto ir = indexed_reader{
+          .r_ = r, .selected_ = select_blocks(**idx, [&](block_info const& b) {
+            return intersects(b.kinds_, kinds) &&
+                   (!c.bbox_.has_value() || b.kinds_ != entity_kind::kNodes ||
+                    c.bbox_->intersects(b.box()));
+          })};
+      read<kFields>(ir, c, std::forward<NodeFn>(on_node),
+                    std::forward<WayFn>(on_way), std::forward<RelFn>(on_rel));
+      return;
+    }
+  }
+
+  read<kFields>(r, c, std::forward<NodeFn>(on_node),
+                std::forward<WayFn>(on_way), std::forward<RelFn>(on_rel));
+}
+
+}  // namespace osm
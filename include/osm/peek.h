@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "protozero/types.hpp"
+#include "protozero/varint.hpp"
+
+#include "utl/verify.h"
+
+#include "osm/decoder.h"
+#include "osm/decompress.h"
+#include "osm/osm.h"
+#include "osm/tags.h"
+
+namespace osm {
+
+namespace detail {
+
+// Stream interface (begin/read_some/end) over uncompressed data.
+struct memory_stream {
+  void begin(std::string_view in) { in_ = in; }
+
+  std::size_t read_some(char* out, std::size_t n) {
+    n = std::min(n, in_.size());
+    std::memcpy(out, in_.data(), n);
+    in_.remove_prefix(n);
+    return n;
+  }
+
+  void end() {}
+
+  std::string_view in_;
+};
+
+// Reads a decompression stream through a small window, or into `out` to
+// keep the inflated bytes (end_: number of bytes inflated so far).
+template <typename Stream>
+struct stream_cursor {
+  explicit stream_cursor(Stream& z)
+      : z_{z}, out_{window_.data(), window_.size()}, keep_{false} {}
+
+  stream_cursor(Stream& z, std::span<char> out)
+      : z_{z}, out_{out}, keep_{true} {}
+
+  std::optional<std::uint8_t> get() {
+    if (pos_ == end_ && !refill()) {
+      return std::nullopt;
+    }
+    return static_cast<std::uint8_t>(out_[pos_++]);
+  }
+
+  std::optional<std::uint64_t> get_varint() {
+    auto x = std::uint64_t{0U};
+    for (auto shift = 0U; shift < 64U; shift += 7U) {
+      auto const b = get();
+      if (!b.has_value()) {
+        return std::nullopt;
+      }
+      x |= static_cast<std::uint64_t>(*b & 0x7FU) << shift;
+      if ((*b & 0x80U) == 0U) {
+        return x;
+      }
+    }
+    return std::nullopt;
+  }
+
+  bool skip(std::uint64_t n) {
+    while (n != 0U) {
+      if (pos_ == end_ && !refill()) {
+        return false;
+      }
+      auto const k = std::min(n, static_cast<std::uint64_t>(end_ - pos_));
+      pos_ += k;
+      n -= k;
+    }
+    return true;
+  }
+
+  bool refill() {
+    if (!keep_) {
+      pos_ = end_ = 0U;
+    }
+    auto const n = std::min(window_.size(), out_.size() - end_);
+    auto const k = n == 0U ? 0U : z_.read_some(out_.data() + end_, n);
+    end_ += k;
+    return k != 0U;
+  }
+
+  Stream& z_;
+  std::array<char, 4096U> window_;
+  std::span<char> out_;
+  bool keep_;
+  std::size_t pos_{0U}, end_{0U};
+};
+
+}  // namespace detail
+
+namespace detail {
+
+// Skips a field of the given wire type.
+template <typename Stream>
+bool skip_field(stream_cursor<Stream>& cursor,
+                protozero::pbf_wire_type const type) {
+  using protozero::pbf_wire_type;
+  switch (type) {
+    case pbf_wire_type::varint: return cursor.get_varint().has_value();
+    case pbf_wire_type::fixed64: return cursor.skip(8U);
+    case pbf_wire_type::fixed32: return cursor.skip(4U);
+    case pbf_wire_type::length_delimited: {
+      auto const size = cursor.get_varint();
+      return size.has_value() && cursor.skip(*size);
+    }
+    default: return false;
+  }
+}
+
+// Moves the cursor into the first primitive group of a block and returns
+// the key of the group's first field (nodes, dense, ways, relations).
+template <typename Stream>
+std::optional<std::uint64_t> first_group_key(stream_cursor<Stream>& cursor) {
+  using namespace protozero;
+  while (true) {
+    auto const key = cursor.get_varint();
+    if (!key.has_value()) {
+      return std::nullopt;
+    }
+
+    auto const field = static_cast<pbf_tag_type>(*key >> 3U);
+    auto const type = static_cast<pbf_wire_type>(*key & 0x07U);
+    if (field == static_cast<pbf_tag_type>(
+                     primitive_block::repeated_PrimitiveGroup_primitivegroup) &&
+        type == pbf_wire_type::length_delimited) {
+      auto const group_size = cursor.get_varint();
+      if (!group_size.has_value() || *group_size == 0U) {
+        return std::nullopt;
+      }
+      return cursor.get_varint();
+    }
+
+    if (!skip_field(cursor, type)) {
+      return std::nullopt;
+    }
+  }
+}
+
+inline entity_kind group_kind(std::uint64_t const group_key) {
+  switch (static_cast<primitive_group>(group_key >> 3U)) {
+    case primitive_group::repeated_Node_nodes: [[fallthrough]];
+    case primitive_group::optional_DenseNodes_dense: return entity_kind::kNodes;
+    case primitive_group::repeated_Way_ways: return entity_kind::kWays;
+    case primitive_group::repeated_Relation_relations:
+      return entity_kind::kRelations;
+    default: return entity_kind::kAll;
+  }
+}
+
+// ID of the first entity of the group, the cursor being positioned after
+// the group's first key.
+template <typename Stream>
+std::optional<std::int64_t> first_id(stream_cursor<Stream>& cursor,
+                                     std::uint64_t const group_key) {
+  using namespace protozero;
+  auto const group_field = static_cast<primitive_group>(group_key >> 3U);
+  if (!cursor.get_varint().has_value()) {  // entity message size
+    return std::nullopt;
+  }
+
+  // The ID is field 1 in Node, DenseNodes, Way and Relation.
+  while (true) {
+    auto const key = cursor.get_varint();
+    if (!key.has_value()) {
+      return std::nullopt;
+    }
+
+    auto const type = static_cast<pbf_wire_type>(*key & 0x07U);
+    if ((*key >> 3U) != 1U) {
+      if (!skip_field(cursor, type)) {
+        return std::nullopt;
+      }
+      continue;
+    }
+
+    switch (group_field) {
+      case primitive_group::optional_DenseNodes_dense: {
+        if (type != pbf_wire_type::length_delimited ||
+            !cursor.get_varint().has_value()) {
+          return std::nullopt;
+        }
+        auto const id = cursor.get_varint();  // first delta: absolute
+        return id.transform([](std::uint64_t const x) {
+          return decode_zigzag64(x);
+        });
+      }
+
+      case primitive_group::repeated_Node_nodes: {
+        auto const id = cursor.get_varint();
+        return id.transform([](std::uint64_t const x) {
+          return decode_zigzag64(x);
+        });
+      }
+
+      default: {
+        auto const id = cursor.get_varint();
+        return id.transform([](std::uint64_t const x) {
+          return static_cast<std::int64_t>(x);
+        });
+      }
+    }
+  }
+}
+
+}  // namespace detail
+
+// Kind of the first primitive group of a block, determined by inflating only
+// the block prefix up to that group: the string table in front of it is
+// decompressed into a small window and discarded, the groups are not touched.
+// Use decompress_wanted to keep the prefix for blocks that are decoded.
+//
+// Assumes that all groups of a block contain the same entity kind (which is
+// what common writers produce). Returns entity_kind::kAll if undecidable.
+template <typename Stream>
+entity_kind peek_kind(Stream& z, std::string_view compressed) {
+  z.begin(compressed);
+  auto cursor = detail::stream_cursor<Stream>{z};
+  auto const key = detail::first_group_key(cursor);
+  z.end();
+  return key.has_value() ? detail::group_kind(*key) : entity_kind::kAll;
+}
+
+// Kind and ID of the first entity of a block.
+struct block_head {
+  entity_kind kind_{entity_kind::kAll};
+  std::optional<std::int64_t> first_id_;
+};
+
+// Like peek_kind, but inflates a few more bytes: up to the first entity ID.
+template <typename Stream>
+block_head peek_head(Stream& z, std::string_view compressed) {
+  z.begin(compressed);
+  auto cursor = detail::stream_cursor<Stream>{z};
+  auto head = block_head{};
+  if (auto const key = detail::first_group_key(cursor); key.has_value()) {
+    head.kind_ = detail::group_kind(*key);
+    head.first_id_ = detail::first_id(cursor, *key);
+  }
+  z.end();
+  return head;
+}
+
+// Kind of a block and the decompressed block if the kind intersects
+// `kinds`: the prefix inflated to determine the kind goes to `out` and
+// decompression continues from there, wanted blocks are not inflated twice.
+struct peeked_block {
+  entity_kind kind_{entity_kind::kAll};
+  std::optional<std::string_view> block_;  // nullopt: not wanted
+};
+
+template <typename Stream>
+peeked_block decompress_wanted(Stream& z,
+                               buf const& b,
+                               entity_kind const kinds,
+                               std::string& out) {
+  out.resize(b.raw_size_);
+  z.begin(b.compressed_);
+  auto cursor = detail::stream_cursor<Stream>{z, out};
+  auto const key = detail::first_group_key(cursor);
+  auto p = peeked_block{
+      .kind_ = key.has_value() ? detail::group_kind(*key) : entity_kind::kAll};
+  if (!intersects(p.kind_, kinds)) {
+    z.end();
+    return p;
+  }
+
+  auto n = cursor.end_;
+  while (n != out.size()) {
+    auto const k = z.read_some(out.data() + n, out.size() - n);
+    if (k == 0U) {
+      break;
+    }
+    n += k;
+  }
+  auto extra = char{};
+  auto const trailing = z.read_some(&extra, 1U);
+  z.end();
+  utl_verify(n == out.size() && trailing == 0U, "raw size mismatch: {} != {}",
+             n + trailing, out.size());
+  p.block_ = std::string_view{out};
+  return p;
+}
+
+inline entity_kind peek_kind(decompressor& d, buf const& b) {
+  switch (b.compression_) {
+    case compression::kRaw: {
+      auto s = detail::memory_stream{};
+      return peek_kind(s, b.compressed_);
+    }
+
+    case compression::kZlib: return peek_kind(d.zlib_, b.compressed_);
+
+#ifdef OSM_WITH_ZSTD
+    case compression::kZstd: return peek_kind(d.zstd_, b.compressed_);
+#endif
+
+    default: return entity_kind::kAll;
+  }
+}
+
+// Uncompressed blocks are not copied. Compressions without streaming support
+// are decompressed completely (kind kAll).
+inline peeked_block decompress_wanted(decompressor& d,
+                                      buf const& b,
+                                      entity_kind const kinds,
+                                      std::string& out) {
+  switch (b.compression_) {
+    case compression::kRaw: {
+      auto const kind = peek_kind(d, b);
+      return {.kind_ = kind,
+              .block_ = intersects(kind, kinds)
+                            ? std::optional{b.compressed_}
+                            : std::nullopt};
+    }
+
+    case compression::kZlib: return decompress_wanted(d.zlib_, b, kinds, out);
+
+#ifdef OSM_WITH_ZSTD
+    case compression::kZstd: return decompress_wanted(d.zstd_, b, kinds, out);
+#endif
+
+    default:
+      return {.kind_ = entity_kind::kAll, .block_ = d.decompress(b, out)};
+  }
+}
+
+// Falls back to decompressing the whole block into `out` for compressions
+// without streaming support.
+inline block_head peek_head(decompressor& d, buf const& b, std::string& out) {
+  auto s = detail::memory_stream{};
+  switch (b.compression_) {
+    case compression::kRaw: return peek_head(s, b.compressed_);
+
+    case compression::kZlib: return peek_head(d.zlib_, b.compressed_);
+
+#ifdef OSM_WITH_ZSTD
+    case compression::kZstd: return peek_head(d.zstd_, b.compressed_);
+#endif
+
+    default: return peek_head(s, d.decompress(b, out));
+  }
+}
+
+}  // namespace osm
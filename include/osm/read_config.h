@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <thread>
+
+#include "osm/buffer_pool.h"
+#include "osm/decoder.h"
+#include "osm/stats.h"
+#include "osm/stream_reader.h"
+
+namespace osm {
+
+// On-disk cache of inflated blocks (see block_cache.h), shared by all
+// processes using the same directory.
+struct block_cache_config {
+  std::filesystem::path dir_;
+
+  // Limit for all entries in dir_, least recently used entries are evicted.
+  std::uint64_t max_size_{std::uint64_t{16U} << 30U};
+
+  // 0: store blocks uncompressed, otherwise zstd level (OSM_WITH_ZSTD).
+  int zstd_level_{0};
+};
+
+// Shard i of n: the blobs starting in [size * i / n, size * (i + 1) / n).
+// Every blob belongs to exactly one shard and the split only depends on the
+// file contents, so all processes agree without coordination.
+struct shard_spec {
+  unsigned i_{0U};
+  unsigned n_{1U};
+};
+
+struct read_config {
+  entity_kind kinds() const {
+    return (read_nodes_ ? entity_kind::kNodes : entity_kind::kNone) |
+           (read_ways_ ? entity_kind::kWays : entity_kind::kNone) |
+           (read_relations_ ? entity_kind::kRelations : entity_kind::kNone);
+  }
+
+  // Copy that reads no kinds outside `fields`.
+  read_config masked(field const fields) const {
+    auto c = *this;
+    c.read_nodes_ = read_nodes_ && has(fields, field::kNodes);
+    c.read_ways_ = read_ways_ && has(fields, field::kWays);
+    c.read_relations_ = read_relations_ && has(fields, field::kRelations);
+    return c;
+  }
+
+  // Number of decoder threads. The calling thread reads blobs.
+  unsigned n_threads_{std::thread::hardware_concurrency()};
+
+  // Blobs in flight between reader and decoders (rounded up to 2^N).
+  std::size_t queue_size_{64U};
+
+  // read_ordered(): maximum number of blobs between the oldest unreleased
+  // and the newest dispatched one.
+  std::size_t reorder_window_{256U};
+
+  bool read_nodes_{true};
+  bool read_ways_{true};
+  bool read_relations_{true};
+
+  // Drop blocks of unwanted entity kinds after inflating only their prefix
+  // (see decompress_wanted). Only effective if not all kinds are read.
+  bool peek_kinds_{true};
+
+  // read(path, ...): select blocks through the block index sidecar if there
+  // is an up to date one. Only effective if not all kinds are read.
+  bool use_index_{true};
+
+  // Only pass entities with at least one matching tag to the callbacks.
+  // Blocks whose string table contains none of the filter's strings are
+  // dropped before decoding any entity.
+  tag_filter const* filter_{nullptr};
+
+  // Only decode blocks whose nodes may lie inside the box: reading stops
+  // if the header bbox is disjoint, the block index (if used) drops node
+  // blocks outside. Nodes are not filtered individually.
+  std::optional<bbox> bbox_{};
+
+  // Required for field::kTagIds: interns the string table of every block,
+  // shared by all decoder threads.
+  string_interner* interner_{nullptr};
+
+  // Decompression buffers: with a pool, the reading thread leases the
+  // uncompressed size of each blob before queueing it and blocks while the
+  // pool's byte budget is exhausted. Without, every worker keeps its own
+  // buffer and only queue_size_ bounds the blobs in flight.
+  buffer_pool* pool_{nullptr};
+
+  // read(path, ...): only read this shard of the file (see get_shard).
+  // Uses the block index sidecar for the boundaries if there is an up to
+  // date one (and use_index_), otherwise resyncs on the blob headers.
+  // Blocks are not preselected by kind or bbox through the index.
+  std::optional<shard_spec> shard_{};
+
+  // read(path, ...): read blobs with a stream_reader instead of mapping
+  // the file. Always used for "-" (stdin) and paths that are no regular
+  // files (pipes). No block index or shards.
+  std::optional<stream_config> stream_{};
+
+  // read(path, ...): read inflated blocks from the cache, building the
+  // cache entry for the file first if there is none. Ignored for shards
+  // and streamed input, and if the entry exceeds the cache size limit.
+  std::optional<block_cache_config> cache_{};
+
+  // Pipeline instrumentation, see stats.
+  stats* stats_{nullptr};
+
+  // Called from the reading thread with (bytes read, file size).
+  std::function<void(std::size_t, std::size_t)> progress_{};
+};
+
+}  // namespace osm
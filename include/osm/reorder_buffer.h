@@ -0,0 +1,103 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "utl/verify.h"
+
+namespace osm {
+
+// Collects results that finish out of order and hands them to a consumer in
+// sequence order. Only `window` consecutive sequence numbers can be pending
+// at a time: acquire() blocks until the sequence number fits the window.
+//
+// The consumer is never called concurrently, but not always from the same
+// thread: whoever completes the next expected sequence number releases it
+// (and everything finished behind it) outside of the lock.
+template <typename T>
+struct reorder_buffer {
+  explicit reorder_buffer(std::size_t const window,
+                          std::size_t const first = 0U)
+      : slots_(window), done_(window, false), next_{first} {
+    utl::verify(window != 0U, "reorder window must not be empty");
+  }
+
+  // Returns false if the buffer was closed while waiting.
+  bool acquire(std::size_t const seq) {
+    auto lock = std::unique_lock{mutex_};
+    cv_.wait(lock, [&]() { return closed_ || seq < next_ + slots_.size(); });
+    return !closed_;
+  }
+
+  // `result` is nullopt for sequence numbers without payload (skipped).
+  template <typename Fn>
+  void complete(std::size_t const seq,
+                std::optional<T>&& result,
+                Fn&& consume) {
+    auto lock = std::unique_lock{mutex_};
+    auto const slot = seq % slots_.size();
+    utl::verify(seq >= next_ && seq < next_ + slots_.size() && !done_[slot],
+                "reorder_buffer: sequence number {} not acquired", seq);
+    slots_[slot] = std::move(result);
+    done_[slot] = true;
+
+    if (releasing_) {
+      return;
+    }
+
+    releasing_ = true;
+    auto const reset = finally{[&]() {
+      if (!lock.owns_lock()) {
+        lock.lock();  // consume threw
+      }
+      releasing_ = false;
+    }};
+    while (!closed_ && done_[next_ % slots_.size()]) {
+      auto const s = next_ % slots_.size();
+      auto x = std::move(slots_[s]);
+      slots_[s].reset();
+      done_[s] = false;
+      ++next_;
+      cv_.notify_all();
+
+      if (x.has_value()) {
+        lock.unlock();
+        consume(std::move(*x));
+        lock.lock();
+      }
+    }
+  }
+
+  void close() {
+    {
+      auto const lock = std::scoped_lock{mutex_};
+      closed_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  std::size_t next() const {
+    auto const lock = std::scoped_lock{mutex_};
+    return next_;
+  }
+
+private:
+  template <typename Fn>
+  struct finally {
+    ~finally() { fn_(); }
+    Fn fn_;
+  };
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::optional<T>> slots_;
+  std::vector<bool> done_;
+  std::size_t next_{0U};
+  bool releasing_{false};
+  bool closed_{false};
+};
+
+}  // namespace osm
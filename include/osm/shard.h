@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+#include "osm/block_index.h"
+#include "osm/osm.h"
+#include "osm/read_config.h"
+
+namespace osm {
+
+// Blob aligned byte range [begin_, end_) of a shard.
+struct shard_range {
+  std::size_t begin_{0U};
+  std::size_t end_{0U};
+
+  // buf::idx_ of the blob at begin_, if known (from an index).
+  std::optional<std::size_t> idx_{};
+};
+
+// First blob start at or after `offset`, file.size() if there is none.
+// Searches the BlobHeader type field of data blobs ("\x0a\x07OSMData") and
+// accepts a match only if the blob frame around it is consistent and
+// followed by another blob or the end of the file.
+std::size_t next_blob_start(std::string_view file, std::size_t offset);
+
+// Range of the shard by scanning for the boundaries (reads a few KB around
+// each boundary, no blob headers in between).
+shard_range get_shard(std::string_view file, shard_spec);
+
+// Same range, looked up in the block index.
+shard_range get_shard(block_index const&, shard_spec);
+
+// Reads the OSMHeader blob, then the blobs of the shard. Usable with
+// read() / read_ordered() in place of a raw_reader. Without known
+// shard_range::idx_, blob indices continue at 1 after the header.
+struct shard_reader {
+  std::optional<buf> read();
+
+  // Progress within the shard.
+  std::size_t offset() const;
+  std::size_t size() const { return range_.end_ - range_.begin_; }
+
+  raw_reader& r_;
+  shard_range range_;
+  bool started_{false};
+};
+
+}  // namespace osm
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cinttypes>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "cista/containers/string.h"
+#include "cista/containers/vector.h"
+#include "cista/mmap.h"
+
+#include "osm/location.h"
+#include "osm/read_config.h"
+
+namespace osm {
+
+// Interned tag: IDs into snapshot::strings_.
+struct tag_id {
+  std::uint32_t key_;
+  std::uint32_t value_;
+};
+
+// Tags of entity i: tags_[offsets_[i], offsets_[i + 1]).
+struct snapshot_tags {
+  std::span<tag_id const> get(std::size_t const i) const {
+    return {tags_.data() + offsets_[i], tags_.data() + offsets_[i + 1U]};
+  }
+
+  cista::offset::vector<std::uint64_t> offsets_;
+  cista::offset::vector<tag_id> tags_;
+};
+
+// Columnar copy of the decoded entities of a PBF file, for zero-copy use
+// through cista::mmap. Entities of each kind are sorted by ID (i = index in
+// the ID column).
+struct snapshot {
+  // Source file. Stale if size / modification time differ.
+  std::uint64_t file_size_;
+  std::int64_t file_mtime_;
+  std::int64_t replication_timestamp_;  // OSMHeader, 0 if not set
+
+  // String ID -> string (tags and member roles).
+  cista::offset::vector<cista::offset::string> strings_;
+
+  // Fixed point, see kFixedPointFactor.
+  cista::offset::vector<std::int64_t> node_ids_;
+  cista::offset::vector<std::int32_t> node_lats_;
+  cista::offset::vector<std::int32_t> node_lons_;
+  snapshot_tags node_tags_;
+
+  // Refs of way i: zigzag varint deltas (starting from 0 for every way) in
+  // way_refs_[way_ref_offsets_[i], way_ref_offsets_[i + 1]), see way_refs.
+  cista::offset::vector<std::int64_t> way_ids_;
+  cista::offset::vector<std::uint64_t> way_ref_offsets_;
+  cista::offset::vector<std::uint8_t> way_refs_;
+  snapshot_tags way_tags_;
+
+  // Members of relation i: [member_offsets_[i], member_offsets_[i + 1]).
+  cista::offset::vector<std::int64_t> relation_ids_;
+  cista::offset::vector<std::uint64_t> member_offsets_;
+  cista::offset::vector<std::int64_t> member_refs_;
+  cista::offset::vector<std::uint32_t> member_roles_;  // string IDs
+  cista::offset::vector<std::uint8_t> member_types_;  // member_type
+  snapshot_tags relation_tags_;
+};
+
+// Read-only view of a memory mapped snapshot file.
+struct snapshot_file {
+  snapshot const* operator->() const { return snapshot_; }
+  snapshot const& operator*() const { return *snapshot_; }
+
+  cista::mmap mem_;
+  snapshot const* snapshot_;
+};
+
+// Decodes the file with the parallel reader (read_nodes_ etc. select the
+// kinds, the tag filter applies). Tags are interned into c.interner_ or a
+// temporary interner.
+snapshot build_snapshot(std::filesystem::path const& pbf,
+                        read_config const& = {});
+
+void write_snapshot(snapshot const&, std::filesystem::path const& out);
+
+// Returns nullopt if the snapshot file does not exist, cannot be read, is
+// truncated or does not match the PBF file (size / modification time).
+std::optional<snapshot_file> read_snapshot(std::filesystem::path const& file,
+                                           std::filesystem::path const& pbf);
+
+// Index into node_ids_ / way_ids_ / relation_ids_.
+std::optional<std::size_t> find(cista::offset::vector<std::int64_t> const&,
+                                std::int64_t id);
+
+inline location node_location(snapshot const& s, std::size_t const i) {
+  return {s.node_lats_[i], s.node_lons_[i]};
+}
+
+inline std::string_view get_string(snapshot const& s, std::uint32_t const id) {
+  return s.strings_[id].view();
+}
+
+// Decodes the refs of way i into `out`.
+void way_refs(snapshot const&, std::size_t i, std::vector<std::int64_t>& out);
+
+}  // namespace osm
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace osm {
+
+// Written by one thread only (no read-modify-write needed), readable from
+// the sampling thread at any time.
+struct counter {
+  void add(std::uint64_t const x) {
+    v_.store(v_.load(std::memory_order_relaxed) + x,
+             std::memory_order_relaxed);
+  }
+
+  std::uint64_t get() const { return v_.load(std::memory_order_relaxed); }
+
+  std::atomic_uint64_t v_{0U};
+};
+
+// Per block latency (pop to done) histogram: bucket i counts blocks with
+// bit_width(microseconds) == i.
+constexpr auto const kLatencyBuckets = 32U;
+
+// Counters of one thread. Cache line aligned to avoid false sharing.
+struct alignas(64) thread_stats {
+  counter blobs_read_, bytes_read_, bytes_inflated_;
+  counter inflate_ns_, decode_ns_, callback_ns_;
+  counter nodes_, ways_, relations_;
+  counter producer_stall_ns_, consumer_stall_ns_;
+  std::array<counter, kLatencyBuckets> latency_;
+};
+
+// Merged counters at one point in time.
+struct stats_snapshot {
+  std::uint64_t elapsed_ns_{0U};
+  std::uint64_t blobs_read_{0U}, bytes_read_{0U}, bytes_inflated_{0U};
+  std::uint64_t inflate_ns_{0U}, decode_ns_{0U}, callback_ns_{0U};
+  std::uint64_t nodes_{0U}, ways_{0U}, relations_{0U};
+  std::uint64_t producer_stall_ns_{0U}, consumer_stall_ns_{0U};
+  std::uint64_t queue_depth_{0U}, max_queue_depth_{0U};
+  std::array<std::uint64_t, kLatencyBuckets> latency_{};
+};
+
+// Pipeline statistics of read() / read_ordered() (see read_config::stats_).
+// blocks() / entities() only record inflate time, size and block latency.
+//
+// Every thread gets its own thread_stats, merged only by sample(). The
+// reading thread records a sample every interval_ and a final one at the
+// end. callback_ns_ is estimated from timing every 64th callback call.
+// decode_ns_ includes callback time.
+struct stats {
+  using clock = std::chrono::steady_clock;
+
+  explicit stats(std::chrono::milliseconds interval = std::chrono::seconds{1})
+      : interval_{interval} {}
+
+  // Registers a new set of counters for the calling thread.
+  thread_stats& add_thread();
+
+  stats_snapshot sample() const;
+
+  // Called by the reading thread: records a sample if interval_ passed.
+  void maybe_sample(bool force = false);
+
+  // Called after a successful push. A worker can pop (and call dequeued())
+  // before, so the depth can be -1 for a moment.
+  void enqueued() {
+    auto const depth = queue_depth_.fetch_add(1) + 1;
+    auto max = max_queue_depth_.load(std::memory_order_relaxed);
+    while (depth > max && !max_queue_depth_.compare_exchange_weak(max, depth)) {
+    }
+  }
+
+  void dequeued() { queue_depth_.fetch_sub(1); }
+
+  // Final totals and all samples.
+  std::string to_json() const;
+
+  std::chrono::milliseconds interval_;
+  clock::time_point start_{clock::now()};
+  clock::time_point last_sample_{start_};
+
+  mutable std::mutex mutex_;  // threads_, samples_
+  std::deque<thread_stats> threads_;  // stable addresses
+  std::vector<stats_snapshot> samples_;
+
+  std::atomic_int64_t queue_depth_{0}, max_queue_depth_{0};
+};
+
+namespace detail {
+
+// Adds the elapsed time to the counter (if any) on destruction.
+struct scoped_timer {
+  explicit scoped_timer(counter* c)
+      : c_{c}, start_{c == nullptr ? stats::clock::time_point{}
+                                   : stats::clock::now()} {}
+
+  scoped_timer(scoped_timer const&) = delete;
+  scoped_timer& operator=(scoped_timer const&) = delete;
+
+  ~scoped_timer() {
+    if (c_ != nullptr) {
+      c_->add(static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              stats::clock::now() - start_)
+              .count()));
+    }
+  }
+
+  counter* c_;
+  stats::clock::time_point start_;
+};
+
+inline counter* get(thread_stats* s, counter thread_stats::*c) {
+  return s == nullptr ? nullptr : &(s->*c);
+}
+
+// Counts entities and samples the time spent in a callback. Forwards the
+// call signature so node_batch / way locations detection still works.
+template <typename Fn>
+struct instrumented {
+  template <typename... Args>
+  auto operator()(Args&&... args)
+      -> decltype(std::declval<Fn&>()(std::forward<Args>(args)...)) {
+    if (s_ == nullptr) {
+      return fn_(std::forward<Args>(args)...);
+    }
+
+    if constexpr (sizeof...(Args) == 1U) {
+      (s_->*count_).add((args.size(), ...));  // node_batch
+    } else {
+      (s_->*count_).add(1U);
+    }
+
+    if ((calls_++ & 63U) != 0U) {
+      return fn_(std::forward<Args>(args)...);
+    }
+    auto const start = stats::clock::now();
+    auto const add_time = [&]() {
+      s_->callback_ns_.add(
+          64U * static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        stats::clock::now() - start)
+                        .count()));
+    };
+    if constexpr (std::is_void_v<decltype(fn_(
+                      std::forward<Args>(args)...))>) {
+      fn_(std::forward<Args>(args)...);
+      add_time();
+    } else {
+      decltype(auto) result = fn_(std::forward<Args>(args)...);
+      add_time();
+      return result;
+    }
+  }
+
+  Fn& fn_;
+  thread_stats* s_;
+  counter thread_stats::*count_;
+  std::uint64_t calls_{0U};
+};
+
+template <typename Fn>
+instrumented<Fn> instrument(Fn& fn,
+                            thread_stats* s,
+                            counter thread_stats::*count) {
+  return {fn, s, count};
+}
+
+void record_latency(thread_stats*, stats::clock::time_point start);
+
+}  // namespace detail
+
+}  // namespace osm
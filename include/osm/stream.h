@@ -0,0 +1,275 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <future>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "boost/fiber/buffered_channel.hpp"
+
+#include "cista/mmap.h"
+
+#include "geo/latlng.h"
+
+#include "osm/decoder.h"
+#include "osm/decompress.h"
+#include "osm/generator.h"
+#include "osm/header.h"
+#include "osm/osm.h"
+#include "osm/peek.h"
+#include "osm/read_config.h"
+#include "osm/stats.h"
+
+namespace osm {
+
+// Data block, decompressed ahead of the consumer.
+struct prefetched_block {
+  std::string_view data() const {
+    return b_.compression_ == compression::kRaw ? b_.compressed_
+                                                : std::string_view{out_};
+  }
+
+  buf b_{};
+  std::string out_;
+  bool wanted_{true};  // false: dropped by decompress_wanted
+};
+
+// Returns the data blobs of a reader in file order. c.queue_size_ blobs
+// ahead of the consumer are decompressed by c.n_threads_ threads.
+// Destruction stops reading and drops all queued work: only blocks already
+// being decompressed are finished. With c.stats_, every decompressed block
+// counts one latency sample.
+template <typename Reader>
+struct block_prefetcher {
+  struct job {
+    buf b_;
+    std::promise<prefetched_block> result_;
+  };
+
+  block_prefetcher(Reader& r, read_config const& c)
+      : r_{r},
+        kinds_{c.peek_kinds_ ? c.kinds() : entity_kind::kAll},
+        window_{std::max(std::size_t{1U}, c.queue_size_)},
+        ch_{std::bit_ceil(window_ + 1U)} {
+    auto const n_threads = c.n_threads_ == 0U ? 1U : c.n_threads_;
+    for (auto i = 0U; i != n_threads; ++i) {
+      auto const s = c.stats_ == nullptr ? nullptr : &c.stats_->add_thread();
+      workers_.emplace_back([this, s]() { work(s); });
+    }
+  }
+
+  block_prefetcher(block_prefetcher const&) = delete;
+  block_prefetcher& operator=(block_prefetcher const&) = delete;
+
+  // pop() still returns queued jobs after close(): the flag drops them.
+  ~block_prefetcher() {
+    stop_.store(true);
+    ch_.close();
+    for (auto& w : workers_) {
+      w.join();
+    }
+  }
+
+  std::optional<prefetched_block> next() {
+    fill();
+    if (pending_.empty()) {
+      return std::nullopt;
+    }
+    auto f = std::move(pending_.front());
+    pending_.pop_front();
+    fill();
+    return f.get();
+  }
+
+private:
+  void fill() {
+    while (!eof_ && pending_.size() < window_) {
+      auto const b = r_.read();
+      if (!b.has_value()) {
+        eof_ = true;
+      } else if (b->type_ == blob_type::kHeader) {
+        read_header(*b);  // throws on unsupported required features
+      } else {
+        auto j = job{.b_ = *b};
+        pending_.emplace_back(j.result_.get_future());
+        ch_.push(std::move(j));  // never blocks: capacity > window_
+      }
+    }
+  }
+
+  void work(thread_stats* s) {
+    auto d = decompressor{};
+    auto j = job{};
+    while (ch_.pop(j) == boost::fibers::channel_op_status::success &&
+           !stop_.load()) {
+      auto const start =
+          s == nullptr ? stats::clock::time_point{} : stats::clock::now();
+      try {
+        auto block = prefetched_block{.b_ = j.b_};
+        {
+          auto const t =
+              detail::scoped_timer{detail::get(s, &thread_stats::inflate_ns_)};
+          if (kinds_ == entity_kind::kAll) {
+            d.decompress(j.b_, block.out_);
+          } else {
+            block.wanted_ = decompress_wanted(d, j.b_, kinds_, block.out_)
+                                .block_.has_value();
+          }
+        }
+        if (s != nullptr) {
+          s->bytes_inflated_.add(block.out_.size());
+        }
+        j.result_.set_value(std::move(block));
+      } catch (...) {
+        j.result_.set_exception(std::current_exception());
+      }
+      detail::record_latency(s, start);
+    }
+  }
+
+  Reader& r_;
+  entity_kind kinds_;
+  std::size_t window_;
+  bool eof_{false};
+  std::deque<std::future<prefetched_block>> pending_;
+  std::atomic_bool stop_{false};
+  boost::fibers::buffered_channel<job> ch_;
+  std::vector<std::thread> workers_;
+};
+
+// Decompressed data blocks of `r` in file order (see block_prefetcher).
+// `r` has to outlive the generator.
+template <typename Reader>
+  requires requires(Reader& r) { r.read(); }
+generator<prefetched_block> blocks(Reader& r, read_config const c) {
+  auto p = block_prefetcher<Reader>{r, c};
+  while (auto block = p.next()) {
+    if (block->wanted_) {
+      co_yield *block;
+    }
+  }
+}
+
+struct tag {
+  std::string_view key_, value_;
+};
+
+struct member {
+  std::int64_t ref_;
+  std::string_view role_;
+  member_type type_;
+};
+
+// Entity of any kind. Only the fields of its kind are set. Views are valid
+// until the generator is advanced.
+struct entity {
+  entity_kind kind_{entity_kind::kNone};
+  std::int64_t id_{0};
+  geo::latlng pos_{};  // nodes
+  std::span<std::int64_t const> refs_;  // ways
+  std::span<member const> members_;  // relations
+  std::span<tag const> tags_;
+};
+
+// Pull interface: the entities of `r` in file order. Blocks are decoded one
+// at a time on the consuming thread, while the next blocks are read and
+// decompressed in the background. Leaving the loop stops all reading and
+// decompression. Config: kinds, tag filter, threads and queue size are
+// used, Fields as for decode_primitive.
+template <field Fields = field::kAll, typename Reader>
+  requires requires(Reader& r) { r.read(); }
+generator<entity> entities(Reader& r, read_config const c) {
+  struct entry {
+    entity e_;
+    std::size_t begin_, end_;  // refs_ / members_
+    std::size_t tags_begin_, tags_end_;
+  };
+
+  auto state = decode_state{};
+  state.filter_ = c.filter_;
+  state.interner_ = c.interner_;
+  auto entries = std::vector<entry>{};
+  auto tags = std::vector<tag>{};
+  auto refs = std::vector<std::int64_t>{};
+  auto members = std::vector<member>{};
+
+  auto const add = [&](entity const& e, auto&& entity_tags) {
+    auto const tags_begin = tags.size();
+    for (auto const [k, v] : entity_tags) {
+      tags.emplace_back(k, v);
+    }
+    entries.push_back({.e_ = e,
+                       .begin_ = 0U,
+                       .end_ = 0U,
+                       .tags_begin_ = tags_begin,
+                       .tags_end_ = tags.size()});
+  };
+
+  for (auto const& block : blocks(r, c.masked(Fields))) {
+    entries.clear();
+    tags.clear();
+    refs.clear();
+    members.clear();
+
+    decode_primitive<Fields>(
+        block.data(), state, c.read_nodes_, c.read_ways_, c.read_relations_,
+        [&](std::int64_t const id, geo::latlng const& pos, auto&& t) {
+          add({.kind_ = entity_kind::kNodes, .id_ = id, .pos_ = pos}, t);
+        },
+        [&](std::uint64_t const id, std::span<std::int64_t const> way_refs,
+            auto&& t) {
+          auto const first = refs.size();
+          refs.insert(end(refs), begin(way_refs), end(way_refs));
+          add({.kind_ = entity_kind::kWays,
+               .id_ = static_cast<std::int64_t>(id)},
+              t);
+          entries.back().begin_ = first;
+          entries.back().end_ = refs.size();
+        },
+        [&](std::uint64_t const id, auto&& rel_members, auto&& t) {
+          auto const first = members.size();
+          for (auto const [ref, role, type] : rel_members) {
+            members.push_back({ref, role, type});
+          }
+          add({.kind_ = entity_kind::kRelations,
+               .id_ = static_cast<std::int64_t>(id)},
+              t);
+          entries.back().begin_ = first;
+          entries.back().end_ = members.size();
+        });
+
+    // Spans only now: the vectors grow while decoding.
+    for (auto& x : entries) {
+      auto& e = x.e_;
+      e.tags_ = std::span{tags}.subspan(x.tags_begin_,
+                                        x.tags_end_ - x.tags_begin_);
+      if (e.kind_ == entity_kind::kWays) {
+        e.refs_ = std::span{refs}.subspan(x.begin_, x.end_ - x.begin_);
+      } else if (e.kind_ == entity_kind::kRelations) {
+        e.members_ = std::span{members}.subspan(x.begin_, x.end_ - x.begin_);
+      }
+      co_yield e;
+    }
+  }
+}
+
+// Same, reading the file at `path`.
+template <field Fields = field::kAll>
+generator<entity> entities(std::string const path, read_config const c) {
+  auto r = raw_reader{
+      .file_ = cista::mmap{path.c_str(), cista::mmap::protection::READ}};
+  for (auto const& e : entities<Fields>(r, c)) {
+    co_yield e;
+  }
+}
+
+}  // namespace osm
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "osm/osm.h"
+
+namespace osm {
+
+struct stream_config {
+  // Blobs read ahead by the background thread.
+  std::size_t read_ahead_{8U};
+
+  // Regular files: drop pages from the page cache once read
+  // (POSIX_FADV_DONTNEED), so a planet file does not evict everything else.
+  bool drop_cache_{true};
+};
+
+// Reads blobs with read() / pread() into pooled buffers instead of mapping
+// the file: works with pipes, stdin and file systems without mmap support.
+// A background thread keeps up to read_ahead_ blobs ready. The returned
+// bufs own their data (buf::owner_); buffers are reused once all copies
+// of a buf are gone.
+//
+// Usable with read() / read_ordered() in place of a raw_reader. Pipes are
+// polled together with a wakeup pipe, so destruction does not wait for
+// input that never comes.
+struct stream_reader {
+  // Does not take ownership of the file descriptor.
+  explicit stream_reader(int fd, stream_config const& = {});
+
+  // "-" reads stdin.
+  explicit stream_reader(char const* path, stream_config const& = {});
+
+  ~stream_reader();
+
+  stream_reader(stream_reader const&) = delete;
+  stream_reader& operator=(stream_reader const&) = delete;
+
+  // Rethrows read / parse errors of the background thread.
+  std::optional<buf> read();
+
+  // Bytes consumed through read().
+  std::size_t offset() const { return offset_; }
+
+  // File size, 0 if unknown (pipes).
+  std::size_t size() const { return size_; }
+
+private:
+  struct buffers;
+
+  void run();
+
+  int fd_;
+  bool owns_fd_;
+  bool seekable_;
+  std::size_t size_{0U};
+  std::size_t offset_{0U};
+  stream_config config_;
+  std::array<int, 2> wakeup_{-1, -1};  // pipe, only if not seekable
+
+  std::shared_ptr<buffers> buffers_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::pair<buf, std::size_t>> queue_;  // blob, end offset
+  std::exception_ptr error_;
+  bool done_{false};
+  bool stop_{false};
+
+  std::thread thread_;
+};
+
+}  // namespace osm
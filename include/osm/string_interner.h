@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cinttypes>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace osm {
+
+// Maps strings to dense global 32 bit IDs, shared by all threads.
+//
+// Lookups of known strings are lock-free (open addressing, one atomic load
+// per probe). New strings are inserted under a mutex. The table grows by
+// copying into a table of twice the size: readers still holding the old
+// table either find their string there or fall back to the locked path.
+// Old tables are kept until destruction.
+//
+// IDs of seeded strings (common_strings(), in that order) are fixed. Other
+// IDs depend on the order in which threads first see a string: they are
+// only stable for the lifetime of the interner.
+struct string_interner {
+  // Frequent OSM keys and values.
+  static std::span<std::string_view const> common_strings();
+
+  explicit string_interner(bool seed = true);
+  ~string_interner();
+
+  string_interner(string_interner const&) = delete;
+  string_interner& operator=(string_interner const&) = delete;
+
+  std::uint32_t intern(std::string_view);
+  std::optional<std::uint32_t> find(std::string_view) const;
+  std::string_view get(std::uint32_t id) const;
+  std::uint32_t size() const { return size_.load(std::memory_order_acquire); }
+
+private:
+  struct table;
+
+  static constexpr auto const kChunkBits = 16U;
+  static constexpr auto const kChunkSize = 1U << kChunkBits;
+  static constexpr auto const kMaxChunks = 1U << (32U - kChunkBits);
+
+  std::optional<std::uint32_t> find(table const&,
+                                    std::string_view,
+                                    std::uint64_t hash) const;
+  void insert(table&, std::uint32_t id, std::uint64_t hash);
+  std::string_view store(std::string_view);
+
+  std::atomic<table*> table_;
+
+  // id -> string, in chunks of kChunkSize entries.
+  std::unique_ptr<std::atomic<std::string_view*>[]> chunks_;
+  std::atomic_uint32_t size_{0U};
+
+  std::mutex mutex_;  // inserts: tables_, arena_
+  std::vector<std::unique_ptr<table>> tables_;
+  std::vector<std::unique_ptr<char[]>> arena_;
+  std::size_t arena_used_{0U};
+};
+
+}  // namespace osm
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <cinttypes>
+#include <functional>
+#include <initializer_list>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace osm {
+
+// Set of tag predicates: "key" (any value) or "key=value". An entity passes
+// if at least one of its tags matches one of the predicates.
+//
+// The filter is compiled against the string table of every block (see
+// block_tag_filter) so matching an entity only compares integers.
+struct tag_filter {
+  struct string_hash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view s) const {
+      return std::hash<std::string_view>{}(s);
+    }
+  };
+
+  static constexpr auto const kAnyValue =
+      std::numeric_limits<std::uint32_t>::max();
+
+  // Empty value: any value.
+  tag_filter(
+      std::initializer_list<std::pair<std::string_view, std::string_view>> l) {
+    for (auto const& [k, v] : l) {
+      add(k, v);
+    }
+  }
+
+  tag_filter() = default;
+
+  void add(std::string_view key, std::string_view value = {}) {
+    predicates_.emplace_back(id(key), value.empty() ? kAnyValue : id(value));
+  }
+
+  std::uint32_t id(std::string_view s) {
+    min_length_ = std::min(min_length_, s.size());
+    max_length_ = std::max(max_length_, s.size());
+    auto const it = ids_.find(s);
+    if (it != end(ids_)) {
+      return it->second;
+    }
+    auto const next = static_cast<std::uint32_t>(ids_.size());
+    ids_.emplace(std::string{s}, next);
+    return next;
+  }
+
+  std::size_t n_strings() const { return ids_.size(); }
+
+  std::unordered_map<std::string, std::uint32_t, string_hash, std::equal_to<>>
+      ids_;
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> predicates_;
+  std::size_t min_length_{std::numeric_limits<std::size_t>::max()};
+  std::size_t max_length_{0U};
+};
+
+// tag_filter resolved to the string table indices of one block.
+struct block_tag_filter {
+  enum key_state : std::uint8_t { kUnmatched, kAllValues, kSomeValues };
+
+  static constexpr auto const kMissing =
+      std::numeric_limits<std::uint32_t>::max();
+
+  void reset(tag_filter const& f) {
+    filter_ = &f;
+    block_idx_.assign(f.n_strings(), kMissing);
+    keys_.clear();
+    pairs_.clear();
+    matchable_ = false;
+  }
+
+  // Called for each string of the block's string table, in order.
+  void add_string(std::uint32_t const idx, std::string_view s) {
+    if (s.size() < filter_->min_length_ || s.size() > filter_->max_length_) {
+      return;
+    }
+    auto const it = filter_->ids_.find(s);
+    if (it != end(filter_->ids_) && block_idx_[it->second] == kMissing) {
+      block_idx_[it->second] = idx;
+    }
+  }
+
+  // Called after the string table is complete.
+  void finish(std::size_t const n_strings) {
+    keys_.assign(n_strings, kUnmatched);
+    for (auto const [key, value] : filter_->predicates_) {
+      auto const k = block_idx_[key];
+      if (k == kMissing) {
+        continue;
+      }
+      if (value == tag_filter::kAnyValue) {
+        keys_[k] = kAllValues;
+        matchable_ = true;
+      } else if (auto const v = block_idx_[value]; v != kMissing) {
+        if (keys_[k] != kAllValues) {
+          keys_[k] = kSomeValues;
+        }
+        pairs_.emplace_back(k, v);
+        matchable_ = true;
+      }
+    }
+    std::ranges::sort(pairs_);
+  }
+
+  // False if no entity of the block can match: the block can be skipped.
+  bool matchable() const { return matchable_; }
+
+  bool matches(std::uint32_t const k, std::uint32_t const v) const {
+    if (k >= keys_.size()) {
+      return false;
+    }
+    switch (keys_[k]) {
+      case kAllValues: return true;
+      case kSomeValues:
+        return std::ranges::binary_search(pairs_, std::pair{k, v});
+      default: return false;
+    }
+  }
+
+  // Tags as (key, value) string table index pairs.
+  template <typename Keys, typename Values>
+  bool matches_any(Keys const& keys, Values const& values) const {
+    auto k = std::ranges::begin(keys);
+    auto v = std::ranges::begin(values);
+    for (; k != std::ranges::end(keys) && v != std::ranges::end(values);
+         ++k, ++v) {
+      if (matches(static_cast<std::uint32_t>(*k),
+                  static_cast<std::uint32_t>(*v))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Tags as interleaved key, value, key, value, ... indices (DenseNodes).
+  template <typename KeysVals>
+  bool matches_interleaved(KeysVals const& keys_vals) const {
+    auto it = std::ranges::begin(keys_vals);
+    auto const end = std::ranges::end(keys_vals);
+    while (it != end) {
+      auto const k = static_cast<std::uint32_t>(*it);
+      if (++it == end) {
+        break;
+      }
+      if (matches(k, static_cast<std::uint32_t>(*it))) {
+        return true;
+      }
+      ++it;
+    }
+    return false;
+  }
+
+  tag_filter const* filter_{nullptr};
+  std::vector<std::uint32_t> block_idx_;  // filter string id -> block index
+  std::vector<key_state> keys_;  // block index -> key state
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> pairs_;  // sorted
+  bool matchable_{false};
+};
+
+}  // namespace osm
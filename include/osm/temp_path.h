@@ -0,0 +1,11 @@
+#pragma once
+
+#include <filesystem>
+
+namespace osm {
+
+// Unique sibling of `out` ("<out>.<pid>.<random>.tmp") to write to before
+// renaming it to `out`: concurrent writers never share a temporary file.
+std::filesystem::path temp_path(std::filesystem::path const& out);
+
+}  // namespace osm
@@ -24,19 +24,42 @@ struct varint {
 
     reference operator*() const {
       if (state_ == kFirst) {
-        ++(*const_cast<iterator*>(this));
+        const_cast<iterator*>(this)->next();
       }
       return value_;
     }
 
     iterator& operator++() {
+      if (state_ == kFirst) {
+        next();  // the first value was not decoded yet
+      }
+      next();
+      return *this;
+    }
+
+    iterator operator++(int) {
+      iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+
+    friend bool operator==(iterator const& a, iterator const& b) {
+      return a.state_ == b.state_;
+    }
+
+    friend bool operator!=(iterator const& a, iterator const& b) {
+      return !(a == b);
+    }
+
+    // Decodes the next value.
+    void next() {
       if (state_ == kLast) {
         state_ = kFin;
-        return *this;
+        return;
       }
       if (data_.empty()) {
         state_ = kLast;
-        return *this;
+        return;
       }
       if (state_ == kFirst) {
         state_ = kMid;
@@ -62,21 +85,6 @@ struct varint {
       if (data_.empty()) {
         state_ = kLast;
       }
-      return *this;
-    }
-
-    iterator operator++(int) {
-      iterator tmp = *this;
-      ++(*this);
-      return tmp;
-    }
-
-    friend bool operator==(iterator const& a, iterator const& b) {
-      return a.state_ == b.state_;
-    }
-
-    friend bool operator!=(iterator const& a, iterator const& b) {
-      return !(a == b);
     }
 
     std::string_view data_{};
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "protozero/varint.hpp"
+
+#include "utl/verify.h"
+
+#include "osm/decoder.h"
+#include "osm/location.h"
+#include "osm/osm.h"
+
+namespace osm {
+
+struct writer_config {
+  // Number of encoding / compression threads. The calling thread collects
+  // entities into blocks.
+  unsigned n_threads_{std::thread::hardware_concurrency()};
+
+  // Blocks in flight between the calling thread and the encoders (rounded
+  // up to 2^N for boost) and maximum number of encoded blocks waiting for an
+  // earlier one to be written.
+  std::size_t queue_size_{16U};
+  std::size_t reorder_window_{64U};
+
+  // kRaw, kZlib or kZstd (OSM_WITH_ZSTD). level_ < 0: default level.
+  compression compression_{compression::kZlib};
+  int level_{-1};
+
+  // Entities per block (same as osmium and osmosis).
+  std::size_t max_entities_{8000U};
+
+  // Sort.Type_then_ID: entities have to be added as nodes, ways, relations,
+  // each by ascending ID (verified).
+  bool sorted_{true};
+
+  // LocationsOnWays: ways are added with their node locations.
+  bool locations_on_ways_{false};
+
+  std::optional<bbox> bbox_;
+  std::string writing_program_{"osm"};
+  std::int64_t replication_timestamp_{0};  // seconds since epoch, 0: none
+};
+
+using tag_list =
+    std::initializer_list<std::pair<std::string_view, std::string_view>>;
+using member_list =
+    std::initializer_list<std::tuple<std::int64_t, std::string_view,
+                                     member_type>>;
+
+namespace detail {
+
+// Entities of one primitive block (one kind), encoded by the writer's
+// threads. Lists of the i-th entity are [offsets_[i], offsets_[i + 1]).
+struct block_builder {
+  struct string_hash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view s) const {
+      return std::hash<std::string_view>{}(s);
+    }
+  };
+
+  std::uint32_t string_id(std::string_view s) {
+    auto const it = string_ids_.find(s);
+    if (it != end(string_ids_)) {
+      return it->second;
+    }
+    auto const id = static_cast<std::uint32_t>(strings_.size());
+    strings_.emplace_back(s);
+    string_ids_.emplace(std::string{s}, id);
+    string_bytes_ += s.size();
+    return id;
+  }
+
+  std::size_t size() const { return ids_.size(); }
+
+  // Upper bound of the encoded size.
+  std::size_t max_bytes() const {
+    return string_bytes_ + strings_.size() * 8U +
+           protozero::max_varint_length *
+               (ids_.size() * 3U + locations_.size() * 2U + tags_.size() +
+                refs_.size() + roles_.size() + types_.size());
+  }
+
+  std::span<std::uint32_t const> tags(std::size_t const i) const {
+    return std::span{tags_}.subspan(tag_offsets_[i],
+                                    tag_offsets_[i + 1U] - tag_offsets_[i]);
+  }
+
+  std::span<std::int64_t const> refs(std::size_t const i) const {
+    return std::span{refs_}.subspan(ref_offsets_[i],
+                                    ref_offsets_[i + 1U] - ref_offsets_[i]);
+  }
+
+  entity_kind kind_{entity_kind::kNone};
+
+  // String table, index 0 is reserved (dense nodes tag delimiter).
+  std::vector<std::string> strings_{std::string{}};
+  std::unordered_map<std::string, std::uint32_t, string_hash, std::equal_to<>>
+      string_ids_;
+  std::size_t string_bytes_{0U};
+
+  std::vector<std::int64_t> ids_;
+  std::vector<location> locations_;  // nodes / way nodes (LocationsOnWays)
+
+  std::vector<std::uint32_t> tags_;  // key, value, key, value, ...
+  std::vector<std::uint32_t> tag_offsets_{0U};
+
+  // Way refs or relation member refs (with roles_ and types_).
+  std::vector<std::int64_t> refs_;
+  std::vector<std::uint32_t> ref_offsets_{0U};
+  std::vector<std::uint32_t> roles_;
+  std::vector<member_type> types_;
+};
+
+// Encoded PrimitiveBlock.
+std::string encode(block_builder const&, bool locations_on_ways);
+
+// Blob including the size prefix and BlobHeader, ready to be written.
+std::string encode_blob(std::string_view type,
+                        std::string_view block,
+                        compression,
+                        int level);
+
+}  // namespace detail
+
+// Writes PBF files: nodes as DenseNodes, ways and relations, blocks of up to
+// max_entities_ entities of one kind. Blocks are encoded and compressed on
+// n_threads_ threads and written in the order they were filled.
+//
+// Tags are ranges of (key, value), members ranges of (ref, role, type), as
+// passed to the read() callbacks. Not thread safe.
+struct writer {
+  explicit writer(std::filesystem::path const&, writer_config const& = {});
+
+  // Calls finish(), errors are lost.
+  ~writer();
+
+  writer(writer const&) = delete;
+  writer& operator=(writer const&) = delete;
+
+  template <typename Tags = tag_list>
+  void add_node(std::int64_t const id, location const l, Tags&& tags = {}) {
+    begin(entity_kind::kNodes, id);
+    block_.locations_.push_back(l);
+    add_tags(tags);
+  }
+
+  template <typename Refs = std::initializer_list<std::int64_t>,
+            typename Tags = tag_list>
+  void add_way(std::int64_t const id, Refs&& refs, Tags&& tags = {}) {
+    utl::verify(!config_.locations_on_ways_,
+                "writer: way {} without locations (LocationsOnWays)", id);
+    begin(entity_kind::kWays, id);
+    add_refs(refs);
+    add_tags(tags);
+  }
+
+  // LocationsOnWays: one location per ref.
+  template <typename Refs = std::initializer_list<std::int64_t>,
+            typename Locations = std::initializer_list<location>,
+            typename Tags = tag_list>
+  void add_way(std::int64_t const id,
+               Refs&& refs,
+               Locations&& locations,
+               Tags&& tags) {
+    utl::verify(config_.locations_on_ways_,
+                "writer: way {} with locations, LocationsOnWays not set", id);
+    auto const n_refs = std::ranges::distance(refs);
+    auto const n_locations = std::ranges::distance(locations);
+    utl::verify(n_refs == n_locations, "writer: way {}: {} refs, {} locations",
+                id, n_refs, n_locations);
+    begin(entity_kind::kWays, id);
+    add_refs(refs);
+    for (auto const l : locations) {
+      block_.locations_.push_back(l);
+    }
+    add_tags(tags);
+  }
+
+  template <typename Members = member_list, typename Tags = tag_list>
+  void add_relation(std::int64_t const id,
+                    Members&& members,
+                    Tags&& tags = {}) {
+    begin(entity_kind::kRelations, id);
+    for (auto&& [ref, role, type] : members) {
+      block_.refs_.push_back(ref);
+      block_.roles_.push_back(block_.string_id(role));
+      block_.types_.push_back(static_cast<member_type>(type));
+    }
+    block_.ref_offsets_.push_back(
+        static_cast<std::uint32_t>(block_.refs_.size()));
+    add_tags(tags);
+  }
+
+  // Writes the remaining entities and waits for all blocks to be written.
+  // Rethrows the first encoding / write error. No entities can be added
+  // afterwards.
+  void finish();
+
+private:
+  struct impl;
+
+  // Starts a new entity, flushes the current block first if necessary.
+  void begin(entity_kind, std::int64_t id);
+
+  // Hands the current block to the encoders.
+  void flush();
+
+  template <typename Refs>
+  void add_refs(Refs&& refs) {
+    for (auto const ref : refs) {
+      block_.refs_.push_back(ref);
+    }
+    block_.ref_offsets_.push_back(
+        static_cast<std::uint32_t>(block_.refs_.size()));
+  }
+
+  template <typename Tags>
+  void add_tags(Tags&& tags) {
+    for (auto&& [k, v] : tags) {
+      block_.tags_.push_back(block_.string_id(k));
+      block_.tags_.push_back(block_.string_id(v));
+    }
+    block_.tag_offsets_.push_back(
+        static_cast<std::uint32_t>(block_.tags_.size()));
+  }
+
+  writer_config config_;
+  detail::block_builder block_;
+  entity_kind last_kind_{entity_kind::kNone};
+  std::int64_t last_id_{0};
+  std::unique_ptr<impl> impl_;
+};
+
+}  // namespace osm
@@ -0,0 +1,358 @@
+#include "osm/area.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+
+#include "osm/header.h"
+#include "osm/parallel_reader.h"
+
+namespace osm {
+
+namespace {
+
+struct relation_entry {
+  std::int64_t id_;
+  std::vector<std::pair<std::string, std::string>> tags_;
+  std::vector<std::int64_t> ways_;
+};
+
+struct ring {
+  std::vector<location> points_;  // closed: front() == back()
+  std::vector<location> sorted_;  // for vertex lookups
+  bbox box_;
+  double area_{0.0};  // signed, fixed point units
+  int depth_{0};
+  std::optional<std::size_t> parent_;
+};
+
+// Index of `id` in sorted `ids`.
+std::optional<std::size_t> find(std::vector<std::int64_t> const& ids,
+                                std::int64_t const id) {
+  auto const it = std::ranges::lower_bound(ids, id);
+  return it != end(ids) && *it == id
+             ? std::optional{static_cast<std::size_t>(it - begin(ids))}
+             : std::nullopt;
+}
+
+bool less(location const a, location const b) {
+  return std::tie(a.lat_, a.lon_) < std::tie(b.lat_, b.lon_);
+}
+
+double signed_area(std::vector<location> const& r) {
+  auto a = 0.0;
+  for (auto i = std::size_t{1U}; i < r.size(); ++i) {
+    a += static_cast<double>(r[i - 1U].lon_) * r[i].lat_ -
+         static_cast<double>(r[i].lon_) * r[i - 1U].lat_;
+  }
+  return a / 2.0;
+}
+
+// Ray casting, planar in fixed point coordinates.
+bool contains(std::vector<location> const& r, location const p) {
+  auto inside = false;
+  for (auto i = std::size_t{0U}, j = r.size() - 1U; i != r.size(); j = i++) {
+    auto const& a = r[i];
+    auto const& b = r[j];
+    if ((a.lat_ > p.lat_) != (b.lat_ > p.lat_)) {
+      auto const x = static_cast<double>(a.lon_) +
+                     (static_cast<double>(b.lon_) - a.lon_) *
+                         (static_cast<double>(p.lat_) - a.lat_) /
+                         (static_cast<double>(b.lat_) - a.lat_);
+      if (p.lon_ < x) {
+        inside = !inside;
+      }
+    }
+  }
+  return inside;
+}
+
+// Whether `inner` lies inside `outer`, decided by the first vertex of `inner`
+// that is not a vertex of `outer` (rings may touch).
+bool contains(ring const& outer, ring const& inner) {
+  if (!outer.box_.contains(inner.box_.min_) ||
+      !outer.box_.contains(inner.box_.max_)) {
+    return false;
+  }
+  for (auto const p : inner.points_) {
+    if (!std::ranges::binary_search(outer.sorted_, p, less)) {
+      return contains(outer.points_, p);
+    }
+  }
+  return false;  // same ring
+}
+
+std::vector<geo::latlng> to_latlng(std::vector<location> const& points,
+                                   bool const reverse) {
+  auto out = std::vector<geo::latlng>{};
+  out.reserve(points.size());
+  for (auto const p : points) {
+    out.emplace_back(p.to_latlng());
+  }
+  if (reverse) {
+    std::ranges::reverse(out);
+  }
+  return out;
+}
+
+}  // namespace
+
+std::vector<geo::polygon> assemble_rings(
+    std::span<std::vector<std::int64_t> const> way_nodes,
+    std::span<std::vector<location> const> way_locations) {
+  // Ways by end node.
+  auto ends = std::unordered_multimap<std::int64_t, std::size_t>{};
+  for (auto i = std::size_t{0U}; i != way_nodes.size(); ++i) {
+    if (way_nodes[i].size() >= 2U) {
+      ends.emplace(way_nodes[i].front(), i);
+      ends.emplace(way_nodes[i].back(), i);
+    }
+  }
+
+  // Join ways at shared end nodes until each ring is closed.
+  auto used = std::vector<bool>(way_nodes.size(), false);
+  auto rings = std::vector<ring>{};
+  for (auto start = std::size_t{0U}; start != way_nodes.size(); ++start) {
+    if (used[start] || way_nodes[start].size() < 2U) {
+      continue;
+    }
+    used[start] = true;
+    auto first = way_nodes[start].front();
+    auto last = way_nodes[start].back();
+    auto points = way_locations[start];
+    while (first != last) {
+      auto const [from, to] = ends.equal_range(last);
+      auto const next = std::find_if(
+          from, to, [&](auto const& e) { return !used[e.second]; });
+      if (next == to) {
+        return {};  // open ring
+      }
+
+      auto const w = next->second;
+      used[w] = true;
+      auto const& locations = way_locations[w];
+      if (way_nodes[w].front() == last) {
+        points.insert(end(points), std::next(begin(locations)),
+                      end(locations));
+        last = way_nodes[w].back();
+      } else {
+        points.insert(end(points), std::next(rbegin(locations)),
+                      rend(locations));
+        last = way_nodes[w].front();
+      }
+    }
+
+    if (points.size() < 4U) {
+      continue;  // degenerate
+    }
+    auto r = ring{};
+    r.points_ = std::move(points);
+    r.sorted_ = r.points_;
+    std::ranges::sort(r.sorted_, less);
+    auto const [min_lat, max_lat] =
+        std::ranges::minmax(r.points_, {}, &location::lat_);
+    auto const [min_lon, max_lon] =
+        std::ranges::minmax(r.points_, {}, &location::lon_);
+    r.box_ = {.min_ = {min_lat.lat_, min_lon.lon_},
+              .max_ = {max_lat.lat_, max_lon.lon_}};
+    r.area_ = signed_area(r.points_);
+    rings.emplace_back(std::move(r));
+  }
+
+  // Nesting: the parent of a ring is the smallest larger ring containing it.
+  std::ranges::sort(rings, std::greater<>{},
+                    [](ring const& r) { return std::abs(r.area_); });
+  for (auto i = std::size_t{0U}; i != rings.size(); ++i) {
+    for (auto j = i; j-- != 0U;) {
+      if (contains(rings[j], rings[i])) {
+        rings[i].parent_ = j;
+        rings[i].depth_ = rings[j].depth_ + 1;
+        break;
+      }
+    }
+  }
+
+  // Outer rings counterclockwise, inner rings clockwise.
+  auto polygons = std::vector<geo::polygon>{};
+  auto polygon_of = std::vector<std::size_t>(rings.size());
+  for (auto i = std::size_t{0U}; i != rings.size(); ++i) {
+    auto const& r = rings[i];
+    if (r.depth_ % 2 == 0) {
+      polygon_of[i] = polygons.size();
+      auto& p = polygons.emplace_back();
+      p.outer_ = to_latlng(r.points_, r.area_ < 0.0);
+    } else {
+      polygons[polygon_of[*r.parent_]].inner_.emplace_back(
+          to_latlng(r.points_, r.area_ > 0.0));
+    }
+  }
+  return polygons;
+}
+
+area_stats assemble_areas(std::filesystem::path const& pbf,
+                          area_config const& config,
+                          std::function<void(area const&)> const& f) {
+  auto const path = pbf.string();
+  auto const& c = config.read_;
+  auto members_config = c;  // the tag filter only applies to relations
+  members_config.filter_ = nullptr;
+  auto const locations_on_ways = read_header(path.c_str()).locations_on_ways();
+
+  // 1. Relations of the configured types and their member ways.
+  auto mutex = std::mutex{};
+  auto relations = std::vector<relation_entry>{};
+  read<field::kRelations | field::kRelationMembers | field::kRelationTags>(
+      path.c_str(), c, no_callback{}, no_callback{},
+      [&](std::uint64_t const id, auto&& members, auto&& tags) {
+        auto const is_area = std::ranges::any_of(tags, [&](auto&& t) {
+          auto const [k, v] = t;
+          return k == "type" && std::ranges::find(config.types_, v) !=
+                                    end(config.types_);
+        });
+        if (!is_area) {
+          return;
+        }
+
+        auto r = relation_entry{.id_ = static_cast<std::int64_t>(id)};
+        for (auto const [k, v] : tags) {
+          r.tags_.emplace_back(k, v);
+        }
+        for (auto const [ref, role, type] : members) {
+          if (type == member_type::kWay) {
+            r.ways_.push_back(ref);
+          }
+        }
+        std::ranges::sort(r.ways_);
+        r.ways_.erase(std::ranges::unique(r.ways_).begin(), end(r.ways_));
+
+        auto const lock = std::scoped_lock{mutex};
+        relations.emplace_back(std::move(r));
+      });
+  std::ranges::sort(relations, {}, &relation_entry::id_);
+
+  auto way_ids = std::vector<std::int64_t>{};
+  for (auto const& r : relations) {
+    way_ids.insert(end(way_ids), begin(r.ways_), end(r.ways_));
+  }
+  std::ranges::sort(way_ids);
+  way_ids.erase(std::ranges::unique(way_ids).begin(), end(way_ids));
+
+  // 2. Member ways only. Each way is written by one thread.
+  auto way_nodes = std::vector<std::vector<std::int64_t>>(way_ids.size());
+  auto way_locations = std::vector<std::vector<location>>(way_ids.size());
+  auto const way_index = [&](std::uint64_t const id) {
+    return find(way_ids, static_cast<std::int64_t>(id));
+  };
+  if (locations_on_ways) {
+    read<field::kWays | field::kWayRefs>(
+        path.c_str(), members_config, no_callback{},
+        [&](std::uint64_t const id, std::span<std::int64_t const> refs,
+            std::span<location const> locations, tags_t const&) {
+          if (auto const i = way_index(id); i.has_value()) {
+            way_nodes[*i].assign(begin(refs), end(refs));
+            way_locations[*i].assign(begin(locations), end(locations));
+          }
+        },
+        no_callback{});
+  } else {
+    read<field::kWays | field::kWayRefs>(
+        path.c_str(), members_config, no_callback{},
+        [&](std::uint64_t const id, std::span<std::int64_t const> refs) {
+          if (auto const i = way_index(id); i.has_value()) {
+            way_nodes[*i].assign(begin(refs), end(refs));
+          }
+        },
+        no_callback{});
+
+    // 3. Locations of member way nodes only.
+    auto node_ids = std::vector<std::int64_t>{};
+    for (auto const& nodes : way_nodes) {
+      node_ids.insert(end(node_ids), begin(nodes), end(nodes));
+    }
+    std::ranges::sort(node_ids);
+    node_ids.erase(std::ranges::unique(node_ids).begin(), end(node_ids));
+
+    auto node_locations = std::vector<location>(node_ids.size());
+    read<field::kNodes>(
+        path.c_str(), members_config,
+        [&](node_batch const& b) {
+          for (auto i = std::size_t{0U}; i != b.size(); ++i) {
+            if (auto const j = find(node_ids, b.ids_[i]); j.has_value()) {
+              node_locations[*j] = {b.lats_[i], b.lons_[i]};
+            }
+          }
+        },
+        no_callback{}, no_callback{});
+
+    for (auto w = std::size_t{0U}; w != way_nodes.size(); ++w) {
+      auto& locations = way_locations[w];
+      locations.reserve(way_nodes[w].size());
+      for (auto const n : way_nodes[w]) {
+        locations.emplace_back(node_locations[*find(node_ids, n)]);
+      }
+    }
+  }
+
+  // 4. Ring assembly, one relation at a time per thread.
+  auto next = std::atomic_size_t{0U};
+  auto assembled = std::atomic_size_t{0U};
+  auto incomplete = std::atomic_size_t{0U};
+  auto invalid = std::atomic_size_t{0U};
+  auto error = detail::first_error{};
+  auto const n_threads = c.n_threads_ == 0U ? 1U : c.n_threads_;
+  auto threads = std::vector<std::thread>{};
+  for (auto t = 0U; t != n_threads; ++t) {
+    threads.emplace_back([&]() {
+      try {
+        auto nodes = std::vector<std::vector<std::int64_t>>{};
+        auto locations = std::vector<std::vector<location>>{};
+        for (auto i = next++; i < relations.size(); i = next++) {
+          auto const& r = relations[i];
+          nodes.resize(r.ways_.size());
+          locations.resize(r.ways_.size());
+          auto complete = true;
+          for (auto j = std::size_t{0U}; j != r.ways_.size(); ++j) {
+            auto const w = *find(way_ids, r.ways_[j]);
+            nodes[j] = way_nodes[w];
+            locations[j] = way_locations[w];
+            complete = complete && !nodes[j].empty() &&
+                       std::ranges::all_of(locations[j], &location::valid);
+          }
+          if (!complete) {
+            ++incomplete;
+            continue;
+          }
+
+          auto a = area{.relation_id_ = r.id_,
+                        .tags_ = r.tags_,
+                        .polygons_ = assemble_rings(nodes, locations)};
+          if (a.polygons_.empty()) {
+            ++invalid;
+            continue;
+          }
+          ++assembled;
+          f(a);
+        }
+      } catch (...) {
+        error.set(std::current_exception());
+        next = relations.size();
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  error.rethrow();
+
+  return {.relations_ = relations.size(),
+          .assembled_ = assembled,
+          .incomplete_ = incomplete,
+          .invalid_ = invalid};
+}
+
+}  // namespace osm
@@ -0,0 +1,296 @@
+#include "osm/block_cache.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cista/hash.h"
+#include "cista/serialization.h"
+#include "cista/targets/buf.h"
+
+#include "fmt/format.h"
+
+#include "utl/verify.h"
+
+#include "osm/compress.h"
+#include "osm/parallel_reader.h"
+
+namespace fs = std::filesystem;
+
+namespace osm {
+
+constexpr auto const kMode =
+    cista::mode::WITH_INTEGRITY | cista::mode::WITH_VERSION;
+
+namespace {
+
+constexpr auto const kIndexExt = ".idx";
+constexpr auto const kDataExt = ".blocks";
+constexpr auto const kLockExt = ".lock";
+
+std::int64_t mtime(fs::path const& p) {
+  return static_cast<std::int64_t>(
+      fs::last_write_time(p).time_since_epoch().count());
+}
+
+fs::path with_ext(fs::path p, std::string_view ext) {
+  p += ext;
+  return p;
+}
+
+// Entry path without extension.
+fs::path entry_path(fs::path const& pbf, block_cache_config const& c) {
+  auto const id = fmt::format("{}:{}:{}", fs::canonical(pbf).string(),
+                              fs::file_size(pbf), mtime(pbf));
+  return c.dir_ / fmt::format("{:016x}", cista::hash(id));
+}
+
+// Exclusive flock, released on destruction. Lock files may be removed by
+// evict() while waiting: only a lock on the file still at `p` counts.
+struct file_lock {
+  explicit file_lock(fs::path const& p) {
+    while (true) {
+      fd_ = ::open(p.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+      utl::verify(fd_ != -1, "could not open lock {}: {}", p.string(),
+                  std::strerror(errno));
+      while (::flock(fd_, LOCK_EX) != 0) {
+        utl::verify(errno == EINTR, "flock {}: {}", p.string(),
+                    std::strerror(errno));
+      }
+
+      struct stat locked {};
+      struct stat current {};
+      if (::fstat(fd_, &locked) == 0 && ::stat(p.c_str(), &current) == 0 &&
+          locked.st_dev == current.st_dev && locked.st_ino == current.st_ino) {
+        return;
+      }
+      ::close(fd_);
+    }
+  }
+
+  file_lock(file_lock const&) = delete;
+  file_lock& operator=(file_lock const&) = delete;
+
+  ~file_lock() { ::close(fd_); }
+
+  int fd_;
+};
+
+// Removes a lock file unless it is held (entry being built).
+void remove_lock(fs::path const& p) {
+  auto const fd = ::open(p.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd == -1) {
+    return;
+  }
+  if (::flock(fd, LOCK_EX | LOCK_NB) == 0) {
+    auto ec = std::error_code{};
+    fs::remove(p, ec);
+  }
+  ::close(fd);
+}
+
+void build(fs::path const& pbf,
+           fs::path const& entry,
+           block_cache_config const& cache,
+           read_config const& config) {
+  auto c = config;
+  c.read_nodes_ = c.read_ways_ = c.read_relations_ = true;
+  c.filter_ = nullptr;
+  c.bbox_ = std::nullopt;
+  c.shard_ = std::nullopt;
+  c.stream_ = std::nullopt;
+  c.cache_ = std::nullopt;
+
+  auto idx = block_cache_index{.file_size_ = fs::file_size(pbf),
+                               .file_mtime_ = mtime(pbf),
+                               .nonce_ = std::random_device{}(),
+                               .data_size_ = 0U};
+  idx.nonce_ = (idx.nonce_ << 32U) | std::random_device{}();
+
+  auto const data_tmp = with_ext(entry, ".blocks.tmp");
+  auto const idx_tmp = with_ext(entry, ".idx.tmp");
+  {
+    auto out = std::ofstream{data_tmp, std::ios::binary | std::ios::trunc};
+    utl::verify(out.good(), "could not write {}", data_tmp.string());
+    auto const write = [&](cached_blob b, std::string_view data) {
+      b.begin_ = idx.data_size_;
+      b.size_ = data.size();
+      out.write(data.data(), static_cast<std::streamsize>(data.size()));
+      idx.data_size_ += data.size();
+      idx.blobs_.emplace_back(b);
+    };
+
+    out.write(reinterpret_cast<char const*>(&idx.nonce_), sizeof(idx.nonce_));
+    idx.data_size_ = sizeof(idx.nonce_);
+
+    auto r = raw_reader{.file_ = cista::mmap{pbf.string().c_str(),
+                                             cista::mmap::protection::READ}};
+    auto const header = r.read();
+    utl::verify(header.has_value() && header->type_ == blob_type::kHeader,
+                "{}: no OSMHeader", pbf.string());
+    write(cached_blob{.type_ = blob_type::kHeader,
+                      .compression_ = header->compression_,
+                      .idx_ = header->idx_,
+                      .offset_ = header->offset_,
+                      .raw_size_ = header->raw_size_},
+          header->compressed_);
+
+    struct result {
+      cached_blob blob_;
+      std::string data_;
+    };
+    read_ordered(
+        r, c,
+        [&](buf const& b, std::string_view block, decode_state&) {
+          auto x = result{.blob_ = {.type_ = blob_type::kData,
+                                    .compression_ = compression::kRaw,
+                                    .idx_ = b.idx_,
+                                    .offset_ = b.offset_,
+                                    .raw_size_ = block.size()}};
+          if (cache.zstd_level_ == 0) {
+            x.data_ = block;
+          } else {
+            x.blob_.compression_ = compression::kZstd;
+            x.data_ =
+                compress(compression::kZstd, block, cache.zstd_level_);
+          }
+          return x;
+        },
+        [&](result&& x) { write(x.blob_, x.data_); });
+
+    out.close();
+    utl::verify(!out.fail(), "could not write {}", data_tmp.string());
+  }
+  {
+    auto mmap = cista::buf<cista::mmap>{cista::mmap{
+        idx_tmp.string().c_str(), cista::mmap::protection::WRITE}};
+    cista::serialize<kMode>(mmap, idx);
+  }
+
+  // Data first: a new index is never visible without its data. Readers
+  // still using old files keep their mappings.
+  fs::rename(data_tmp, with_ext(entry, kDataExt));
+  fs::rename(idx_tmp, with_ext(entry, kIndexExt));
+}
+
+}  // namespace
+
+std::optional<block_cache_file> read_block_cache(
+    fs::path const& pbf, block_cache_config const& cache) {
+  auto const entry = entry_path(pbf, cache);
+  auto const idx_path = with_ext(entry, kIndexExt);
+  auto ec = std::error_code{};
+  if (!fs::is_regular_file(idx_path, ec)) {
+    return std::nullopt;
+  }
+
+  try {
+    auto f = block_cache_file{
+        .index_mem_ = cista::mmap{idx_path.string().c_str(),
+                                  cista::mmap::protection::READ},
+        .index_ = nullptr,
+        .data_ = cista::mmap{with_ext(entry, kDataExt).string().c_str(),
+                             cista::mmap::protection::READ}};
+    f.index_ = cista::deserialize<block_cache_index, kMode>(f.index_mem_);
+
+    auto nonce = std::uint64_t{};
+    if (f.data_.size() != f->data_size_ || f.data_.size() < sizeof(nonce)) {
+      return std::nullopt;
+    }
+    std::memcpy(&nonce, f.data_.data(), sizeof(nonce));
+    if (nonce != f->nonce_ || f->file_size_ != fs::file_size(pbf) ||
+        f->file_mtime_ != mtime(pbf)) {
+      return std::nullopt;
+    }
+
+    fs::last_write_time(idx_path, fs::file_time_type::clock::now(), ec);
+    return f;
+  } catch (std::exception const&) {
+    return std::nullopt;  // incomplete, evicted or from another version
+  }
+}
+
+std::optional<block_cache_file> ensure_block_cache(
+    fs::path const& pbf,
+    block_cache_config const& cache,
+    read_config const& c) {
+  if (auto f = read_block_cache(pbf, cache); f.has_value()) {
+    return f;
+  }
+
+  fs::create_directories(cache.dir_);
+  auto const entry = entry_path(pbf, cache);
+  {
+    auto const lock = file_lock{with_ext(entry, kLockExt)};
+    if (auto f = read_block_cache(pbf, cache); f.has_value()) {
+      return f;  // built by another process meanwhile
+    }
+    build(pbf, entry, cache, c);
+  }
+  evict(cache);
+  return read_block_cache(pbf, cache);
+}
+
+void evict(block_cache_config const& cache) {
+  struct entry {
+    fs::file_time_type used_;
+    std::uintmax_t size_;
+    fs::path path_;
+  };
+
+  auto const lock = file_lock{cache.dir_ / "lock"};
+  auto const now = fs::file_time_type::clock::now();
+  auto entries = std::vector<entry>{};
+  auto total = std::uintmax_t{0U};
+  auto ec = std::error_code{};
+  for (auto const& f : fs::directory_iterator{cache.dir_, ec}) {
+    auto const& p = f.path();
+    auto base = p;
+    while (base.has_extension()) {
+      base.replace_extension();
+    }
+
+    auto const time = f.last_write_time(ec);
+    if (ec) {
+      continue;  // removed concurrently
+    }
+
+    if (p.extension() == kIndexExt) {
+      auto const size = f.file_size(ec) +
+                        fs::file_size(with_ext(base, kDataExt), ec);
+      if (!ec) {
+        entries.push_back({time, size, base});
+        total += size;
+      }
+    } else if ((p.extension() == ".tmp" || p.extension() == kDataExt) &&
+               now - time > std::chrono::hours{24} &&
+               !fs::exists(with_ext(base, kIndexExt), ec)) {
+      fs::remove(p, ec);  // left behind by a crashed build
+    } else if (p.extension() == kLockExt &&
+               !fs::exists(with_ext(base, kIndexExt), ec)) {
+      remove_lock(p);  // evicted entry or failed build
+    }
+  }
+
+  std::ranges::sort(entries, std::less<>{}, &entry::used_);
+  for (auto const& e : entries) {
+    if (total <= cache.max_size_) {
+      break;
+    }
+    fs::remove(with_ext(e.path_, kIndexExt), ec);
+    fs::remove(with_ext(e.path_, kDataExt), ec);
+    remove_lock(with_ext(e.path_, kLockExt));
+    total -= e.size_;
+  }
+}
+
+}  // namespace osm
@@ -0,0 +1,147 @@
+#include "osm/block_index.h"
+
+#include <algorithm>
+
+#include "cista/serialization.h"
+#include "cista/targets/buf.h"
+
+#include "utl/verify.h"
+
+#include "osm/parallel_reader.h"
+#include "osm/temp_path.h"
+
+namespace fs = std::filesystem;
+
+namespace osm {
+
+constexpr auto const kMode =
+    cista::mode::WITH_INTEGRITY | cista::mode::WITH_VERSION;
+
+namespace {
+
+std::int64_t mtime(fs::path const& p) {
+  return static_cast<std::int64_t>(
+      fs::last_write_time(p).time_since_epoch().count());
+}
+
+}  // namespace
+
+fs::path default_index_path(fs::path const& pbf) {
+  auto p = pbf;
+  p += ".idx";
+  return p;
+}
+
+block_index build_block_index(fs::path const& pbf,
+                              read_config const& config) {
+  // The index covers every block, whatever the caller reads.
+  auto c = config;
+  c.read_nodes_ = c.read_ways_ = c.read_relations_ = true;
+  c.filter_ = nullptr;
+  c.bbox_ = std::nullopt;
+  c.shard_ = std::nullopt;
+
+  auto r = raw_reader{.file_ = cista::mmap{pbf.string().c_str(),
+                                           cista::mmap::protection::READ}};
+  auto idx = block_index{.file_size_ = fs::file_size(pbf),
+                         .file_mtime_ = mtime(pbf)};
+  read_ordered(
+      r, c,
+      [](buf const& b, std::string_view block, decode_state& state) {
+        auto info =
+            block_info{.offset_ = b.offset_,
+                       .idx_ = b.idx_,
+                       .compressed_size_ =
+                           static_cast<std::uint32_t>(b.compressed_.size()),
+                       .raw_size_ = static_cast<std::uint32_t>(b.raw_size_),
+                       .kinds_ = entity_kind::kNone};
+        auto const add = [&](entity_kind const kind, std::int64_t const id) {
+          info.kinds_ = info.kinds_ | kind;
+          info.min_id_ = std::min(info.min_id_, id);
+          info.max_id_ = std::max(info.max_id_, id);
+        };
+        // IDs and coordinates only: tags, refs and members are skipped.
+        decode_primitive<field::kNodes | field::kWays | field::kRelations>(
+            block, state,
+            [&](node_batch const& nodes) {
+              if (nodes.size() == 0U) {
+                return;
+              }
+              auto const [min_id, max_id] = std::ranges::minmax(nodes.ids_);
+              auto const [min_lat, max_lat] = std::ranges::minmax(nodes.lats_);
+              auto const [min_lon, max_lon] = std::ranges::minmax(nodes.lons_);
+              add(entity_kind::kNodes, min_id);
+              add(entity_kind::kNodes, max_id);
+              info.min_lat_ = std::min(info.min_lat_, min_lat);
+              info.min_lon_ = std::min(info.min_lon_, min_lon);
+              info.max_lat_ = std::max(info.max_lat_, max_lat);
+              info.max_lon_ = std::max(info.max_lon_, max_lon);
+            },
+            [&](std::int64_t const id, auto&&) {
+              add(entity_kind::kWays, id);
+            },
+            [&](std::int64_t const id, auto&&) {
+              add(entity_kind::kRelations, id);
+            });
+        return info;
+      },
+      [&](block_info&& info) { idx.blocks_.emplace_back(info); });
+  return idx;
+}
+
+void write_block_index(block_index const& idx, fs::path const& out) {
+  // Write to a temporary file first: concurrent readers of `out` either see
+  // the old or the complete new index.
+  auto const tmp = temp_path(out);
+  try {
+    {
+      auto mmap = cista::buf<cista::mmap>{
+          cista::mmap{tmp.string().c_str(), cista::mmap::protection::WRITE}};
+      cista::serialize<kMode>(mmap, idx);
+    }
+    fs::rename(tmp, out);
+  } catch (...) {
+    auto ec = std::error_code{};
+    fs::remove(tmp, ec);
+    throw;
+  }
+}
+
+std::optional<block_index_file> read_block_index(fs::path const& index,
+                                                 fs::path const& pbf) {
+  auto ec = std::error_code{};
+  if (!fs::is_regular_file(index, ec)) {
+    return std::nullopt;
+  }
+
+  try {
+    auto f = block_index_file{
+        .mem_ = cista::mmap{index.string().c_str(),
+                            cista::mmap::protection::READ},
+        .index_ = nullptr};
+    f.index_ = cista::deserialize<block_index, kMode>(f.mem_);
+    if (f.index_->file_size_ != fs::file_size(pbf) ||
+        f.index_->file_mtime_ != mtime(pbf)) {
+      return std::nullopt;
+    }
+    return f;
+  } catch (std::exception const&) {
+    return std::nullopt;
+  }
+}
+
+block_index_file ensure_block_index(fs::path const& pbf,
+                                    read_config const& c) {
+  auto const path = default_index_path(pbf);
+  if (auto idx = read_block_index(path, pbf); idx.has_value()) {
+    return std::move(*idx);
+  }
+
+  write_block_index(build_block_index(pbf, c), path);
+
+  auto idx = read_block_index(path, pbf);
+  utl::verify(idx.has_value(), "could not read block index {}", path.string());
+  return std::move(*idx);
+}
+
+}  // namespace osm
@@ -0,0 +1,66 @@
+#include "osm/buffer_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace osm {
+
+std::optional<buffer_pool::lease> buffer_pool::acquire(std::size_t const n,
+                                                       std::stop_token stop) {
+  auto lock = std::unique_lock{mutex_};
+  if (!cv_.wait(lock, stop,
+                [&]() { return leased_ == 0U || leased_ + n <= budget_; })) {
+    return std::nullopt;
+  }
+
+  leased_ += n;
+  peak_ = std::max(peak_, leased_);
+
+  // Smallest cached buffer that fits, else the largest one (grows).
+  auto buf = std::string{};
+  if (!free_.empty()) {
+    auto best = begin(free_);
+    for (auto it = begin(free_); it != end(free_); ++it) {
+      auto const fits = it->capacity() >= n;
+      auto const best_fits = best->capacity() >= n;
+      if ((fits && (!best_fits || it->capacity() < best->capacity())) ||
+          (!fits && !best_fits && it->capacity() > best->capacity())) {
+        best = it;
+      }
+    }
+    idle_ -= best->capacity();
+    std::swap(*best, free_.back());
+    buf = std::move(free_.back());
+    free_.pop_back();
+  }
+  return lease{this, n, std::move(buf)};
+}
+
+void buffer_pool::release(std::size_t const n, std::string buf) {
+  {
+    auto const lock = std::scoped_lock{mutex_};
+    leased_ -= n;
+    if (leased_ + idle_ + buf.capacity() <= budget_) {
+      idle_ += buf.capacity();
+      free_.emplace_back(std::move(buf));
+    }
+  }
+  cv_.notify_all();
+}
+
+std::size_t buffer_pool::leased() const {
+  auto const lock = std::scoped_lock{mutex_};
+  return leased_;
+}
+
+std::size_t buffer_pool::idle() const {
+  auto const lock = std::scoped_lock{mutex_};
+  return idle_;
+}
+
+std::size_t buffer_pool::peak() const {
+  auto const lock = std::scoped_lock{mutex_};
+  return peak_;
+}
+
+}  // namespace osm
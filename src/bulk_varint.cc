@@ -0,0 +1,209 @@
+#include "osm/bulk_varint.h"
+
+#include <cstring>
+
+#include "protozero/varint.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define OSM_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace osm {
+
+namespace {
+
+std::size_t decode_varints_scalar(char const* p,
+                                  char const* const end,
+                                  std::int64_t* out) {
+  auto const first = out;
+  while (p != end) {
+    *out++ = static_cast<std::int64_t>(protozero::decode_varint(&p, end));
+  }
+  return static_cast<std::size_t>(out - first);
+}
+
+void decode_zigzag_scalar(std::int64_t* data, std::size_t const n) {
+  for (auto i = std::size_t{0U}; i != n; ++i) {
+    data[i] = protozero::decode_zigzag64(static_cast<std::uint64_t>(data[i]));
+  }
+}
+
+void prefix_sum_scalar(std::int64_t* data,
+                       std::size_t const n,
+                       std::int64_t sum = 0) {
+  for (auto i = std::size_t{0U}; i != n; ++i) {
+    sum += data[i];
+    data[i] = sum;
+  }
+}
+
+#ifdef OSM_X86_DISPATCH
+
+// Concatenates the low 7 bits of the bytes of x (high bits cleared), same as
+// pext with 0x7F7F'7F7F'7F7F'7F7F: 2x7 -> 14, 2x14 -> 28, 2x28 -> 56 bits.
+inline std::uint64_t compact_7bit(std::uint64_t x) {
+  x = (x & 0x007F'007F'007F'007FULL) | ((x & 0x7F00'7F00'7F00'7F00ULL) >> 1U);
+  x = (x & 0x0000'3FFF'0000'3FFFULL) | ((x & 0x3FFF'0000'3FFF'0000ULL) >> 2U);
+  return (x & 0x0000'0000'0FFF'FFFFULL) |
+         ((x & 0x0FFF'FFFF'0000'0000ULL) >> 4U);
+}
+
+// Masked VByte style: the continuation bits of 32 input bytes are gathered
+// with one movemask. A chunk without continuation bits holds 32 one byte
+// varints which are widened directly. Otherwise the terminator mask yields
+// every varint's length without looking at single bytes, and varints of up to
+// 8 bytes are assembled with one pext (Pext) or compact_7bit.
+template <bool Pext>
+__attribute__((target("avx2,bmi,bmi2"))) std::size_t decode_varints_avx2(
+    char const* p, char const* const end, std::int64_t* out) {
+  auto const first = out;
+  while (end - p >= 32) {
+    auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+    auto const cont = static_cast<std::uint32_t>(_mm256_movemask_epi8(v));
+
+    if (cont == 0U) {
+      for (auto i = 0; i != 32; i += 4) {
+        auto x = std::int32_t{};
+        std::memcpy(&x, p + i, sizeof(x));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                            _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(x)));
+      }
+      p += 32;
+      out += 32;
+      continue;
+    }
+
+    auto ends = ~cont;
+    if (ends == 0U) {
+      break;  // malformed (> 10 byte varint): scalar loop reports it
+    }
+
+    // Unaligned 8 byte loads for every start position in the chunk: read
+    // from the input directly unless this is the end of the input.
+    alignas(32) char padded[40] = {};
+    auto chunk = p;
+    if (end - p < 40) {
+      std::memcpy(padded, p, 32);
+      chunk = padded;
+    }
+
+    auto pos = 0U;
+    while (ends != 0U) {
+      auto const e = static_cast<unsigned>(_tzcnt_u32(ends));
+      auto const len = e - pos + 1U;
+      if (len <= 8U) {
+        auto w = std::uint64_t{};
+        std::memcpy(&w, chunk + pos, sizeof(w));
+        auto const mask = 0x7F7F'7F7F'7F7F'7F7FULL >> (8U * (8U - len));
+        if constexpr (Pext) {
+          *out++ = static_cast<std::int64_t>(_pext_u64(w, mask));
+        } else {
+          *out++ = static_cast<std::int64_t>(compact_7bit(w & mask));
+        }
+      } else {
+        auto q = chunk + pos;
+        *out++ = static_cast<std::int64_t>(
+            protozero::decode_varint(&q, chunk + e + 1U));
+      }
+      pos = e + 1U;
+      ends = _blsr_u32(ends);
+    }
+    p += pos;  // an incomplete varint at the end is decoded with the next chunk
+  }
+  return static_cast<std::size_t>(out - first) +
+         decode_varints_scalar(p, end, out);
+}
+
+__attribute__((target("avx2"))) void decode_zigzag_avx2(std::int64_t* data,
+                                                        std::size_t const n) {
+  auto const one = _mm256_set1_epi64x(1);
+  auto const zero = _mm256_setzero_si256();
+  auto i = std::size_t{0U};
+  for (; i + 4U <= n; i += 4U) {
+    auto const p = reinterpret_cast<__m256i*>(data + i);
+    auto const x = _mm256_loadu_si256(p);
+    auto const sign = _mm256_sub_epi64(zero, _mm256_and_si256(x, one));
+    _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_srli_epi64(x, 1), sign));
+  }
+  decode_zigzag_scalar(data + i, n - i);
+}
+
+// In register prefix sum over 4 lanes (two shifted adds), then the running
+// total of the previous vector is added to all lanes.
+__attribute__((target("avx2"))) void prefix_sum_avx2(std::int64_t* data,
+                                                     std::size_t const n) {
+  auto const zero = _mm256_setzero_si256();
+  auto carry = zero;
+  auto i = std::size_t{0U};
+  for (; i + 4U <= n; i += 4U) {
+    auto const p = reinterpret_cast<__m256i*>(data + i);
+    auto x = _mm256_loadu_si256(p);
+
+    // [a, b, c, d] + [0, a, b, c]
+    x = _mm256_add_epi64(
+        x, _mm256_blend_epi32(_mm256_permute4x64_epi64(x, 0b10'01'00'00), zero,
+                              0b0000'0011));
+
+    // [a, a+b, b+c, c+d] + [0, 0, a, a+b]
+    x = _mm256_add_epi64(
+        x, _mm256_blend_epi32(_mm256_permute4x64_epi64(x, 0b01'00'00'00), zero,
+                              0b0000'1111));
+
+    x = _mm256_add_epi64(x, carry);
+    _mm256_storeu_si256(p, x);
+    carry = _mm256_permute4x64_epi64(x, 0b11'11'11'11);
+  }
+  prefix_sum_scalar(data + i, n - i, i == 0U ? 0 : data[i - 1U]);
+}
+
+bool has_avx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2");
+}
+
+bool const kAvx2 = has_avx2();
+
+// pext is microcoded on AMD Zen 1 / Zen 2 (latency depends on the mask,
+// ~20 cycles for the varint masks), shifts are faster there.
+bool has_fast_pext() {
+  __builtin_cpu_init();
+  return !__builtin_cpu_is("znver1") && !__builtin_cpu_is("znver2");
+}
+
+bool const kFastPext = has_fast_pext();
+
+#endif
+
+}  // namespace
+
+std::size_t decode_varints(std::string_view in, std::int64_t* out) {
+  auto const end = in.data() + in.size();
+#ifdef OSM_X86_DISPATCH
+  if (kAvx2) {
+    return kFastPext ? decode_varints_avx2<true>(in.data(), end, out)
+                     : decode_varints_avx2<false>(in.data(), end, out);
+  }
+#endif
+  return decode_varints_scalar(in.data(), end, out);
+}
+
+void decode_zigzag(std::int64_t* data, std::size_t const n) {
+#ifdef OSM_X86_DISPATCH
+  if (kAvx2) {
+    return decode_zigzag_avx2(data, n);
+  }
+#endif
+  decode_zigzag_scalar(data, n);
+}
+
+void prefix_sum(std::int64_t* data, std::size_t const n) {
+#ifdef OSM_X86_DISPATCH
+  if (kAvx2) {
+    return prefix_sum_avx2(data, n);
+  }
+#endif
+  prefix_sum_scalar(data, n);
+}
+
+}  // namespace osm
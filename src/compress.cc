@@ -0,0 +1,49 @@
+#include "osm/compress.h"
+
+#ifdef OSM_WITH_ZSTD
+#include "zstd.h"
+#endif
+
+#include "zlib.h"
+
+#include "utl/verify.h"
+
+namespace osm {
+
+std::string compress(compression const c,
+                     std::string_view block,
+                     int const level) {
+  switch (c) {
+    case compression::kRaw: return std::string{block};
+
+    case compression::kZlib: {
+      auto size = compressBound(static_cast<uLong>(block.size()));
+      auto out = std::string(size, '\0');
+      auto const ec = compress2(
+          reinterpret_cast<Bytef*>(out.data()), &size,
+          reinterpret_cast<Bytef const*>(block.data()),
+          static_cast<uLong>(block.size()), level < 0 ? Z_DEFAULT_COMPRESSION
+                                                      : level);
+      utl::verify(ec == Z_OK, "deflate failed: {}", ec);
+      out.resize(size);
+      return out;
+    }
+
+#ifdef OSM_WITH_ZSTD
+    case compression::kZstd: {
+      auto out = std::string(ZSTD_compressBound(block.size()), '\0');
+      auto const n =
+          ZSTD_compress(out.data(), out.size(), block.data(), block.size(),
+                        level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+      utl::verify(!ZSTD_isError(n), "zstd failed: {}", ZSTD_getErrorName(n));
+      out.resize(n);
+      return out;
+    }
+#endif
+
+    default:
+      throw utl::fail("unsupported blob compression {}", static_cast<int>(c));
+  }
+}
+
+}  // namespace osm
@@ -0,0 +1,141 @@
+#include "osm/header.h"
+
+#include <algorithm>
+#include <array>
+
+#include "protozero/pbf_message.hpp"
+
+#include "utl/verify.h"
+
+#include "osm/decompress.h"
+
+namespace osm {
+
+namespace {
+
+// HistoricalInformation: all versions are passed to the callbacks.
+constexpr auto const kSupportedFeatures =
+    std::array<std::string_view, 4U>{"OsmSchema-V0.6", "DenseNodes",
+                                     "HistoricalInformation", kLocationsOnWays};
+
+bbox parse_bbox(std::string_view const s) {
+  auto left = std::int64_t{}, right = std::int64_t{};
+  auto top = std::int64_t{}, bottom = std::int64_t{};
+  auto pbf_bbox = protozero::pbf_message<header_bbox>{s};
+  while (pbf_bbox.next()) {
+    switch (pbf_bbox.tag_and_type()) {
+      case protozero::tag_and_type(header_bbox::required_sint64_left,
+                                   protozero::pbf_wire_type::varint):
+        left = pbf_bbox.get_sint64();
+        break;
+
+      case protozero::tag_and_type(header_bbox::required_sint64_right,
+                                   protozero::pbf_wire_type::varint):
+        right = pbf_bbox.get_sint64();
+        break;
+
+      case protozero::tag_and_type(header_bbox::required_sint64_top,
+                                   protozero::pbf_wire_type::varint):
+        top = pbf_bbox.get_sint64();
+        break;
+
+      case protozero::tag_and_type(header_bbox::required_sint64_bottom,
+                                   protozero::pbf_wire_type::varint):
+        bottom = pbf_bbox.get_sint64();
+        break;
+
+      default: pbf_bbox.skip();
+    }
+  }
+
+  return {.min_ = {nano_to_fixed(bottom), nano_to_fixed(left)},
+          .max_ = {nano_to_fixed(top), nano_to_fixed(right)}};
+}
+
+}  // namespace
+
+bool header::has_feature(std::string_view const f) const {
+  return std::ranges::find(required_features_, f) != end(required_features_) ||
+         std::ranges::find(optional_features_, f) != end(optional_features_);
+}
+
+header parse_header(std::string_view const block) {
+  auto h = header{};
+  auto pbf_header = protozero::pbf_message<header_block>{block};
+  while (pbf_header.next()) {
+    switch (pbf_header.tag_and_type()) {
+      case protozero::tag_and_type(
+          header_block::repeated_string_required_features,
+          protozero::pbf_wire_type::length_delimited):
+        h.required_features_.emplace_back(pbf_header.get_view());
+        break;
+
+      case protozero::tag_and_type(
+          header_block::repeated_string_optional_features,
+          protozero::pbf_wire_type::length_delimited):
+        h.optional_features_.emplace_back(pbf_header.get_view());
+        break;
+
+      case protozero::tag_and_type(header_block::optional_HeaderBBox_bbox,
+                                   protozero::pbf_wire_type::length_delimited):
+        h.bbox_ = parse_bbox(pbf_header.get_view());
+        break;
+
+      case protozero::tag_and_type(
+          header_block::optional_string_writingprogram,
+          protozero::pbf_wire_type::length_delimited):
+        h.writing_program_ = pbf_header.get_string();
+        break;
+
+      case protozero::tag_and_type(header_block::optional_string_source,
+                                   protozero::pbf_wire_type::length_delimited):
+        h.source_ = pbf_header.get_string();
+        break;
+
+      case protozero::tag_and_type(
+          header_block::optional_int64_osmosis_replication_timestamp,
+          protozero::pbf_wire_type::varint):
+        h.replication_timestamp_ = pbf_header.get_int64();
+        break;
+
+      case protozero::tag_and_type(
+          header_block::optional_int64_osmosis_replication_sequence_number,
+          protozero::pbf_wire_type::varint):
+        h.replication_sequence_ = pbf_header.get_int64();
+        break;
+
+      case protozero::tag_and_type(
+          header_block::optional_string_osmosis_replication_base_url,
+          protozero::pbf_wire_type::length_delimited):
+        h.replication_base_url_ = pbf_header.get_string();
+        break;
+
+      default: pbf_header.skip();
+    }
+  }
+  return h;
+}
+
+header read_header(buf const& b) {
+  utl::verify(b.type_ == blob_type::kHeader, "blob {} is not an OSMHeader",
+              b.idx_);
+  auto d = decompressor{};
+  auto out = std::string{};
+  auto h = parse_header(d.decompress(b, out));
+  for (auto const& f : h.required_features_) {
+    utl::verify(std::ranges::find(kSupportedFeatures, f) !=
+                    end(kSupportedFeatures),
+                "unsupported required feature: {}", f);
+  }
+  return h;
+}
+
+header read_header(char const* path) {
+  auto r =
+      raw_reader{.file_ = cista::mmap{path, cista::mmap::protection::READ}};
+  auto const b = r.read();
+  utl::verify(b.has_value(), "{}: empty file", path);
+  return read_header(*b);
+}
+
+}  // namespace osm
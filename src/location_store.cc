@@ -0,0 +1,60 @@
+#include "osm/location_store.h"
+
+#include <algorithm>
+
+namespace osm {
+
+dense_location_store::dense_location_store(char const* path,
+                                           std::uint64_t const max_id)
+    : mem_{path, cista::mmap::protection::WRITE},
+      data_{nullptr},
+      size_{max_id + 1U} {
+  mem_.resize(size_ * sizeof(std::uint64_t));
+  data_ = reinterpret_cast<std::uint64_t*>(mem_.data());
+}
+
+std::uint64_t sparse_location_store::next_instance() {
+  static auto next = std::atomic_uint64_t{1U};
+  return next.fetch_add(1U, std::memory_order_relaxed);
+}
+
+location sparse_location_store::get(std::int64_t const id) const {
+  auto const it = std::ranges::lower_bound(entries_, id, {}, &entry::id_);
+  return it != end(entries_) && it->id_ == id ? it->l_ : location{};
+}
+
+void sparse_location_store::finish() {
+  auto n = entries_.size();
+  for (auto const& b : buffers_) {
+    n += b->size();
+  }
+  entries_.reserve(n);
+  for (auto const& b : buffers_) {
+    entries_.insert(end(entries_), begin(*b), end(*b));
+    *b = {};  // threads keep their buffer pointer cached
+  }
+  std::ranges::sort(entries_, {}, &entry::id_);
+}
+
+paged_location_store::paged_location_store(std::uint64_t const max_id)
+    : n_pages_{(max_id >> kPageBits) + 1U},
+      pages_{std::make_unique<std::atomic<std::uint64_t*>[]>(n_pages_)} {}
+
+paged_location_store::~paged_location_store() {
+  for (auto i = std::size_t{0U}; i != n_pages_; ++i) {
+    delete[] pages_[i].load();
+  }
+}
+
+std::uint64_t* paged_location_store::allocate(std::size_t const page_idx) {
+  auto page = new std::uint64_t[kPageSize]{};
+  auto expected = static_cast<std::uint64_t*>(nullptr);
+  if (!pages_[page_idx].compare_exchange_strong(expected, page,
+                                                std::memory_order_acq_rel)) {
+    delete[] page;  // another thread was faster
+    return expected;
+  }
+  return page;
+}
+
+}  // namespace osm
@@ -0,0 +1,127 @@
+#include "osm/lookup.h"
+
+#include <tuple>
+
+#include "utl/verify.h"
+
+#include "osm/header.h"
+
+namespace osm {
+
+namespace {
+
+// Position of a kind in Sort.Type_then_ID order.
+int rank(entity_kind const k) {
+  switch (k) {
+    case entity_kind::kNodes: return 0;
+    case entity_kind::kWays: return 1;
+    case entity_kind::kRelations: return 2;
+    default: throw utl::fail("lookup: block with mixed or unknown kind");
+  }
+}
+
+}  // namespace
+
+lookup::lookup(std::filesystem::path const& pbf)
+    : r_{.file_ = cista::mmap{pbf.string().c_str(),
+                              cista::mmap::protection::READ}} {
+  auto b = r_.read();
+  utl::verify(b.has_value(), "{}: empty file", pbf.string());
+  utl::verify(read_header(*b).sorted(), "lookup: {} is not {}", pbf.string(),
+              kSortTypeThenId);
+
+  index_ = read_block_index(default_index_path(pbf), pbf);
+  if (index_.has_value()) {
+    return;
+  }
+
+  // Blob directory: only blob headers are read, nothing is inflated.
+  while ((b = r_.read()).has_value()) {
+    if (b->type_ == blob_type::kData) {
+      blobs_.emplace_back(b->offset_, b->idx_);
+    }
+  }
+  heads_.resize(blobs_.size());
+}
+
+block_head const& lookup::head(std::size_t const blob) {
+  auto& h = heads_[blob];
+  if (!h.has_value()) {
+    auto const [offset, idx] = blobs_[blob];
+    r_.seek(offset, idx);
+    h = peek_head(decompressor_, *r_.read(), out_);
+    utl::verify(h->first_id_.has_value(), "lookup: no ID in block {}", idx);
+  }
+  return *h;
+}
+
+std::optional<std::size_t> lookup::find_block(entity_kind const kind,
+                                              std::int64_t const id) {
+  if (index_.has_value()) {
+    if (blocks_kind_ != kind) {
+      blocks_ = select_blocks(**index_, kind);
+      blocks_kind_ = kind;
+    }
+    auto const it = std::ranges::lower_bound(blocks_, id, {},
+                                             &block_info::max_id_);
+    return it != end(blocks_) && it->contains(id)
+               ? std::optional{static_cast<std::size_t>(it - begin(blocks_))}
+               : std::nullopt;
+  }
+
+  // Last block whose first entity is <= (kind, id).
+  auto const key = std::tuple{rank(kind), id};
+  auto lo = std::size_t{0U};
+  auto hi = blobs_.size();
+  while (lo != hi) {
+    auto const mid = lo + (hi - lo) / 2U;
+    auto const& h = head(mid);
+    if (std::tuple{rank(h.kind_), *h.first_id_} <= key) {
+      lo = mid + 1U;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo != 0U && head(lo - 1U).kind_ == kind ? std::optional{lo - 1U}
+                                                 : std::nullopt;
+}
+
+void lookup::get(
+    entity_kind const kind,
+    std::span<std::int64_t const> ids,
+    std::function<void(std::span<std::int64_t const>, std::string_view)> const&
+        fn) {
+  auto sorted = std::vector<std::int64_t>(begin(ids), end(ids));
+  std::ranges::sort(sorted);
+  auto const [first, last] = std::ranges::unique(sorted);
+  sorted.erase(first, last);
+
+  // Consecutive IDs of the same block form one batch.
+  auto const read_block = [&](std::size_t const block) {
+    auto const [offset, idx] =
+        index_.has_value()
+            ? std::pair<std::size_t, std::size_t>{blocks_[block].offset_,
+                                                  blocks_[block].idx_}
+            : blobs_[block];
+    r_.seek(offset, idx);
+    return decompressor_.decompress(*r_.read(), out_);
+  };
+
+  auto batch_begin = std::size_t{0U};
+  auto batch_block = std::optional<std::size_t>{};
+  for (auto i = std::size_t{0U}; i <= sorted.size(); ++i) {
+    auto const block = i == sorted.size() ? std::nullopt
+                                          : find_block(kind, sorted[i]);
+    if (i != 0U && block == batch_block && i != sorted.size()) {
+      continue;
+    }
+    if (batch_block.has_value()) {
+      fn(std::span{sorted}.subspan(batch_begin, i - batch_begin),
+         read_block(*batch_block));
+    }
+    batch_begin = i;
+    batch_block = block;
+  }
+}
+
+}  // namespace osm
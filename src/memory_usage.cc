@@ -0,0 +1,98 @@
+#include "osm/memory_usage.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <fstream>
+#include <string_view>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "fmt/format.h"
+
+#include "utl/verify.h"
+
+namespace osm {
+
+namespace {
+
+// Adds the value (kB) of a "Key:   123 kB" line to `out` if the key matches.
+void parse_kb(std::string_view line, std::string_view key, std::size_t& out) {
+  if (!line.starts_with(key) || line.size() == key.size() ||
+      line[key.size()] != ':') {
+    return;
+  }
+  auto kb = std::size_t{0U};
+  for (auto const c : line.substr(key.size() + 1U)) {
+    if (c >= '0' && c <= '9') {
+      kb = kb * 10U + static_cast<std::size_t>(c - '0');
+    }
+  }
+  out = kb * 1024U;
+}
+
+}  // namespace
+
+memory_usage get_memory_usage() {
+  auto m = memory_usage{};
+#ifdef __linux__
+  auto line = std::string{};
+
+  auto status = std::ifstream{"/proc/self/status"};
+  while (std::getline(status, line)) {
+    parse_kb(line, "VmRSS", m.rss_);
+    parse_kb(line, "VmHWM", m.peak_rss_);
+  }
+
+  // Linux >= 4.14, PSS stays zero otherwise.
+  auto rollup = std::ifstream{"/proc/self/smaps_rollup"};
+  while (std::getline(rollup, line)) {
+    parse_kb(line, "Pss", m.pss_);
+    parse_kb(line, "Pss_Anon", m.pss_anon_);
+    parse_kb(line, "Pss_File", m.pss_file_);
+    parse_kb(line, "Swap", m.swap_);
+  }
+#endif
+  return m;
+}
+
+std::size_t resident_bytes(void const* data, std::size_t const size) {
+#ifdef __linux__
+  if (data == nullptr || size == 0U) {
+    return 0U;
+  }
+
+  auto const page = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+  auto const first = reinterpret_cast<std::uintptr_t>(data) & ~(page - 1U);
+  auto const last = reinterpret_cast<std::uintptr_t>(data) + size;
+  auto const n_pages = (last - first + page - 1U) / page;
+
+  auto pages = std::vector<unsigned char>(n_pages);
+  utl::verify(mincore(reinterpret_cast<void*>(first), last - first,
+                      pages.data()) == 0,
+              "mincore failed");
+
+  auto n_resident = std::size_t{0U};
+  for (auto const p : pages) {
+    n_resident += p & 1U;
+  }
+  return std::min(n_resident * page, size);
+#else
+  (void)data;
+  (void)size;
+  return 0U;
+#endif
+}
+
+std::string to_string(memory_usage const& m) {
+  constexpr auto const kMB = 1024U * 1024U;
+  return fmt::format(
+      "rss={} MB (peak {} MB), pss={} MB (anon {} MB, file {} MB), swap={} MB",
+      m.rss_ / kMB, m.peak_rss_ / kMB, m.pss_ / kMB, m.pss_anon_ / kMB,
+      m.pss_file_ / kMB, m.swap_ / kMB);
+}
+
+}  // namespace osm
@@ -0,0 +1,142 @@
+#include "osm/shard.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "protozero/pbf_message.hpp"
+
+#include "cista/endian/conversion.h"
+
+#include "utl/verify.h"
+
+namespace osm {
+
+namespace {
+
+constexpr auto const kDataBlobType = std::string_view{"\x0a\x07OSMData", 9U};
+
+// size * i / n without overflow.
+std::size_t split_point(std::size_t const size, shard_spec const s) {
+  return size / s.n_ * s.i_ + size % s.n_ * s.i_ / s.n_;
+}
+
+// End of the blob starting at `pos` if the frame is consistent.
+std::optional<std::size_t> blob_end(std::string_view file,
+                                    std::size_t const pos,
+                                    bool const data_only) {
+  auto size = std::uint32_t{};
+  if (pos + sizeof(size) > file.size()) {
+    return std::nullopt;
+  }
+  std::memcpy(&size, file.data() + pos, sizeof(size));
+  if constexpr (cista::endian_conversion_necessary<
+                    cista::mode::SERIALIZE_BIG_ENDIAN>()) {
+    size = cista::endian_swap(size);
+  }
+  auto const header_begin = pos + sizeof(size);
+  if (size > raw_reader::kMaxBlobHeaderSize ||
+      header_begin + size > file.size()) {
+    return std::nullopt;
+  }
+
+  auto type = std::string_view{};
+  auto data_size = std::int64_t{-1};
+  try {
+    auto hdr =
+        protozero::pbf_message<blob_header>{file.substr(header_begin, size)};
+    while (hdr.next()) {
+      switch (hdr.tag_and_type()) {
+        case protozero::tag_and_type(
+            blob_header::required_string_type,
+            protozero::pbf_wire_type::length_delimited):
+          type = hdr.get_view();
+          break;
+
+        case protozero::tag_and_type(blob_header::required_int32_datasize,
+                                     protozero::pbf_wire_type::varint):
+          data_size = hdr.get_int32();
+          break;
+
+        default: hdr.skip();
+      }
+    }
+  } catch (...) {
+    return std::nullopt;  // not a blob header
+  }
+
+  auto const end = header_begin + size + static_cast<std::size_t>(data_size);
+  if ((type != "OSMData" && (data_only || type != "OSMHeader")) ||
+      data_size < 0 || end > file.size()) {
+    return std::nullopt;
+  }
+  return end;
+}
+
+}  // namespace
+
+std::size_t next_blob_start(std::string_view file, std::size_t const offset) {
+  constexpr auto const kPrefix = sizeof(std::uint32_t);
+  for (auto q = file.find(kDataBlobType, offset + kPrefix);
+       q != std::string_view::npos; q = file.find(kDataBlobType, q + 1U)) {
+    auto const start = q - kPrefix;
+    auto const end = blob_end(file, start, true);
+    if (end.has_value() &&
+        (*end == file.size() || blob_end(file, *end, false).has_value())) {
+      return start;
+    }
+  }
+  return file.size();
+}
+
+shard_range get_shard(std::string_view file, shard_spec const s) {
+  utl::verify(s.i_ < s.n_, "shard {} of {}", s.i_, s.n_);
+  auto const boundary = [&](unsigned const i) {
+    return i == 0U     ? std::size_t{0U}
+           : i == s.n_ ? file.size()
+                       : next_blob_start(file, split_point(file.size(),
+                                                           {i, s.n_}));
+  };
+  return {.begin_ = boundary(s.i_), .end_ = boundary(s.i_ + 1U)};
+}
+
+shard_range get_shard(block_index const& idx, shard_spec const s) {
+  utl::verify(s.i_ < s.n_, "shard {} of {}", s.i_, s.n_);
+  auto const first_block = [&](unsigned const i) {
+    auto const p = split_point(idx.file_size_, {i, s.n_});
+    return std::ranges::lower_bound(idx.blocks_, p, {}, &block_info::offset_);
+  };
+
+  auto r = shard_range{.end_ = idx.file_size_};
+  if (s.i_ == 0U) {
+    r.idx_ = 0U;
+  } else if (auto const it = first_block(s.i_); it != end(idx.blocks_)) {
+    r.begin_ = it->offset_;
+    r.idx_ = it->idx_;
+  } else {
+    r.begin_ = idx.file_size_;
+  }
+  if (auto const it = first_block(s.i_ + 1U);
+      s.i_ + 1U != s.n_ && it != end(idx.blocks_)) {
+    r.end_ = it->offset_;
+  }
+  return r;
+}
+
+std::optional<buf> shard_reader::read() {
+  if (!started_) {
+    started_ = true;
+    r_.seek(0U, 0U);
+    auto header = r_.read();
+    if (range_.begin_ != 0U) {
+      r_.seek(range_.begin_, range_.idx_.value_or(1U));
+    }
+    return header;
+  }
+  return r_.offset() < range_.end_ ? r_.read() : std::nullopt;
+}
+
+std::size_t shard_reader::offset() const {
+  return std::clamp(r_.offset(), range_.begin_, range_.end_) - range_.begin_;
+}
+
+}  // namespace osm
@@ -0,0 +1,347 @@
+#include "osm/snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+#include <span>
+#include <string>
+
+#include "cista/serialization.h"
+#include "cista/targets/buf.h"
+
+#include "protozero/varint.hpp"
+
+#include "utl/verify.h"
+
+#include "osm/header.h"
+#include "osm/parallel_reader.h"
+#include "osm/string_interner.h"
+#include "osm/temp_path.h"
+
+namespace fs = std::filesystem;
+
+namespace osm {
+
+// No WITH_INTEGRITY: it hashes the whole snapshot on every read. A trailer
+// holding the serialized size rejects truncated files instead, stale ones
+// are detected by PBF size / mtime.
+constexpr auto const kMode = cista::mode::WITH_VERSION;
+
+namespace {
+
+std::int64_t mtime(fs::path const& p) {
+  return static_cast<std::int64_t>(
+      fs::last_write_time(p).time_since_epoch().count());
+}
+
+template <typename T>
+using vec = cista::offset::vector<T>;
+
+struct tag_list {
+  template <typename Tags>
+  void add(Tags&& tags) {
+    auto n = 0U;
+    for (auto const [k, v] : tags) {
+      tags_.push_back({k, v});
+      ++n;
+    }
+    counts_.push_back(n);
+  }
+
+  std::vector<std::uint32_t> counts_;
+  std::vector<tag_id> tags_;
+};
+
+// Entities of one primitive block, built on the worker threads.
+struct chunk {
+  std::vector<std::int64_t> node_ids_;
+  std::vector<std::int32_t> node_lats_, node_lons_;
+  tag_list node_tags_;
+
+  std::vector<std::int64_t> way_ids_;
+  std::vector<std::uint32_t> way_ref_sizes_;
+  std::string way_refs_;
+  tag_list way_tags_;
+
+  std::vector<std::int64_t> relation_ids_;
+  std::vector<std::uint32_t> member_counts_;
+  std::vector<std::int64_t> member_refs_;
+  std::vector<std::uint32_t> member_roles_;
+  std::vector<std::uint8_t> member_types_;
+  tag_list relation_tags_;
+};
+
+template <typename T, typename Range>
+void append(vec<T>& to, Range const& from) {
+  for (auto const& x : from) {
+    to.push_back(static_cast<T>(x));
+  }
+}
+
+void append_offsets(vec<std::uint64_t>& offsets,
+                    std::vector<std::uint32_t> const& sizes) {
+  for (auto const n : sizes) {
+    offsets.push_back(offsets.back() + n);
+  }
+}
+
+void append(snapshot_tags& to, tag_list const& from) {
+  append_offsets(to.offsets_, from.counts_);
+  append(to.tags_, from.tags_);
+}
+
+void append(snapshot& s, chunk const& c) {
+  append(s.node_ids_, c.node_ids_);
+  append(s.node_lats_, c.node_lats_);
+  append(s.node_lons_, c.node_lons_);
+  append(s.node_tags_, c.node_tags_);
+
+  append(s.way_ids_, c.way_ids_);
+  append_offsets(s.way_ref_offsets_, c.way_ref_sizes_);
+  append(s.way_refs_, c.way_refs_);
+  append(s.way_tags_, c.way_tags_);
+
+  append(s.relation_ids_, c.relation_ids_);
+  append_offsets(s.member_offsets_, c.member_counts_);
+  append(s.member_refs_, c.member_refs_);
+  append(s.member_roles_, c.member_roles_);
+  append(s.member_types_, c.member_types_);
+  append(s.relation_tags_, c.relation_tags_);
+}
+
+std::vector<std::size_t> sort_permutation(vec<std::int64_t> const& ids) {
+  auto perm = std::vector<std::size_t>(ids.size());
+  std::iota(begin(perm), end(perm), std::size_t{0U});
+  std::ranges::stable_sort(perm, std::less<>{},
+                           [&](std::size_t const i) { return ids[i]; });
+  return perm;
+}
+
+template <typename T>
+void permute(vec<T>& v, std::vector<std::size_t> const& perm) {
+  auto sorted = vec<T>{};
+  sorted.reserve(perm.size());
+  for (auto const i : perm) {
+    sorted.push_back(v[i]);
+  }
+  v = std::move(sorted);
+}
+
+// Permutes the values of a CSR layout. Offsets have to be permuted last.
+template <typename T>
+void permute(vec<T>& values,
+             vec<std::uint64_t> const& offsets,
+             std::vector<std::size_t> const& perm) {
+  auto sorted = vec<T>{};
+  sorted.reserve(values.size());
+  for (auto const i : perm) {
+    for (auto j = offsets[i]; j != offsets[i + 1U]; ++j) {
+      sorted.push_back(values[j]);
+    }
+  }
+  values = std::move(sorted);
+}
+
+void permute(vec<std::uint64_t>& offsets,
+             std::vector<std::size_t> const& perm) {
+  auto sorted = vec<std::uint64_t>{};
+  sorted.reserve(offsets.size());
+  sorted.push_back(0U);
+  for (auto const i : perm) {
+    sorted.push_back(sorted.back() + (offsets[i + 1U] - offsets[i]));
+  }
+  offsets = std::move(sorted);
+}
+
+void permute(snapshot_tags& t, std::vector<std::size_t> const& perm) {
+  permute(t.tags_, t.offsets_, perm);
+  permute(t.offsets_, perm);
+}
+
+// Files without Sort.Type_then_ID (or merged from several sources).
+void sort_by_id(snapshot& s) {
+  if (!std::ranges::is_sorted(s.node_ids_)) {
+    auto const perm = sort_permutation(s.node_ids_);
+    permute(s.node_ids_, perm);
+    permute(s.node_lats_, perm);
+    permute(s.node_lons_, perm);
+    permute(s.node_tags_, perm);
+  }
+  if (!std::ranges::is_sorted(s.way_ids_)) {
+    auto const perm = sort_permutation(s.way_ids_);
+    permute(s.way_ids_, perm);
+    permute(s.way_refs_, s.way_ref_offsets_, perm);
+    permute(s.way_ref_offsets_, perm);
+    permute(s.way_tags_, perm);
+  }
+  if (!std::ranges::is_sorted(s.relation_ids_)) {
+    auto const perm = sort_permutation(s.relation_ids_);
+    permute(s.relation_ids_, perm);
+    permute(s.member_refs_, s.member_offsets_, perm);
+    permute(s.member_roles_, s.member_offsets_, perm);
+    permute(s.member_types_, s.member_offsets_, perm);
+    permute(s.member_offsets_, perm);
+    permute(s.relation_tags_, perm);
+  }
+}
+
+}  // namespace
+
+snapshot build_snapshot(fs::path const& pbf, read_config const& config) {
+  auto tmp_interner = std::optional<string_interner>{};
+  auto c = config;
+  if (c.interner_ == nullptr) {
+    c.interner_ = &tmp_interner.emplace();
+  }
+
+  auto const h = read_header(pbf.string().c_str());
+  auto s = snapshot{.file_size_ = fs::file_size(pbf),
+                    .file_mtime_ = mtime(pbf),
+                    .replication_timestamp_ = h.replication_timestamp_};
+  for (auto* offsets : {&s.node_tags_.offsets_, &s.way_ref_offsets_,
+                        &s.way_tags_.offsets_, &s.member_offsets_,
+                        &s.relation_tags_.offsets_}) {
+    offsets->push_back(0U);
+  }
+
+  auto r = raw_reader{.file_ = cista::mmap{pbf.string().c_str(),
+                                           cista::mmap::protection::READ}};
+  read_ordered(
+      r, c,
+      [&](buf const&, std::string_view block, decode_state& state) {
+        auto x = chunk{};
+        decode_primitive<field::kAll | field::kTagIds>(
+            block, state, c.read_nodes_, c.read_ways_, c.read_relations_,
+            [&](node_batch const& nodes) {
+              x.node_ids_.insert(end(x.node_ids_), begin(nodes.ids_),
+                                 end(nodes.ids_));
+              x.node_lats_.insert(end(x.node_lats_), begin(nodes.lats_),
+                                  end(nodes.lats_));
+              x.node_lons_.insert(end(x.node_lons_), begin(nodes.lons_),
+                                  end(nodes.lons_));
+              for (auto i = std::size_t{0U}; i != nodes.size(); ++i) {
+                x.node_tags_.add(nodes.tag_ids(i));
+              }
+            },
+            [&](std::uint64_t const id, auto&& refs, auto&& tags) {
+              x.way_ids_.push_back(static_cast<std::int64_t>(id));
+              auto const first = x.way_refs_.size();
+              auto prev = std::int64_t{0};
+              for (auto const ref : refs) {
+                protozero::write_varint(
+                    std::back_inserter(x.way_refs_),
+                    protozero::encode_zigzag64(ref - prev));
+                prev = ref;
+              }
+              x.way_ref_sizes_.push_back(
+                  static_cast<std::uint32_t>(x.way_refs_.size() - first));
+              x.way_tags_.add(tags);
+            },
+            [&](std::uint64_t const id, auto&& members, auto&& tags) {
+              x.relation_ids_.push_back(static_cast<std::int64_t>(id));
+              auto n = 0U;
+              for (auto const [ref, role, type] : members) {
+                x.member_refs_.push_back(ref);
+                x.member_roles_.push_back(state.interner_->intern(role));
+                x.member_types_.push_back(static_cast<std::uint8_t>(type));
+                ++n;
+              }
+              x.member_counts_.push_back(n);
+              x.relation_tags_.add(tags);
+            });
+        return x;
+      },
+      [&](chunk&& x) { append(s, x); });
+
+  sort_by_id(s);
+
+  auto const n_strings = c.interner_->size();
+  s.strings_.reserve(n_strings);
+  for (auto i = std::uint32_t{0U}; i != n_strings; ++i) {
+    s.strings_.emplace_back(c.interner_->get(i));
+  }
+  return s;
+}
+
+void write_snapshot(snapshot const& s, fs::path const& out) {
+  // Write to a temporary file first and rename it: concurrent readers of
+  // `out` see the old or the new snapshot, never a partially written one.
+  auto const tmp = temp_path(out);
+  try {
+    {
+      auto mmap = cista::buf<cista::mmap>{
+          cista::mmap{tmp.string().c_str(), cista::mmap::protection::WRITE}};
+      cista::serialize<kMode>(mmap, s);
+
+      auto const size = static_cast<std::uint64_t>(mmap.buf_.size());
+      mmap.buf_.resize(size + sizeof(size));
+      std::memcpy(mmap.buf_.data() + size, &size, sizeof(size));
+    }
+    fs::rename(tmp, out);
+  } catch (...) {
+    auto ec = std::error_code{};
+    fs::remove(tmp, ec);
+    throw;
+  }
+}
+
+std::optional<snapshot_file> read_snapshot(fs::path const& file,
+                                           fs::path const& pbf) {
+  auto ec = std::error_code{};
+  if (!fs::is_regular_file(file, ec)) {
+    return std::nullopt;
+  }
+
+  try {
+    auto f = snapshot_file{
+        .mem_ =
+            cista::mmap{file.string().c_str(), cista::mmap::protection::READ},
+        .snapshot_ = nullptr};
+
+    auto size = std::uint64_t{0U};
+    if (f.mem_.size() < sizeof(size)) {
+      return std::nullopt;
+    }
+    std::memcpy(&size, f.mem_.data() + f.mem_.size() - sizeof(size),
+                sizeof(size));
+    if (size != f.mem_.size() - sizeof(size)) {
+      return std::nullopt;  // truncated
+    }
+
+    auto data = std::span{f.mem_.data(), static_cast<std::size_t>(size)};
+    f.snapshot_ = cista::deserialize<snapshot, kMode>(data);
+    if (f.snapshot_->file_size_ != fs::file_size(pbf) ||
+        f.snapshot_->file_mtime_ != mtime(pbf)) {
+      return std::nullopt;
+    }
+    return f;
+  } catch (std::exception const&) {
+    return std::nullopt;
+  }
+}
+
+std::optional<std::size_t> find(vec<std::int64_t> const& ids,
+                                std::int64_t const id) {
+  auto const it = std::lower_bound(ids.begin(), ids.end(), id);
+  if (it == ids.end() || *it != id) {
+    return std::nullopt;
+  }
+  return static_cast<std::size_t>(std::distance(ids.begin(), it));
+}
+
+void way_refs(snapshot const& s,
+              std::size_t const i,
+              std::vector<std::int64_t>& out) {
+  out.clear();
+  auto data = reinterpret_cast<char const*>(s.way_refs_.data());
+  auto const end = data + s.way_ref_offsets_[i + 1U];
+  data += s.way_ref_offsets_[i];
+  auto ref = std::int64_t{0};
+  while (data != end) {
+    ref += protozero::decode_zigzag64(protozero::decode_varint(&data, end));
+    out.push_back(ref);
+  }
+}
+
+}  // namespace osm
@@ -0,0 +1,114 @@
+#include "osm/stats.h"
+
+#include <algorithm>
+#include <bit>
+#include <iterator>
+
+#include "fmt/format.h"
+
+namespace osm {
+
+namespace {
+
+std::uint64_t ns_since(stats::clock::time_point const start) {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(stats::clock::now() -
+                                                           start)
+          .count());
+}
+
+void write_json(std::back_insert_iterator<std::string> out,
+                stats_snapshot const& s) {
+  fmt::format_to(out,
+                 R"({{"elapsed_ns":{},"blobs_read":{},"bytes_read":{},)"
+                 R"("bytes_inflated":{},"inflate_ns":{},"decode_ns":{},)"
+                 R"("callback_ns":{},"nodes":{},"ways":{},"relations":{},)"
+                 R"("producer_stall_ns":{},"consumer_stall_ns":{},)"
+                 R"("queue_depth":{},"max_queue_depth":{},"latency_us_log2":[)",
+                 s.elapsed_ns_, s.blobs_read_, s.bytes_read_,
+                 s.bytes_inflated_, s.inflate_ns_, s.decode_ns_,
+                 s.callback_ns_, s.nodes_, s.ways_, s.relations_,
+                 s.producer_stall_ns_, s.consumer_stall_ns_, s.queue_depth_,
+                 s.max_queue_depth_);
+  for (auto i = 0U; i != kLatencyBuckets; ++i) {
+    fmt::format_to(out, "{}{}", i == 0U ? "" : ",", s.latency_[i]);
+  }
+  fmt::format_to(out, "]}}");
+}
+
+}  // namespace
+
+thread_stats& stats::add_thread() {
+  auto const lock = std::scoped_lock{mutex_};
+  return threads_.emplace_back();
+}
+
+stats_snapshot stats::sample() const {
+  auto s = stats_snapshot{
+      .elapsed_ns_ = ns_since(start_),
+      .queue_depth_ = static_cast<std::uint64_t>(
+          std::max(std::int64_t{0}, queue_depth_.load())),
+      .max_queue_depth_ =
+          static_cast<std::uint64_t>(max_queue_depth_.load())};
+  auto const lock = std::scoped_lock{mutex_};
+  for (auto const& t : threads_) {
+    s.blobs_read_ += t.blobs_read_.get();
+    s.bytes_read_ += t.bytes_read_.get();
+    s.bytes_inflated_ += t.bytes_inflated_.get();
+    s.inflate_ns_ += t.inflate_ns_.get();
+    s.decode_ns_ += t.decode_ns_.get();
+    s.callback_ns_ += t.callback_ns_.get();
+    s.nodes_ += t.nodes_.get();
+    s.ways_ += t.ways_.get();
+    s.relations_ += t.relations_.get();
+    s.producer_stall_ns_ += t.producer_stall_ns_.get();
+    s.consumer_stall_ns_ += t.consumer_stall_ns_.get();
+    for (auto i = 0U; i != kLatencyBuckets; ++i) {
+      s.latency_[i] += t.latency_[i].get();
+    }
+  }
+  return s;
+}
+
+void stats::maybe_sample(bool const force) {
+  auto const now = clock::now();
+  if (!force && now - last_sample_ < interval_) {
+    return;
+  }
+  last_sample_ = now;
+  auto s = sample();
+  auto const lock = std::scoped_lock{mutex_};
+  samples_.emplace_back(s);
+}
+
+std::string stats::to_json() const {
+  auto json = std::string{};
+  auto out = std::back_inserter(json);
+  fmt::format_to(out, R"({{"total":)");
+  write_json(out, sample());
+  fmt::format_to(out, R"(,"samples":[)");
+  auto const lock = std::scoped_lock{mutex_};
+  for (auto i = 0U; i != samples_.size(); ++i) {
+    if (i != 0U) {
+      json.push_back(',');
+    }
+    write_json(out, samples_[i]);
+  }
+  fmt::format_to(out, "]}}");
+  return json;
+}
+
+namespace detail {
+
+void record_latency(thread_stats* s, stats::clock::time_point const start) {
+  if (s != nullptr) {
+    auto const us = ns_since(start) / 1000U;
+    auto const bucket = std::min(static_cast<unsigned>(std::bit_width(us)),
+                                 kLatencyBuckets - 1U);
+    s->latency_[bucket].add(1U);
+  }
+}
+
+}  // namespace detail
+
+}  // namespace osm
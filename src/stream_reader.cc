@@ -0,0 +1,239 @@
+#include "osm/stream_reader.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+
+#include "utl/verify.h"
+
+namespace osm {
+
+// Free list of blob buffers, shared with the deleters of buf::owner_ (bufs
+// may outlive the reader).
+struct stream_reader::buffers {
+  std::unique_ptr<std::string> get() {
+    auto const lock = std::scoped_lock{mutex_};
+    if (free_.empty()) {
+      return std::make_unique<std::string>();
+    }
+    auto b = std::move(free_.back());
+    free_.pop_back();
+    return b;
+  }
+
+  void put(std::string* b) {
+    auto const lock = std::scoped_lock{mutex_};
+    free_.emplace_back(b);
+  }
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<std::string>> free_;
+};
+
+namespace {
+
+// Waits until `fd` is readable (or closed). Returns false if the wakeup
+// pipe was written to first.
+bool wait_readable(int const fd, int const wakeup) {
+  auto fds = std::array<pollfd, 2>{pollfd{.fd = fd, .events = POLLIN},
+                                   pollfd{.fd = wakeup, .events = POLLIN}};
+  while (true) {
+    auto const r = ::poll(fds.data(), fds.size(), -1);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    utl::verify(r > 0, "poll failed: {}", std::strerror(errno));
+    return fds[1].revents == 0;
+  }
+}
+
+// Reads exactly n bytes at `offset` (pread) or from the current position
+// (waiting on `wakeup` too, if set). Returns false on end of file before the
+// first byte and if woken up.
+bool read_fully(int const fd,
+                bool const seekable,
+                int const wakeup,
+                std::size_t const offset,
+                char* out,
+                std::size_t const n) {
+  auto done = std::size_t{0U};
+  while (done != n) {
+    if (wakeup != -1 && !wait_readable(fd, wakeup)) {
+      return false;
+    }
+    auto const r =
+        seekable ? ::pread(fd, out + done, n - done,
+                           static_cast<off_t>(offset + done))
+                 : ::read(fd, out + done, n - done);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    utl::verify(r >= 0, "read failed: {}", std::strerror(errno));
+    if (r == 0) {
+      utl::verify(done == 0U, "unexpected end of file: {} of {} bytes", done,
+                  n);
+      return false;
+    }
+    done += static_cast<std::size_t>(r);
+  }
+  return true;
+}
+
+int open_input(char const* path) {
+  if (std::string_view{path} == "-") {
+    return STDIN_FILENO;
+  }
+  auto const fd = ::open(path, O_RDONLY);
+  utl::verify(fd != -1, "could not open {}: {}", path, std::strerror(errno));
+  return fd;
+}
+
+}  // namespace
+
+stream_reader::stream_reader(int const fd, stream_config const& config)
+    : fd_{fd},
+      owns_fd_{false},
+      seekable_{false},
+      config_{config},
+      buffers_{std::make_shared<buffers>()} {
+  struct stat st {};
+  if (::fstat(fd_, &st) == 0 && S_ISREG(st.st_mode)) {
+    seekable_ = true;
+    size_ = static_cast<std::size_t>(st.st_size);
+    ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+  } else {
+    utl::verify(::pipe(wakeup_.data()) == 0, "pipe failed: {}",
+                std::strerror(errno));
+  }
+  thread_ = std::thread{[this]() { run(); }};
+}
+
+stream_reader::stream_reader(char const* path, stream_config const& config)
+    : stream_reader{open_input(path), config} {
+  owns_fd_ = fd_ != STDIN_FILENO;
+}
+
+stream_reader::~stream_reader() {
+  {
+    auto const lock = std::scoped_lock{mutex_};
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (wakeup_[1] != -1) {
+    auto const x = char{0};
+    [[maybe_unused]] auto const n = ::write(wakeup_[1], &x, 1U);
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  for (auto const fd : wakeup_) {
+    if (fd != -1) {
+      ::close(fd);
+    }
+  }
+  if (owns_fd_) {
+    ::close(fd_);
+  }
+}
+
+std::optional<buf> stream_reader::read() {
+  auto lock = std::unique_lock{mutex_};
+  cv_.wait(lock, [&]() { return !queue_.empty() || done_; });
+  if (queue_.empty()) {
+    if (error_ != nullptr) {
+      std::rethrow_exception(error_);
+    }
+    return std::nullopt;
+  }
+  auto [b, end] = std::move(queue_.front());
+  queue_.pop_front();
+  lock.unlock();
+  cv_.notify_all();
+
+  offset_ = end;
+  return std::move(b);
+}
+
+void stream_reader::run() {
+  auto const push = [&](buf&& b, std::size_t const end) {
+    auto lock = std::unique_lock{mutex_};
+    cv_.wait(lock, [&]() {
+      return stop_ ||
+             queue_.size() < std::max(config_.read_ahead_, std::size_t{1U});
+    });
+    if (stop_) {
+      return false;
+    }
+    queue_.emplace_back(std::move(b), end);
+    lock.unlock();
+    cv_.notify_all();
+    return true;
+  };
+
+  // Woken up by the destructor (false) within a blob: the error is not
+  // seen by anyone.
+  auto const read_at = [&](std::size_t const offset, char* out,
+                           std::size_t const n) {
+    return read_fully(fd_, seekable_, wakeup_[0], offset, out, n);
+  };
+
+  try {
+    auto header = std::string{};
+    auto offset = std::size_t{0U};
+    for (auto idx = std::size_t{0U};; ++idx) {
+      auto size_buf = std::array<char, sizeof(std::uint32_t)>{};
+      if (!read_at(offset, size_buf.data(), size_buf.size())) {
+        break;
+      }
+      auto const size = parse_blob_header_size({size_buf.data(), 4U});
+      header.resize(size);
+      utl::verify(read_at(offset + 4U, header.data(), size),
+                  "unexpected end of file");
+      auto const info = parse_blob_header(header);
+      utl::verify(info.data_size_ <= kMaxBlobSize, "blob size {} > {}",
+                  info.data_size_, kMaxBlobSize);
+
+      auto data = buffers_->get();
+      data->resize(info.data_size_);
+      utl::verify(read_at(offset + 4U + size, data->data(), info.data_size_),
+                  "unexpected end of file");
+
+      auto b = parse_blob(info.type_, idx, *data);
+      b.offset_ = offset;
+      b.owner_ = std::shared_ptr<std::string const>{
+          data.release(),
+          [bufs = buffers_](std::string const* x) {
+            bufs->put(const_cast<std::string*>(x));
+          }};
+
+      if (seekable_ && config_.drop_cache_) {
+        ::posix_fadvise(fd_, static_cast<off_t>(offset),
+                        static_cast<off_t>(4U + size + info.data_size_),
+                        POSIX_FADV_DONTNEED);
+      }
+      offset += 4U + size + info.data_size_;
+
+      if (!push(std::move(b), offset)) {
+        break;
+      }
+    }
+  } catch (...) {
+    auto const lock = std::scoped_lock{mutex_};
+    error_ = std::current_exception();
+  }
+
+  {
+    auto const lock = std::scoped_lock{mutex_};
+    done_ = true;
+  }
+  cv_.notify_all();
+}
+
+}  // namespace osm
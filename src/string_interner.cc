@@ -0,0 +1,173 @@
+#include "osm/string_interner.h"
+
+#include <cstring>
+#include <functional>
+#include <limits>
+
+#include "utl/verify.h"
+
+namespace osm {
+
+namespace {
+
+// Unique (IDs = positions).
+constexpr std::string_view const kCommonStrings[] = {
+    // keys
+    "highway", "name", "building", "addr:housenumber", "addr:street",
+    "addr:city", "addr:postcode", "addr:country", "source", "natural",
+    "landuse", "surface", "waterway", "power", "wall", "oneway", "amenity",
+    "ref", "maxspeed", "barrier", "lanes", "layer", "service", "access",
+    "leisure", "tracktype", "bridge", "foot", "bicycle", "type", "route",
+    "railway", "shop", "height", "man_made", "tunnel", "place", "operator",
+    "boundary", "admin_level", "water", "sport", "tourism", "website",
+    "crossing", "entrance", "lit", "note", "parking", "religion",
+    "public_transport", "network", "smoothness", "width", "level",
+    "wikidata", "wikipedia", "name:en", "opening_hours", "phone",
+    // values ("service", "water": see keys)
+    "yes", "no", "residential", "track", "unclassified", "footway", "path",
+    "tertiary", "secondary", "primary", "trunk", "motorway", "living_street",
+    "house", "detached", "garage", "roof", "asphalt", "unpaved", "paved",
+    "gravel", "ground", "grade1", "grade2", "grass", "tree", "wood", "forest",
+    "farmland", "meadow", "stream", "ditch", "multipolygon",
+    "administrative"};
+
+std::uint64_t hash(std::string_view s) {
+  // Never 0: the upper slot half 0 marks empty slots.
+  return std::hash<std::string_view>{}(s) | (std::uint64_t{1U} << 63U);
+}
+
+// Slot: upper 32 bits hash, lower 32 bits ID.
+constexpr std::uint64_t make_slot(std::uint64_t const h, std::uint32_t id) {
+  return (h & 0xFFFF'FFFF'0000'0000ULL) | id;
+}
+
+}  // namespace
+
+struct string_interner::table {
+  explicit table(std::size_t const capacity)
+      : mask_{capacity - 1U},
+        slots_{std::make_unique<std::atomic_uint64_t[]>(capacity)} {}
+
+  std::size_t capacity() const { return mask_ + 1U; }
+
+  std::size_t mask_;
+  std::unique_ptr<std::atomic_uint64_t[]> slots_;
+  std::uint32_t size_{0U};  // written under mutex_ only
+};
+
+std::span<std::string_view const> string_interner::common_strings() {
+  return kCommonStrings;
+}
+
+string_interner::string_interner(bool const seed)
+    : table_{nullptr},
+      chunks_{std::make_unique<std::atomic<std::string_view*>[]>(kMaxChunks)} {
+  tables_.emplace_back(std::make_unique<table>(1U << 12U));
+  table_ = tables_.back().get();
+  if (seed) {
+    for (auto const s : kCommonStrings) {
+      intern(s);
+    }
+  }
+}
+
+string_interner::~string_interner() {
+  for (auto i = 0U; i != kMaxChunks; ++i) {
+    delete[] chunks_[i].load();
+  }
+}
+
+std::optional<std::uint32_t> string_interner::find(
+    table const& t, std::string_view s, std::uint64_t const h) const {
+  for (auto i = h & t.mask_;; i = (i + 1U) & t.mask_) {
+    auto const slot = t.slots_[i].load(std::memory_order_acquire);
+    if (slot == 0U) {
+      return std::nullopt;
+    }
+    auto const id = static_cast<std::uint32_t>(slot);
+    if (slot == make_slot(h, id) && get(id) == s) {
+      return id;
+    }
+  }
+}
+
+std::optional<std::uint32_t> string_interner::find(std::string_view s) const {
+  return find(*table_.load(std::memory_order_acquire), s, hash(s));
+}
+
+std::uint32_t string_interner::intern(std::string_view s) {
+  auto const h = hash(s);
+  if (auto const id = find(*table_.load(std::memory_order_acquire), s, h);
+      id.has_value()) {
+    return *id;
+  }
+
+  auto const lock = std::scoped_lock{mutex_};
+  auto t = table_.load(std::memory_order_relaxed);
+  if (auto const id = find(*t, s, h); id.has_value()) {
+    return *id;  // inserted concurrently
+  }
+
+  auto const id = size_.load(std::memory_order_relaxed);
+  utl::verify(id != std::numeric_limits<std::uint32_t>::max(),
+              "string_interner: too many strings");
+
+  // Publish the string before the slot referencing it.
+  auto& chunk = chunks_[id >> kChunkBits];
+  if (chunk.load(std::memory_order_relaxed) == nullptr) {
+    chunk.store(new std::string_view[kChunkSize], std::memory_order_release);
+  }
+  chunk.load(std::memory_order_relaxed)[id & (kChunkSize - 1U)] = store(s);
+  size_.store(id + 1U, std::memory_order_release);
+
+  if (2U * (t->size_ + 1U) > t->capacity()) {
+    tables_.emplace_back(std::make_unique<table>(2U * t->capacity()));
+    auto const grown = tables_.back().get();
+    for (auto i = std::uint32_t{0U}; i != id; ++i) {
+      insert(*grown, i, hash(get(i)));
+    }
+    table_.store(grown, std::memory_order_release);
+    t = grown;
+  }
+  insert(*t, id, h);
+  return id;
+}
+
+std::string_view string_interner::get(std::uint32_t const id) const {
+  return chunks_[id >> kChunkBits].load(
+      std::memory_order_acquire)[id & (kChunkSize - 1U)];
+}
+
+void string_interner::insert(table& t,
+                             std::uint32_t const id,
+                             std::uint64_t const h) {
+  auto i = h & t.mask_;
+  while (t.slots_[i].load(std::memory_order_relaxed) != 0U) {
+    i = (i + 1U) & t.mask_;
+  }
+  t.slots_[i].store(make_slot(h, id), std::memory_order_release);
+  ++t.size_;
+}
+
+std::string_view string_interner::store(std::string_view s) {
+  constexpr auto const kBlockSize = std::size_t{1U} << 20U;
+  if (s.empty()) {
+    return {};  // arena_used_ may point past the end of a large string
+  }
+  if (s.size() > kBlockSize / 4U) {
+    auto& b = arena_.emplace_back(std::make_unique<char[]>(s.size()));
+    std::memcpy(b.get(), s.data(), s.size());
+    arena_used_ = kBlockSize;  // large strings end the current block
+    return {b.get(), s.size()};
+  }
+  if (arena_.empty() || arena_used_ + s.size() > kBlockSize) {
+    arena_.emplace_back(std::make_unique<char[]>(kBlockSize));
+    arena_used_ = 0U;
+  }
+  auto const data = arena_.back().get() + arena_used_;
+  std::memcpy(data, s.data(), s.size());
+  arena_used_ += s.size();
+  return {data, s.size()};
+}
+
+}  // namespace osm
@@ -0,0 +1,22 @@
+#include "osm/temp_path.h"
+
+#include <random>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "fmt/format.h"
+
+namespace osm {
+
+std::filesystem::path temp_path(std::filesystem::path const& out) {
+  auto p = out;
+  p += fmt::format(".{}.{:08x}.tmp", getpid(), std::random_device{}());
+  return p;
+}
+
+}  // namespace osm
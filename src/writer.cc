@@ -0,0 +1,381 @@
+#include "osm/writer.h"
+
+#include <exception>
+#include <fstream>
+
+#include "boost/fiber/buffered_channel.hpp"
+
+#include "protozero/pbf_builder.hpp"
+
+#include "osm/compress.h"
+#include "osm/header.h"
+#include "osm/parallel_reader.h"
+#include "osm/reorder_buffer.h"
+
+namespace bf = boost::fibers;
+
+namespace osm {
+
+namespace {
+
+// Blocks stay well below kMaxUncompressedBlobSize.
+constexpr auto const kMaxBlockBytes = std::size_t{16U} << 20U;
+
+template <typename Tag>
+constexpr protozero::pbf_tag_type tag(Tag const t) {
+  return static_cast<protozero::pbf_tag_type>(t);
+}
+
+// Delta coded (sint64) values.
+template <typename Builder, typename Tag, typename Values>
+void add_deltas(Builder& b, Tag const t, Values&& values) {
+  auto f = protozero::packed_field_sint64{b, tag(t)};
+  auto prev = std::int64_t{0};
+  for (auto const x : values) {
+    f.add_element(x - prev);
+    prev = x;
+  }
+}
+
+template <typename Builder, typename Tag>
+void add_tags(Builder& b,
+              Tag const keys,
+              Tag const values,
+              std::span<std::uint32_t const> kv) {
+  for (auto const& [t, first] :
+       {std::pair{keys, 0U}, std::pair{values, 1U}}) {
+    auto f = protozero::packed_field_uint32{b, tag(t)};
+    for (auto i = std::size_t{first}; i < kv.size(); i += 2U) {
+      f.add_element(kv[i]);
+    }
+  }
+}
+
+auto lats(std::span<location const> l) {
+  return l | std::views::transform([](location const x) {
+           return std::int64_t{x.lat_};
+         });
+}
+
+auto lons(std::span<location const> l) {
+  return l | std::views::transform([](location const x) {
+           return std::int64_t{x.lon_};
+         });
+}
+
+// Granularity 100 nanodegrees and offset 0 (defaults): fixed point
+// coordinates are written as they are.
+void encode_dense_nodes(protozero::pbf_builder<primitive_group>& group,
+                        detail::block_builder const& b) {
+  auto dense = protozero::pbf_builder<dense_nodes>{
+      group, primitive_group::optional_DenseNodes_dense};
+  add_deltas(dense, dense_nodes::packed_sint64_id, b.ids_);
+  add_deltas(dense, dense_nodes::packed_sint64_lat, lats(b.locations_));
+  add_deltas(dense, dense_nodes::packed_sint64_lon, lons(b.locations_));
+
+  // keys_vals: k v k v ... 0 per node, omitted if no node has tags.
+  if (!b.tags_.empty()) {
+    auto f = protozero::packed_field_int32{
+        dense, tag(dense_nodes::packed_int32_keys_vals)};
+    for (auto i = std::size_t{0U}; i != b.size(); ++i) {
+      for (auto const s : b.tags(i)) {
+        f.add_element(static_cast<std::int32_t>(s));
+      }
+      f.add_element(0);
+    }
+  }
+}
+
+void encode_ways(protozero::pbf_builder<primitive_group>& group,
+                 detail::block_builder const& b,
+                 bool const locations_on_ways) {
+  for (auto i = std::size_t{0U}; i != b.size(); ++i) {
+    auto w =
+        protozero::pbf_builder<way>{group, primitive_group::repeated_Way_ways};
+    w.add_int64(way::required_int64_id, b.ids_[i]);
+    add_tags(w, way::packed_uint32_keys, way::packed_uint32_vals, b.tags(i));
+    add_deltas(w, way::packed_sint64_refs, b.refs(i));
+    if (locations_on_ways) {
+      auto const l = std::span{b.locations_}.subspan(b.ref_offsets_[i],
+                                                     b.refs(i).size());
+      add_deltas(w, way::packed_sint64_lat, lats(l));
+      add_deltas(w, way::packed_sint64_lon, lons(l));
+    }
+  }
+}
+
+void encode_relations(protozero::pbf_builder<primitive_group>& group,
+                      detail::block_builder const& b) {
+  for (auto i = std::size_t{0U}; i != b.size(); ++i) {
+    auto r = protozero::pbf_builder<relation>{
+        group, primitive_group::repeated_Relation_relations};
+    r.add_int64(relation::required_int64_id, b.ids_[i]);
+    add_tags(r, relation::packed_uint32_keys, relation::packed_uint32_vals,
+             b.tags(i));
+
+    auto const first = b.ref_offsets_[i];
+    auto const n = b.refs(i).size();
+    {
+      auto f = protozero::packed_field_int32{
+          r, tag(relation::packed_int32_roles_sid)};
+      for (auto const role : std::span{b.roles_}.subspan(first, n)) {
+        f.add_element(static_cast<std::int32_t>(role));
+      }
+    }
+    add_deltas(r, relation::packed_sint64_memids, b.refs(i));
+    {
+      auto f = protozero::packed_field_int32{
+          r, tag(relation::packed_MemberType_types)};
+      for (auto const type : std::span{b.types_}.subspan(first, n)) {
+        f.add_element(static_cast<std::int32_t>(type));
+      }
+    }
+  }
+}
+
+std::string encode_header(writer_config const& c) {
+  auto block = std::string{};
+  auto pbf = protozero::pbf_builder<header_block>{block};
+  if (c.bbox_.has_value()) {
+    auto const nano = [](std::int32_t const x) {
+      return std::int64_t{x} * kNanoPerFixed;
+    };
+    auto bbox = protozero::pbf_builder<header_bbox>{
+        pbf, header_block::optional_HeaderBBox_bbox};
+    bbox.add_sint64(header_bbox::required_sint64_left,
+                    nano(c.bbox_->min_.lon_));
+    bbox.add_sint64(header_bbox::required_sint64_right,
+                    nano(c.bbox_->max_.lon_));
+    bbox.add_sint64(header_bbox::required_sint64_top,
+                    nano(c.bbox_->max_.lat_));
+    bbox.add_sint64(header_bbox::required_sint64_bottom,
+                    nano(c.bbox_->min_.lat_));
+  }
+  for (auto const f : {"OsmSchema-V0.6", "DenseNodes"}) {
+    pbf.add_string(header_block::repeated_string_required_features, f);
+  }
+  auto const add_optional = [&](std::string_view const f) {
+    pbf.add_string(header_block::repeated_string_optional_features, f.data(),
+                   f.size());
+  };
+  if (c.sorted_) {
+    add_optional(kSortTypeThenId);
+  }
+  if (c.locations_on_ways_) {
+    add_optional(kLocationsOnWays);
+  }
+  pbf.add_string(header_block::optional_string_writingprogram,
+                 c.writing_program_);
+  if (c.replication_timestamp_ != 0) {
+    pbf.add_int64(header_block::optional_int64_osmosis_replication_timestamp,
+                  c.replication_timestamp_);
+  }
+  return block;
+}
+
+}  // namespace
+
+namespace detail {
+
+std::string encode(block_builder const& b, bool const locations_on_ways) {
+  auto block = std::string{};
+  auto pb = protozero::pbf_builder<primitive_block>{block};
+  {
+    auto st = protozero::pbf_builder<string_table>{
+        pb, primitive_block::required_StringTable_stringtable};
+    for (auto const& s : b.strings_) {
+      st.add_bytes(string_table::repeated_bytes_s, s);
+    }
+  }
+  {
+    auto group = protozero::pbf_builder<primitive_group>{
+        pb, primitive_block::repeated_PrimitiveGroup_primitivegroup};
+    switch (b.kind_) {
+      case entity_kind::kNodes: encode_dense_nodes(group, b); break;
+      case entity_kind::kWays: encode_ways(group, b, locations_on_ways); break;
+      case entity_kind::kRelations: encode_relations(group, b); break;
+      default: throw utl::fail("writer: block without entity kind");
+    }
+  }
+  return block;
+}
+
+std::string encode_blob(std::string_view const type,
+                        std::string_view const block,
+                        compression const c,
+                        int const level) {
+  utl::verify(block.size() <= kMaxUncompressedBlobSize,
+              "writer: block size {} > {}", block.size(),
+              kMaxUncompressedBlobSize);
+
+  auto blob = std::string{};
+  {
+    auto pb = protozero::pbf_builder<osm::blob>{blob};
+    switch (c) {
+      case compression::kRaw:
+        pb.add_bytes(blob::optional_bytes_raw, block.data(), block.size());
+        break;
+
+      case compression::kZlib:
+      case compression::kZstd:
+        pb.add_int32(blob::optional_int32_raw_size,
+                     static_cast<std::int32_t>(block.size()));
+        pb.add_bytes(c == compression::kZlib ? blob::optional_bytes_zlib_data
+                                             : blob::optional_bytes_zstd_data,
+                     compress(c, block, level));
+        break;
+
+      default:
+        throw utl::fail("writer: unsupported compression {}",
+                        static_cast<int>(c));
+    }
+  }
+
+  auto header = std::string{};
+  {
+    auto h = protozero::pbf_builder<blob_header>{header};
+    h.add_string(blob_header::required_string_type, type.data(),
+                 type.size());
+    h.add_int32(blob_header::required_int32_datasize,
+                static_cast<std::int32_t>(blob.size()));
+  }
+
+  auto const size = static_cast<std::uint32_t>(header.size());
+  auto out = std::string{};
+  out.reserve(4U + header.size() + blob.size());
+  out += {static_cast<char>(size >> 24U), static_cast<char>(size >> 16U),
+          static_cast<char>(size >> 8U), static_cast<char>(size)};
+  out += header;
+  out += blob;
+  return out;
+}
+
+}  // namespace detail
+
+struct writer::impl {
+  struct job {
+    std::size_t seq_;
+    detail::block_builder block_;
+  };
+
+  impl(std::filesystem::path const& path, writer_config const& c)
+      : path_{path},
+        ch_{detail::channel_size(c.queue_size_)},
+        reorder_{c.reorder_window_} {
+    // Encoded first: an unsupported compression fails before creating the
+    // file.
+    auto const header = detail::encode_blob("OSMHeader", encode_header(c),
+                                            c.compression_, c.level_);
+    out_.open(path, std::ios::binary | std::ios::trunc);
+    utl::verify(out_.good(), "could not open {}", path.string());
+    write(header);
+
+    auto const n_threads = c.n_threads_ == 0U ? 1U : c.n_threads_;
+    workers_.reserve(n_threads);
+    for (auto i = 0U; i != n_threads; ++i) {
+      workers_.emplace_back([this, c]() {
+        try {
+          auto j = job{};
+          while (ch_.pop(j) == bf::channel_op_status::success) {
+            auto blob =
+                detail::encode_blob("OSMData",
+                                    detail::encode(j.block_,
+                                                   c.locations_on_ways_),
+                                    c.compression_, c.level_);
+            reorder_.complete(j.seq_, std::move(blob),
+                              [&](std::string&& x) { write(x); });
+          }
+        } catch (...) {
+          stop();
+        }
+      });
+    }
+  }
+
+  void write(std::string_view s) {
+    out_.write(s.data(), static_cast<std::streamsize>(s.size()));
+    utl::verify(out_.good(), "could not write {}", path_.string());
+  }
+
+  void stop() {
+    error_.set(std::current_exception());
+    ch_.close();
+    reorder_.close();
+  }
+
+  std::filesystem::path path_;
+  std::ofstream out_;
+  bf::buffered_channel<job> ch_;
+  reorder_buffer<std::string> reorder_;
+  detail::first_error error_;
+  std::size_t next_seq_{0U};
+  std::vector<std::thread> workers_;
+};
+
+writer::writer(std::filesystem::path const& path, writer_config const& c)
+    : config_{c}, impl_{std::make_unique<impl>(path, c)} {}
+
+writer::~writer() {
+  try {
+    finish();
+  } catch (...) {
+  }
+}
+
+void writer::begin(entity_kind const kind, std::int64_t const id) {
+  utl::verify(impl_ != nullptr, "writer: add after finish()");
+  if (config_.sorted_) {
+    utl::verify(kind > last_kind_ || (kind == last_kind_ && id > last_id_),
+                "writer: entity {} (kind {}) after {} (kind {}), not "
+                "Sort.Type_then_ID",
+                id, static_cast<int>(kind), last_id_,
+                static_cast<int>(last_kind_));
+  }
+  last_kind_ = kind;
+  last_id_ = id;
+
+  if (block_.kind_ != kind || block_.size() >= config_.max_entities_ ||
+      block_.max_bytes() >= kMaxBlockBytes) {
+    flush();
+  }
+  block_.kind_ = kind;
+  block_.ids_.push_back(id);
+}
+
+void writer::flush() {
+  if (block_.size() == 0U) {
+    return;
+  }
+  auto& x = *impl_;
+  auto const seq = x.next_seq_++;
+  if (!x.reorder_.acquire(seq) ||
+      x.ch_.push(impl::job{seq, std::move(block_)}) !=
+          bf::channel_op_status::success) {
+    x.error_.rethrow();
+    throw utl::fail("writer: closed");
+  }
+  block_ = detail::block_builder{};
+}
+
+void writer::finish() {
+  if (impl_ == nullptr) {
+    return;
+  }
+  try {
+    flush();
+  } catch (...) {
+    impl_->stop();
+  }
+
+  auto const x = std::move(impl_);
+  x->ch_.close();
+  for (auto& w : x->workers_) {
+    w.join();
+  }
+  x->error_.rethrow();
+
+  x->out_.close();
+  utl::verify(!x->out_.fail(), "could not write {}", x->path_.string());
+}
+
+}  // namespace osm
@@ -1,18 +1,118 @@
 #include "osm/osm.h"
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <thread>
+
+#include "zlib.h"
+
 #include "fmt/ranges.h"
 
+#include "protozero/pbf_builder.hpp"
+
 #include "gtest/gtest.h"
 
 #include "utl/progress_tracker.h"
 
+#include "osm/area.h"
+#include "osm/block_cache.h"
+#include "osm/block_index.h"
+#include "osm/buffer_pool.h"
+#include "osm/bulk_varint.h"
+#include "osm/compress.h"
 #include "osm/decoder.h"
-#include "osm/inflate.h"
-#include "osm/memory.h"
+#include "osm/decompress.h"
+#include "osm/header.h"
+#include "osm/location_store.h"
+#include "osm/lookup.h"
+#include "osm/memory_usage.h"
+#include "osm/parallel_reader.h"
+#include "osm/peek.h"
+#include "osm/reorder_buffer.h"
+#include "osm/shard.h"
+#include "osm/snapshot.h"
+#include "osm/stats.h"
+#include "osm/stream.h"
+#include "osm/stream_reader.h"
+#include "osm/string_interner.h"
+#include "osm/tag_filter.h"
+#include "osm/tags.h"
+#include "osm/temp_path.h"
+#include "osm/writer.h"
 
-#include "boost/fiber/all.hpp"
+namespace {
+
+using test_tags = std::vector<std::pair<std::string, std::string>>;
+
+// Appends a blob with raw `data` to `file`, returns the blob's offset.
+// `data_size` overrides the size given in the blob header.
+std::size_t add_blob(std::string& file,
+                     char const* type,
+                     std::string const& data,
+                     std::optional<std::int32_t> data_size = std::nullopt) {
+  auto blob = std::string{};
+  protozero::pbf_builder<osm::blob>{blob}.add_bytes(
+      osm::blob::optional_bytes_raw, data);
+  auto header = std::string{};
+  auto h = protozero::pbf_builder<osm::blob_header>{header};
+  h.add_string(osm::blob_header::required_string_type, type);
+  h.add_int32(osm::blob_header::required_int32_datasize,
+              data_size.value_or(static_cast<std::int32_t>(blob.size())));
+
+  auto const start = file.size();
+  auto const size = static_cast<std::uint32_t>(header.size());
+  file += {static_cast<char>(size >> 24U), static_cast<char>(size >> 16U),
+           static_cast<char>(size >> 8U), static_cast<char>(size)};
+  file += header;
+  file += blob;
+  return start;
+}
 
-namespace bf = boost::fibers;
+// Sorted test file in the temp directory: nodes 1..n at (i, -i) in 1e-7
+// degrees with name=i, ways 1..n/2 over nodes (2i - 1, 2i) and relations
+// 1..n/10 with way i as outer member.
+std::filesystem::path write_test_file(std::string const& name,
+                                      int const n = 100,
+                                      osm::writer_config c = {
+                                          .n_threads_ = 2U,
+                                          .max_entities_ = 8U}) {
+  auto const path = std::filesystem::temp_directory_path() / name;
+  auto w = osm::writer{path, c};
+  for (auto i = 1; i <= n; ++i) {
+    w.add_node(i, osm::location{i, -i}, {{"name", std::to_string(i)}});
+  }
+  for (auto i = 1; i <= n / 2; ++i) {
+    w.add_way(i, {2 * i - 1, 2 * i}, {{"highway", "residential"}});
+  }
+  for (auto i = 1; i <= n / 10; ++i) {
+    w.add_relation(i, {{i, "outer", osm::kWay}}, {{"type", "multipolygon"}});
+  }
+  w.finish();
+  return path;
+}
+
+// Shoelace formula, x = lng: positive for counterclockwise rings.
+double signed_area(std::vector<geo::latlng> const& ring) {
+  auto a = 0.0;
+  for (auto i = std::size_t{1U}; i < ring.size(); ++i) {
+    a += ring[i - 1U].lng() * ring[i].lat() -
+         ring[i].lng() * ring[i - 1U].lat();
+  }
+  return a / 2.0;
+}
+
+}  // namespace
 
 TEST(osm, varint) {
   auto buf = std::array<char, protozero::max_varint_length * 10U>{};
@@ -50,81 +150,1449 @@ TEST(osm, varint) {
 
   ++it;
   EXPECT_EQ(it, v.end());
+
+  // Advancing without dereferencing (e.g. std::views::chunk).
+  EXPECT_EQ(456, *std::next(v.begin()));
+  EXPECT_EQ(789, *std::next(v.begin(), 2));
+  EXPECT_EQ(v.end(), std::next(v.begin(), 3));
 }
 
-TEST(a, b) {
-  auto r = osm::raw_reader{
-      .file_ = cista::mmap{"/home/felix/Downloads/germany-latest.osm.pbf",
-                           cista::mmap::protection::READ}};
+TEST(osm, parallel_read) {
+  auto const path = write_test_file("osm_parallel_read_test.osm.pbf");
 
-  auto bars = utl::global_progress_bars{false};
-  auto pt = utl::activate_progress_tracker("parse");
-  pt->in_high(r.rest_.size());
+  // Queue sizes that are no power of two are rounded up.
+  for (auto const queue_size : {0U, 3U, 64U}) {
+    auto n_nodes = std::atomic_int{0};
+    auto n_ways = std::atomic_int{0};
+    auto n_rels = std::atomic_int{0};
+    auto id_sum = std::atomic_int64_t{0};
+    osm::read(
+        path.string().c_str(), {.n_threads_ = 3U, .queue_size_ = queue_size},
+        [&](std::int64_t const id, geo::latlng const&, auto&&) {
+          ++n_nodes;
+          id_sum += id;
+        },
+        [&](std::int64_t, auto&&, auto&&) { ++n_ways; },
+        [&](std::int64_t, auto&&, auto&&) { ++n_rels; });
+    EXPECT_EQ(100, n_nodes);
+    EXPECT_EQ(50, n_ways);
+    EXPECT_EQ(10, n_rels);
+    EXPECT_EQ(5050, id_sum);
+  }
 
-  auto const n_threads = std::thread::hardware_concurrency();
+  // The first callback exception stops all workers and is rethrown. Every
+  // node block from the third on throws: each worker takes at most one of
+  // them, the way blocks behind the 13 node blocks are never reached.
+  auto n_ways = std::atomic_int{0};
+  EXPECT_THROW(osm::read(
+                   path.string().c_str(), {.n_threads_ = 4U, .queue_size_ = 2U},
+                   [&](std::int64_t const id, geo::latlng const&, auto&&) {
+                     if (id >= 20) {
+                       throw std::runtime_error{"node >= 20"};
+                     }
+                   },
+                   [&](std::int64_t, auto&&, auto&&) { ++n_ways; },
+                   [](std::int64_t, auto&&, auto&&) {}),
+               std::runtime_error);
+  EXPECT_EQ(0, n_ways);
 
-  auto n_nodes = std::atomic_uint64_t{0U};
-  auto n_ways = std::atomic_uint64_t{0U};
-  auto n_rels = std::atomic_uint64_t{0U};
+  // Reader errors are rethrown as well.
+  auto r = osm::raw_reader{.file_ = cista::mmap{
+                               path.string().c_str(),
+                               cista::mmap::protection::READ}};
+  r.rest_ = r.rest_.substr(0U, r.rest_.size() - 3U);  // truncated last blob
+  EXPECT_ANY_THROW(osm::read(
+      r, {.n_threads_ = 2U}, [](std::int64_t, geo::latlng const&, auto&&) {},
+      [](std::int64_t, auto&&, auto&&) {},
+      [](std::int64_t, auto&&, auto&&) {}));
 
-  auto print_mtx = std::mutex{};
+  std::filesystem::remove(path);
+}
+
+TEST(osm, reorder_buffer) {
+  auto r = osm::reorder_buffer<int>{4U};
+  auto out = std::vector<int>{};
+  auto const consume = [&](int const x) { out.push_back(x); };
 
-  auto pool = std::vector<std::thread>{n_threads};
-  auto fin = std::atomic_bool{false};
-  auto fin_cv = bf::condition_variable_any{};
-  auto fin_mutex = std::mutex{};
+  // Released in sequence order, skipped sequence numbers are not consumed.
+  for (auto seq = 0U; seq != 4U; ++seq) {
+    EXPECT_TRUE(r.acquire(seq));
+  }
+  r.complete(2U, 2, consume);
+  r.complete(1U, std::nullopt, consume);
+  EXPECT_TRUE(out.empty());
+  r.complete(0U, 0, consume);
+  EXPECT_EQ((std::vector{0, 2}), out);
+  EXPECT_EQ(3U, r.next());
 
-  auto ch = bf::buffered_channel<osm::buf>{64U};
-  for (auto i = 0U; i != n_threads; ++i) {
-    bf::fiber([&]() {
-      auto decompressor = osm::inflate{};
-      auto out = std::string{};
-      auto strings = std::vector<std::string_view>{};
+  // acquire() blocks until the sequence number fits the window [3, 7).
+  EXPECT_TRUE(r.acquire(6U));
+  auto acquired = std::atomic_bool{false};
+  auto waiting = std::thread{[&]() {
+    EXPECT_TRUE(r.acquire(7U));
+    acquired = true;
+  }};
+  std::this_thread::sleep_for(std::chrono::milliseconds{20});
+  EXPECT_FALSE(acquired);
+  r.complete(3U, 3, consume);
+  waiting.join();
+  EXPECT_TRUE(acquired);
 
-      for (auto const& b : ch) {
-        out.resize(b.raw_size_);
-        decompressor.decompress(b.compressed_, out);
+  // A throwing consumer leaves the buffer usable.
+  EXPECT_THROW(
+      r.complete(4U, 4, [](int) { throw std::runtime_error{"consume"}; }),
+      std::runtime_error);
+  r.complete(5U, 5, consume);
+  EXPECT_EQ((std::vector{0, 2, 3, 5}), out);
 
+  // close() wakes blocked acquire() calls and stops releasing.
+  auto blocked = std::thread{[&]() { EXPECT_FALSE(r.acquire(100U)); }};
+  r.close();
+  blocked.join();
+  r.complete(6U, 6, consume);
+  EXPECT_EQ(4U, out.size());
+  EXPECT_FALSE(r.acquire(7U));
+}
+
+TEST(osm, read_ordered) {
+  auto const path = write_test_file("osm_read_ordered_test.osm.pbf");
+  auto r = osm::raw_reader{.file_ = cista::mmap{
+                               path.string().c_str(),
+                               cista::mmap::protection::READ}};
+
+  // Blocks of 8 nodes: map results arrive in file order.
+  auto ids = std::vector<std::int64_t>{};
+  osm::read_ordered(
+      r, {.n_threads_ = 4U, .queue_size_ = 3U, .reorder_window_ = 2U},
+      [](osm::buf const&, std::string_view block, osm::decode_state& state) {
+        auto block_ids = std::vector<std::int64_t>{};
         osm::decode_primitive(
-            out, strings, true, true, true,
-            [&](std::int64_t const id, geo::latlng const& pos, auto&& tags) {
-              ++n_nodes;
+            block, state, true, false, false,
+            [&](std::int64_t const id, geo::latlng const&, auto&&) {
+              block_ids.push_back(id);
             },
-            [&](std::int64_t const id, auto&& refs, auto&& tags) { ++n_ways; },
-            [&](std::int64_t const id, auto&& members, auto&& tags) {
-              ++n_rels;
-            });
+            [](std::int64_t, auto&&, auto&&) {},
+            [](std::int64_t, auto&&, auto&&) {});
+        return block_ids;
+      },
+      [&](std::vector<std::int64_t> const& block_ids) {
+        ids.insert(end(ids), begin(block_ids), end(block_ids));
+      });
+
+  auto expected = std::vector<std::int64_t>(100U);
+  std::iota(begin(expected), end(expected), 1);
+  EXPECT_EQ(expected, ids);
+
+  std::filesystem::remove(path);
+}
+
+TEST(osm, block_index) {
+  auto const path = write_test_file("osm_block_index_test.osm.pbf");
+  auto const idx_path = osm::default_index_path(path);
+  std::filesystem::remove(idx_path);
+
+  // Disabled kinds of the config don't restrict the index.
+  auto const idx =
+      osm::build_block_index(path, {.n_threads_ = 2U, .read_nodes_ = false});
+  ASSERT_EQ(13U + 7U + 2U, idx.blocks_.size());
+  auto const& first = idx.blocks_.front();
+  EXPECT_EQ(osm::entity_kind::kNodes, first.kinds_);
+  EXPECT_EQ(1, first.min_id_);
+  EXPECT_EQ(8, first.max_id_);
+  EXPECT_EQ(1, first.min_lat_);
+  EXPECT_EQ(-8, first.min_lon_);
+  EXPECT_EQ(8, first.max_lat_);
+  EXPECT_EQ(-1, first.max_lon_);
+  EXPECT_EQ(osm::entity_kind::kWays, idx.blocks_[13].kinds_);
+  EXPECT_TRUE(idx.blocks_[13].contains(8));
+  EXPECT_FALSE(idx.blocks_[13].contains(9));
+  EXPECT_EQ(osm::entity_kind::kRelations, idx.blocks_.back().kinds_);
+  EXPECT_EQ(10, idx.blocks_.back().max_id_);
+
+  // Sidecar file, invalidated by a modified PBF.
+  EXPECT_FALSE(osm::read_block_index(idx_path, path).has_value());
+  auto const f = osm::ensure_block_index(path, {.n_threads_ = 2U});
+  EXPECT_EQ(idx.blocks_.size(), f->blocks_.size());
+  EXPECT_TRUE(osm::read_block_index(idx_path, path).has_value());
+  EXPECT_NE(osm::temp_path(idx_path), osm::temp_path(idx_path));
+  for (auto const& e : std::filesystem::directory_iterator{
+           std::filesystem::temp_directory_path()}) {
+    auto const name = e.path().filename().string();
+    EXPECT_FALSE(name.starts_with(idx_path.filename().string() + ".") &&
+                 name.ends_with(".tmp"))
+        << name;  // renamed
+  }
+  std::filesystem::last_write_time(
+      path, std::filesystem::last_write_time(path) + std::chrono::seconds{1});
+  EXPECT_FALSE(osm::read_block_index(idx_path, path).has_value());
+
+  // raw_reader::seek
+  auto r = osm::raw_reader{.file_ = cista::mmap{
+                               path.string().c_str(),
+                               cista::mmap::protection::READ}};
+  auto const& b = idx.blocks_[14];
+  r.seek(b.offset_, b.idx_);
+  auto const blob = r.read();
+  ASSERT_TRUE(blob.has_value());
+  EXPECT_EQ(b.offset_, blob->offset_);
+  EXPECT_EQ(b.idx_, blob->idx_);
+  EXPECT_EQ(b.compressed_size_, blob->compressed_.size());
+
+  // indexed_reader: ways 10..20 are in the way blocks [9, 16] and [17, 24].
+  auto ir = osm::indexed_reader{
+      .r_ = r,
+      .selected_ = osm::select_blocks(idx, osm::entity_kind::kWays, 10, 20)};
+  ASSERT_EQ(2U, ir.selected_.size());
+  auto way_ids = std::vector<std::int64_t>{};
+  osm::read(
+      ir, {.n_threads_ = 1U}, [](std::int64_t, geo::latlng const&, auto&&) {},
+      [&](std::int64_t const id, auto&&, auto&&) { way_ids.push_back(id); },
+      [](std::int64_t, auto&&, auto&&) {});
+  std::ranges::sort(way_ids);
+  EXPECT_EQ(9, way_ids.front());
+  EXPECT_EQ(24, way_ids.back());
+  EXPECT_EQ(16U, way_ids.size());
+
+  // read(path) through the index still checks the OSMHeader: the file has
+  // no LocationsOnWays.
+  osm::ensure_block_index(path, {.n_threads_ = 2U});
+  ASSERT_TRUE(osm::read_block_index(idx_path, path).has_value());
+  EXPECT_ANY_THROW(osm::read(
+      path.string().c_str(), {.read_nodes_ = false, .read_relations_ = false},
+      [](std::int64_t, geo::latlng const&, auto&&) {},
+      [](std::uint64_t, auto&&, std::span<osm::location const>, auto&&) {},
+      [](std::int64_t, auto&&, auto&&) {}));
+
+  std::filesystem::remove(idx_path);
+  std::filesystem::remove(path);
+}
+
+TEST(osm, peek_kind) {
+  using osm::entity_kind;
+  for (auto const c : {osm::compression::kRaw, osm::compression::kZlib}) {
+    auto const path =
+        write_test_file("osm_peek_test.osm.pbf", 100,
+                        {.compression_ = c, .max_entities_ = 40U});
+    auto r = osm::raw_reader{.file_ = cista::mmap{
+                                 path.string().c_str(),
+                                 cista::mmap::protection::READ}};
+    auto d = osm::decompressor{};
+    auto out = std::string{};
+    auto expected = std::string{};
+    auto kinds = std::vector<entity_kind>{};
+    for (auto b = r.read(); b.has_value(); b = r.read()) {
+      if (b->type_ != osm::blob_type::kData) {
+        continue;
+      }
+      auto const kind = osm::peek_kind(d, *b);
+      kinds.push_back(kind);
+
+      // Only wanted blocks are decompressed, continuing after the prefix.
+      auto const p = osm::decompress_wanted(d, *b, entity_kind::kWays, out);
+      EXPECT_EQ(kind, p.kind_);
+      EXPECT_EQ(kind == entity_kind::kWays, p.block_.has_value());
+      if (p.block_.has_value()) {
+        EXPECT_EQ(d.decompress(*b, expected), *p.block_);
+      }
+    }
+    EXPECT_EQ((std::vector{entity_kind::kNodes, entity_kind::kNodes,
+                           entity_kind::kNodes, entity_kind::kWays,
+                           entity_kind::kWays, entity_kind::kRelations}),
+              kinds);
+
+    auto n_ways = std::atomic_int{0};
+    osm::read(
+        path.string().c_str(),
+        {.n_threads_ = 2U, .read_nodes_ = false, .read_relations_ = false},
+        [](std::int64_t, geo::latlng const&, auto&&) {},
+        [&](std::int64_t, auto&&, auto&&) { ++n_ways; },
+        [](std::int64_t, auto&&, auto&&) {});
+    EXPECT_EQ(50, n_ways);
+    std::filesystem::remove(path);
+  }
+}
+
+TEST(osm, inflate_read_some) {
+  auto const raw = std::string(100'000U, 'x') + "end";
+  auto compressed = std::string(compressBound(raw.size()), '\0');
+  auto size = static_cast<uLongf>(compressed.size());
+  ASSERT_EQ(Z_OK, compress2(reinterpret_cast<Bytef*>(compressed.data()), &size,
+                            reinterpret_cast<Bytef const*>(raw.data()),
+                            raw.size(), Z_DEFAULT_COMPRESSION));
+  compressed.resize(size);
+
+  auto z = osm::inflate{};
+
+  // Prefix only, the rest of the stream is dropped by end().
+  auto prefix = std::array<char, 10U>{};
+  z.begin(compressed);
+  EXPECT_EQ(prefix.size(), z.read_some(prefix.data(), prefix.size()));
+  EXPECT_EQ(std::string(10U, 'x'), std::string_view(prefix.data(), 10U));
+  z.end();
+
+  // Whole stream in small pieces.
+  auto pieces = std::string{};
+  z.begin(compressed);
+  auto piece = std::array<char, 777U>{};
+  for (auto n = z.read_some(piece.data(), piece.size()); n != 0U;
+       n = z.read_some(piece.data(), piece.size())) {
+    pieces.append(piece.data(), n);
+  }
+  z.end();
+  EXPECT_EQ(raw, pieces);
+
+  // A throwing read_some() skips end(): begin() resets the stream anyway.
+  z.begin("not a zlib stream");
+  EXPECT_ANY_THROW(z.read_some(piece.data(), piece.size()));
+  z.begin(compressed);
+  EXPECT_EQ(prefix.size(), z.read_some(prefix.data(), prefix.size()));
+  z.end();
+
+  // The state is reset for complete decompression.
+  auto out = std::string(raw.size(), '\0');
+  z.decompress(compressed, out);
+  EXPECT_EQ(raw, out);
+}
+
+TEST(osm, decompress) {
+  auto raw = std::string{};
+  for (auto i = 0; i != 10'000; ++i) {
+    raw += std::to_string(i * i % 997);
+  }
+
+  auto blobs = std::vector<std::pair<osm::compression, std::string>>{
+      {osm::compression::kRaw, osm::compress(osm::compression::kRaw, raw)},
+      {osm::compression::kZlib, osm::compress(osm::compression::kZlib, raw)}};
+#ifdef OSM_WITH_ZSTD
+  blobs.emplace_back(osm::compression::kZstd,
+                     osm::compress(osm::compression::kZstd, raw));
+#endif
+#ifdef OSM_WITH_LZ4
+  auto lz4 =
+      std::string(LZ4_compressBound(static_cast<int>(raw.size())), '\0');
+  lz4.resize(static_cast<std::size_t>(LZ4_compress_default(
+      raw.data(), lz4.data(), static_cast<int>(raw.size()),
+      static_cast<int>(lz4.size()))));
+  blobs.emplace_back(osm::compression::kLz4, lz4);
+#endif
+
+  auto d = osm::decompressor{};
+  auto out = std::string{};
+  for (auto const& [c, compressed] : blobs) {
+    auto b = osm::buf{.type_ = osm::blob_type::kData,
+                      .compression_ = c,
+                      .idx_ = 0U,
+                      .offset_ = 0U,
+                      .raw_size_ = raw.size(),
+                      .compressed_ = compressed};
+    EXPECT_EQ(raw, d.decompress(b, out));
+    EXPECT_EQ(raw, d.decompress(b, out));  // reused state
+
+    if (c != osm::compression::kRaw) {
+      b.raw_size_ = raw.size() - 1U;
+      EXPECT_ANY_THROW(d.decompress(b, out));
+      b.raw_size_ = raw.size();
+      b.compressed_ = b.compressed_.substr(0U, b.compressed_.size() / 2U);
+      EXPECT_ANY_THROW(d.decompress(b, out));
+
+      // Failures leave no state behind.
+      b.compressed_ = compressed;
+      EXPECT_EQ(raw, d.decompress(b, out));
+    }
+  }
+
+  EXPECT_ANY_THROW(d.decompress(
+      osm::buf{.type_ = osm::blob_type::kData,
+               .compression_ = osm::compression::kLzma,
+               .idx_ = 0U,
+               .offset_ = 0U,
+               .raw_size_ = raw.size(),
+               .compressed_ = raw},
+      out));
+}
+
+TEST(osm, bulk_varint) {
+  auto deltas = std::vector<std::int64_t>{};
+  for (auto i = 0; i != 1000; ++i) {
+    deltas.push_back(i % 3 == 0 ? 1 : (i % 7) * (i % 2 == 0 ? -1 : 1) * i * i);
+  }
+
+  auto buf = std::string{};
+  auto expected = std::vector<std::int64_t>{};
+  auto sum = std::int64_t{0};
+  for (auto const d : deltas) {
+    auto tmp = std::array<char, protozero::max_varint_length>{};
+    auto const n =
+        protozero::write_varint(tmp.data(), protozero::encode_zigzag64(d));
+    buf.append(tmp.data(), static_cast<std::size_t>(n));
+    expected.push_back(sum += d);
+  }
+
+  auto out = osm::int_buffer{};
+  auto const decoded = osm::decode_packed<true, true>(buf, out);
+  ASSERT_EQ(expected.size(), decoded.size());
+  EXPECT_TRUE(std::ranges::equal(expected, decoded));
+
+  auto const legacy = osm::delta_varint<std::int64_t>{buf};
+  EXPECT_TRUE(std::ranges::equal(legacy, decoded));
+}
+
+TEST(osm, node_batch) {
+  auto const path = write_test_file("osm_node_batch_test.osm.pbf");
+
+  // One call per dense group: 8 nodes per block.
+  auto ids = std::vector<std::int64_t>{};
+  auto batch_sizes = std::vector<std::size_t>{};
+  osm::read(
+      path.string().c_str(), {.n_threads_ = 1U},
+      [&](osm::node_batch const& b) {
+        batch_sizes.push_back(b.size());
+        for (auto i = 0U; i != b.size(); ++i) {
+          auto const id = b.ids_[i];
+          ids.push_back(id);
+          EXPECT_EQ(id, b.lats_[i]);
+          EXPECT_EQ(-id, b.lons_[i]);
+          auto tags = test_tags{};
+          for (auto const [k, v] : b.tags(i)) {
+            tags.emplace_back(k, v);
+          }
+          EXPECT_EQ((test_tags{{"name", std::to_string(id)}}), tags);
+        }
+      },
+      [](std::int64_t, auto&&, auto&&) {},
+      [](std::int64_t, auto&&, auto&&) {});
+  EXPECT_EQ(13U, batch_sizes.size());
+  EXPECT_EQ(4U, batch_sizes.back());
+  auto expected = std::vector<std::int64_t>(100U);
+  std::iota(begin(expected), end(expected), 1);
+  EXPECT_EQ(expected, ids);
+
+  // Granularity below 1e-7 degrees: both signs round half away from zero.
+  auto const sub = std::array<std::int64_t, 6>{1, -1, 3, -3, 7, -7};
+  auto out = std::array<std::int32_t, 6>{};
+  osm::to_fixed(sub, 0, 50, out.data());
+  EXPECT_EQ((std::array<std::int32_t, 6>{1, -1, 2, -2, 4, -4}), out);
+  osm::to_fixed(sub, 0, 30, out.data());
+  EXPECT_EQ((std::array<std::int32_t, 6>{0, 0, 1, -1, 2, -2}), out);
+
+  std::filesystem::remove(path);
+}
+
+TEST(osm, tag_filter) {
+  auto const filter = osm::tag_filter{{"highway", ""}, {"amenity", "bench"}};
+  auto const strings = std::vector<std::string_view>{
+      "", "name", "amenity", "bench", "highway", "primary"};
+
+  auto block = osm::block_tag_filter{};
+  block.reset(filter);
+  for (auto i = 0U; i != strings.size(); ++i) {
+    block.add_string(i, strings[i]);
+  }
+  block.finish(strings.size());
+
+  ASSERT_TRUE(block.matchable());
+  EXPECT_TRUE(block.matches(4U, 5U));
+  EXPECT_TRUE(block.matches(2U, 3U));
+  EXPECT_FALSE(block.matches(2U, 5U));
+  EXPECT_FALSE(block.matches(1U, 3U));
+  EXPECT_TRUE(block.matches_interleaved(std::vector{1U, 3U, 2U, 3U}));
+  EXPECT_FALSE(block.matches_interleaved(std::vector{1U, 3U, 2U}));
+
+  block.reset(filter);
+  block.add_string(0U, "");
+  block.add_string(1U, "amenity");
+  block.finish(2U);
+  EXPECT_FALSE(block.matchable());
+}
+
+TEST(osm, header) {
+  auto block = std::string{};
+  auto pbf = protozero::pbf_builder<osm::header_block>{block};
+  pbf.add_string(osm::header_block::repeated_string_required_features,
+                 "OsmSchema-V0.6");
+  pbf.add_string(osm::header_block::repeated_string_required_features,
+                 osm::kLocationsOnWays.data(), osm::kLocationsOnWays.size());
+  pbf.add_string(osm::header_block::repeated_string_optional_features,
+                 "Sort.Type_then_ID");
+  pbf.add_string(osm::header_block::optional_string_writingprogram, "test");
+  pbf.add_int64(osm::header_block::optional_int64_osmosis_replication_timestamp,
+                1'700'000'000);
+  {
+    auto bbox = protozero::pbf_builder<osm::header_bbox>{
+        pbf, osm::header_block::optional_HeaderBBox_bbox};
+    bbox.add_sint64(osm::header_bbox::required_sint64_left, -5'000'000'050);
+    bbox.add_sint64(osm::header_bbox::required_sint64_right, 15'000'000'000);
+    bbox.add_sint64(osm::header_bbox::required_sint64_top, 55'000'000'000);
+    bbox.add_sint64(osm::header_bbox::required_sint64_bottom, 47'000'000'000);
+  }
+
+  auto const h = osm::parse_header(block);
+  EXPECT_EQ(2U, h.required_features_.size());
+  EXPECT_TRUE(h.has_feature(osm::kLocationsOnWays));
+  EXPECT_TRUE(h.has_feature("Sort.Type_then_ID"));
+  EXPECT_FALSE(h.has_feature("DenseNodes"));
+  EXPECT_TRUE(h.sorted());
+  EXPECT_EQ("test", h.writing_program_);
+  EXPECT_EQ(1'700'000'000, h.replication_timestamp_);
+  ASSERT_TRUE(h.bbox_.has_value());
+  // Rounded half away from zero, like node coordinates.
+  EXPECT_EQ((osm::location{470'000'000, -50'000'001}), h.bbox_->min_);
+  EXPECT_EQ((osm::location{550'000'000, 150'000'000}), h.bbox_->max_);
+
+  using osm::entity_kind;
+  EXPECT_TRUE(osm::all_after(entity_kind::kWays, entity_kind::kNodes));
+  EXPECT_FALSE(osm::all_after(entity_kind::kAll, entity_kind::kNodes));
+  EXPECT_FALSE(osm::all_after(entity_kind::kWays, entity_kind::kWays));
+  EXPECT_TRUE(osm::all_after(entity_kind::kRelations,
+                             entity_kind::kNodes | entity_kind::kWays));
+}
+
+TEST(osm, location_store) {
+  auto const check = [](auto& store) {
+    for (auto i = 0; i != 1000; ++i) {
+      store.set(i * 100'003, osm::location{i, -i});
+    }
+    store.finish();
+    for (auto i = 0; i != 1000; ++i) {
+      EXPECT_EQ((osm::location{i, -i}), store.get(i * 100'003));
+      EXPECT_FALSE(store.get(i * 100'003 + 1).valid());
+    }
+    auto const refs = std::vector<std::int64_t>{100'003, 7};
+    auto const resolved = osm::resolve(store, refs);
+    EXPECT_EQ(1, (*begin(resolved)).second.lat_);
+  };
+
+  auto sparse = osm::sparse_location_store{};
+  check(sparse);
+
+  auto paged = osm::paged_location_store{1ULL << 27U};
+  check(paged);
+
+  // The adapter owns the callback, the temporary is gone when it is called.
+  auto const prefix = std::string(32U, 'w');
+  auto seen = std::vector<std::string>{};
+  auto adapter = osm::with_locations(
+      sparse, [&seen, prefix](std::uint64_t const id, auto&& locations,
+                              auto&&) {
+        for (auto const [ref, l] : locations) {
+          seen.push_back(fmt::format("{}{}:{}:{}", prefix, id, ref, l.lat_));
+        }
+      });
+  auto const refs = std::vector<std::int64_t>{100'003, 200'006};
+  adapter(std::uint64_t{7U}, refs, test_tags{});
+  EXPECT_EQ((std::vector{prefix + "7:100003:1", prefix + "7:200006:2"}), seen);
+
+  // Variadic callbacks are ordinary callbacks: no LocationsOnWays needed and
+  // no node batches.
+  auto const variadic = [](auto&&...) {};
+  auto const with_locs = [](std::uint64_t, auto&&, auto&&, auto&&) {};
+  auto const batch = [](osm::node_batch const&) {};
+  static_assert(!osm::is_way_locations_fn<decltype(variadic)>);
+  static_assert(osm::is_way_locations_fn<decltype(with_locs)>);
+  static_assert(!osm::is_node_batch_fn<decltype(variadic)>);
+  static_assert(osm::is_node_batch_fn<decltype(batch)>);
+
+  auto const path = write_test_file("osm_location_store_test.osm.pbf");
+  auto ways = std::atomic_uint{0U};
+  osm::read(path.string().c_str(), {.n_threads_ = 2U},
+            [](std::int64_t, geo::latlng const&, auto&&) {},
+            [&](auto&&...) { ++ways; }, osm::no_callback{});
+  EXPECT_EQ(50U, ways);
+
+  auto file = osm::sparse_location_store{};
+  osm::read_locations(path.string().c_str(), file, {.n_threads_ = 2U});
+  EXPECT_EQ((osm::location{42, -42}), file.get(42));
+  std::filesystem::remove(path);
+}
+
+TEST(osm, lookup) {
+  // Nodes 10, 20, ..., 1000 and ways 1..50, 8 entities per block.
+  auto const path =
+      std::filesystem::temp_directory_path() / "osm_lookup_test.osm.pbf";
+  std::filesystem::remove(osm::default_index_path(path));
+  {
+    auto w = osm::writer{path, {.n_threads_ = 1U, .max_entities_ = 8U}};
+    for (auto i = 1; i <= 100; ++i) {
+      w.add_node(i * 10, osm::location{i, -i});
+    }
+    for (auto i = 1; i <= 50; ++i) {
+      w.add_way(i, {i * 10, i * 10 + 10});
+    }
+  }
+
+  // peek_head: kind and first ID of every block.
+  auto r = osm::raw_reader{.file_ = cista::mmap{
+                               path.string().c_str(),
+                               cista::mmap::protection::READ}};
+  auto d = osm::decompressor{};
+  auto out = std::string{};
+  auto heads = std::vector<std::string>{};
+  for (auto b = r.read(); b.has_value(); b = r.read()) {
+    if (b->type_ == osm::blob_type::kData) {
+      auto const h = osm::peek_head(d, *b, out);
+      heads.push_back(fmt::format("{}:{}", static_cast<int>(h.kind_),
+                                  h.first_id_.value_or(-1)));
+    }
+  }
+  ASSERT_EQ(13U + 7U, heads.size());
+  EXPECT_EQ("1:10", heads[0]);
+  EXPECT_EQ("1:90", heads[1]);
+  EXPECT_EQ("1:970", heads[12]);
+  EXPECT_EQ("2:1", heads[13]);
+  EXPECT_EQ("2:49", heads[19]);
+
+  using batches_t = std::vector<std::vector<std::int64_t>>;
+  auto const check = [&](osm::lookup& l, batches_t const& expected_batches) {
+    // Hits, misses before, between and after the blocks, duplicates.
+    auto const ids =
+        std::vector<std::int64_t>{850, 10, 85, 5, 1000, 20, 10, 1005};
+    auto found = std::vector<std::string>{};
+    l.get_nodes(ids, [&](std::int64_t const id, geo::latlng const& pos,
+                         auto&&) {
+      found.push_back(fmt::format("{}:{}", id, std::lround(pos.lat_ * 1e7)));
+    });
+    EXPECT_EQ((std::vector<std::string>{"10:1", "20:2", "850:85", "1000:100"}),
+              found);
+
+    // One call per candidate block.
+    auto batches = batches_t{};
+    l.get(osm::entity_kind::kNodes, ids,
+          [&](std::span<std::int64_t const> wanted, std::string_view) {
+            batches.emplace_back(begin(wanted), end(wanted));
+          });
+    EXPECT_EQ(expected_batches, batches);
+
+    auto way_ids = std::vector<std::uint64_t>{};
+    l.get_ways(std::vector<std::int64_t>{50, 1, 0, 51, 9},
+               [&](std::uint64_t const id, auto&&, auto&&) {
+                 way_ids.push_back(id);
+               });
+    EXPECT_EQ((std::vector<std::uint64_t>{1, 9, 50}), way_ids);
+  };
+
+  {
+    auto l = osm::lookup{path};  // binary search over the blob heads
+    EXPECT_FALSE(l.index_.has_value());
+    check(l, {{10, 20, 85}, {850}, {1000, 1005}});
+    EXPECT_FALSE(l.find_block(osm::entity_kind::kNodes, 5).has_value());
+    EXPECT_EQ(0U, l.find_block(osm::entity_kind::kNodes, 85));
+    EXPECT_EQ(12U, l.find_block(osm::entity_kind::kNodes, 5000));
+    EXPECT_FALSE(l.find_block(osm::entity_kind::kRelations, 1).has_value());
+  }
+
+  osm::ensure_block_index(path, {.n_threads_ = 1U});
+  {
+    auto l = osm::lookup{path};  // block index
+    EXPECT_TRUE(l.index_.has_value());
+    check(l, {{10, 20}, {850}, {1000}});  // min / max ID per block
+  }
+
+  std::filesystem::remove(osm::default_index_path(path));
+  std::filesystem::remove(path);
+}
+
+TEST(osm, stats) {
+  auto c = osm::counter{};
+  c.add(3U);
+  c.add(4U);
+  EXPECT_EQ(7U, c.get());
+
+  {
+    auto const t = osm::detail::scoped_timer{&c};
+    std::this_thread::sleep_for(std::chrono::milliseconds{2});
+  }
+  EXPECT_LE(7U + 2'000'000U, c.get());
+  { auto const noop = osm::detail::scoped_timer{nullptr}; }
+
+  auto const path = write_test_file("osm_stats_test.osm.pbf");
+  auto s = osm::stats{std::chrono::milliseconds{0}};
+  osm::read(path.string().c_str(),
+            {.n_threads_ = 2U, .queue_size_ = 4U, .stats_ = &s},
+            [](std::int64_t, geo::latlng const&, auto&&) {},
+            [](std::int64_t, auto&&, auto&&) {},
+            [](std::int64_t, auto&&, auto&&) {});
+  auto const total = s.sample();
+  EXPECT_EQ(100U, total.nodes_);
+  EXPECT_EQ(50U, total.ways_);
+  EXPECT_EQ(10U, total.relations_);
+  EXPECT_EQ(1U + 13U + 7U + 2U, total.blobs_read_);  // with the header
+  EXPECT_LT(0U, total.bytes_read_);
+  EXPECT_GT(std::filesystem::file_size(path), total.bytes_read_);
+  EXPECT_EQ(0U, total.queue_depth_);
+  EXPECT_LE(1U, total.max_queue_depth_);
+  // Workers pop before they report the dequeue: one extra job per worker.
+  EXPECT_GE(4U + 2U, total.max_queue_depth_);
+  EXPECT_EQ(22U, std::accumulate(begin(total.latency_), end(total.latency_),
+                                 std::uint64_t{0U}));
+
+  auto const json = s.to_json();
+  EXPECT_TRUE(json.starts_with(R"({"total":{"elapsed_ns":)"));
+  EXPECT_NE(std::string::npos, json.find(R"("nodes":100,"ways":50,)"));
+  EXPECT_NE(std::string::npos, json.find(R"("samples":[{)"));
+  EXPECT_TRUE(json.ends_with("]}"));
+
+  std::filesystem::remove(path);
+}
+
+TEST(osm, detect_fields) {
+  using osm::field;
+  auto const node = [](std::int64_t, geo::latlng const&) {};
+  auto const way = [](std::uint64_t, auto&&, auto&&) {};
+  static_assert(
+      osm::detect_fields<decltype(node), decltype(way), osm::no_callback>() ==
+      (field::kNodes | field::kWays | field::kWayRefs | field::kWayTags));
+  static_assert(osm::detect_fields<osm::no_callback, osm::no_callback,
+                                   decltype(way)>() ==
+                (field::kRelations | field::kRelationMembers |
+                 field::kRelationTags));
+
+  auto const fixed_node = [](std::int64_t, osm::location) {};
+  static_assert(osm::detect_fields<decltype(fixed_node), osm::no_callback,
+                                   osm::no_callback>() == field::kNodes);
+}
+
+TEST(osm, fixed_point) {
+  auto const in = std::array<std::int64_t, 5>{523456789, -1, 0, 3, -3};
+  for (auto const [offset, granularity] :
+       {std::pair{0, 100}, std::pair{200, 1000}, std::pair{-150, 50},
+        std::pair{0, 50}}) {
+    auto const m = osm::meta_data{.granularity_ = granularity,
+                                  .lat_offset_ = offset,
+                                  .lon_offset_ = offset};
+    auto out = std::array<std::int32_t, 5>{};
+    osm::to_fixed(in, offset, granularity, out.data());
+    for (auto i = 0U; i != in.size(); ++i) {
+      EXPECT_EQ((osm::location{out[i], out[i]}),
+                m.position<osm::field::kFixedPoint>(in[i], in[i]));
+    }
+  }
+}
+
+TEST(osm, tag_ids) {
+  // Block: strings ["", "highway", "foo"], way 7 with highway=foo.
+  auto block = std::string{};
+  {
+    auto pb = protozero::pbf_builder<osm::primitive_block>{block};
+    {
+      auto st = protozero::pbf_builder<osm::string_table>{
+          pb, osm::primitive_block::required_StringTable_stringtable};
+      for (auto const s : {"", "highway", "foo"}) {
+        st.add_bytes(osm::string_table::repeated_bytes_s, s);
+      }
+    }
+    auto group = protozero::pbf_builder<osm::primitive_group>{
+        pb, osm::primitive_block::repeated_PrimitiveGroup_primitivegroup};
+    auto w = protozero::pbf_builder<osm::way>{
+        group, osm::primitive_group::repeated_Way_ways};
+    auto const keys = std::array{1U};
+    auto const vals = std::array{2U};
+    w.add_int64(osm::way::required_int64_id, 7);
+    w.add_packed_uint32(osm::way::packed_uint32_keys, begin(keys), end(keys));
+    w.add_packed_uint32(osm::way::packed_uint32_vals, begin(vals), end(vals));
+  }
+
+  auto interner = osm::string_interner{};
+  auto state = osm::decode_state{};
+  state.interner_ = &interner;
+  auto ids = std::vector<std::pair<std::uint32_t, std::uint32_t>>{};
+  for (auto i = 0U; i != 2U; ++i) {
+    osm::decode_primitive<osm::field::kAll | osm::field::kTagIds>(
+        block, state, osm::no_callback{},
+        [&](std::uint64_t, auto&&, auto&& tags) {
+          for (auto const [k, v] : tags) {
+            ids.emplace_back(k, v);
+          }
+        },
+        osm::no_callback{});
+  }
+
+  ASSERT_EQ(2U, ids.size());
+  EXPECT_EQ(ids[0], ids[1]);
+  EXPECT_EQ(0U, ids[0].first);  // seeded: "highway" first
+  EXPECT_EQ("foo", interner.get(ids[0].second));
+  EXPECT_EQ(ids[0].second, interner.find("foo").value());
+
+  // Large strings get their own arena block: an empty string after one
+  // must not point past its end.
+  auto const large = std::string(1U << 19U, 'x');
+  auto const large_id = interner.intern(large);
+  auto const empty_id = interner.intern("");
+  auto const small_id = interner.intern("bar");
+  EXPECT_EQ(large, interner.get(large_id));
+  EXPECT_EQ("", interner.get(empty_id));
+  EXPECT_EQ("bar", interner.get(small_id));
+  EXPECT_EQ(empty_id, interner.find("").value());
+}
+
+TEST(osm, shard) {
+  auto file = std::string{};
+  auto starts = std::vector<std::size_t>{add_blob(file, "OSMHeader", "header")};
+  for (auto i = 0U; i != 20U; ++i) {
+    // Payloads containing the blob type pattern must not match.
+    starts.push_back(
+        add_blob(file, "OSMData",
+                 std::string(i * 37U, 'x') +
+                     std::string{"\0\0\0\x0d\x0a\x07OSMData", 13U} +
+                     std::string(i * 11U, 'y')));
+  }
+
+  for (auto n = 1U; n != 8U; ++n) {
+    auto prev_end = std::size_t{0U};
+    for (auto i = 0U; i != n; ++i) {
+      auto const r = osm::get_shard(file, {i, n});
+      EXPECT_EQ(prev_end, r.begin_);
+      EXPECT_TRUE(r.begin_ == file.size() ||
+                  std::ranges::binary_search(starts, r.begin_));
+      prev_end = r.end_;
+    }
+    EXPECT_EQ(file.size(), prev_end);
+  }
+}
+
+TEST(osm, stream_reader) {
+  auto file = std::string{};
+  auto starts = std::vector<std::size_t>{};
+  auto payloads = std::vector<std::string>{};
+  auto const add = [&](char const* type, std::string const& data) {
+    starts.push_back(add_blob(file, type, data));
+    payloads.push_back(data);
+  };
+  add("OSMHeader", "header");
+  for (auto i = 0U; i != 50U; ++i) {
+    add("OSMData", std::string(i * 1000U, static_cast<char>('a' + i)));
+  }
+
+  int fds[2];
+  ASSERT_EQ(0, ::pipe(fds));
+  auto writer = std::thread{[&]() {
+    for (auto rest = std::string_view{file}; !rest.empty();) {
+      auto const chunk = rest.substr(0U, 4096U);
+      auto const n = ::write(fds[1], chunk.data(), chunk.size());
+      ASSERT_GT(n, 0);
+      rest.remove_prefix(static_cast<std::size_t>(n));
+    }
+    ::close(fds[1]);
+  }};
+
+  auto blobs = std::vector<osm::buf>{};
+  {
+    auto r = osm::stream_reader{fds[0], {.read_ahead_ = 2U}};
+    while (auto b = r.read()) {
+      blobs.emplace_back(std::move(*b));  // outlives the reader
+    }
+    EXPECT_EQ(file.size(), r.offset());
+    EXPECT_EQ(0U, r.size());
+  }
+  writer.join();
+  ::close(fds[0]);
+
+  ASSERT_EQ(payloads.size(), blobs.size());
+  for (auto i = 0U; i != blobs.size(); ++i) {
+    EXPECT_EQ(i, blobs[i].idx_);
+    EXPECT_EQ(starts[i], blobs[i].offset_);
+    EXPECT_EQ(payloads[i], blobs[i].compressed_);
+  }
+
+  // Destruction while the reading thread waits for input.
+  ASSERT_EQ(0, ::pipe(fds));
+  { auto const r = osm::stream_reader{fds[0]}; }
+  ::close(fds[0]);
+  ::close(fds[1]);
+
+  // Blob sizes above the limit are rejected before allocating.
+  auto const path =
+      std::filesystem::temp_directory_path() / "osm_stream_reader_test.pbf";
+  auto huge = std::string{};
+  add_blob(huge, "OSMData", "x", std::numeric_limits<std::int32_t>::max());
+  std::ofstream{path, std::ios::binary} << huge;
+  {
+    auto r = osm::stream_reader{path.string().c_str()};
+    try {
+      r.read();
+      ADD_FAILURE() << "no error";
+    } catch (std::exception const& e) {
+      EXPECT_TRUE(std::string_view{e.what()}.starts_with("blob size"))
+          << e.what();
+    }
+  }
+  std::filesystem::remove(path);
+}
+
+TEST(osm, assemble_rings) {
+  using osm::location;
+  // Outer square split into two ways (second one reversed), square hole.
+  auto const nodes = std::vector<std::vector<std::int64_t>>{
+      {1, 2, 3}, {1, 4, 3}, {5, 6, 7, 8, 5}};
+  auto const locations = std::vector<std::vector<location>>{
+      {{0, 0}, {0, 100}, {100, 100}},
+      {{0, 0}, {100, 0}, {100, 100}},
+      {{10, 10}, {10, 20}, {20, 20}, {20, 10}, {10, 10}}};
+
+  auto const polygons = osm::assemble_rings(nodes, locations);
+  ASSERT_EQ(1U, polygons.size());
+  EXPECT_EQ(5U, polygons[0].outer_.size());
+  ASSERT_EQ(1U, polygons[0].inner_.size());
+  EXPECT_EQ(5U, polygons[0].inner_[0].size());
+  EXPECT_LT(0.0, signed_area(polygons[0].outer_));  // counterclockwise
+  EXPECT_GT(0.0, signed_area(polygons[0].inner_[0]));  // clockwise
+
+  // Same orientation for input rings in the opposite direction.
+  auto reversed = locations;
+  for (auto& l : reversed) {
+    std::ranges::reverse(l);
+  }
+  auto reversed_nodes = nodes;
+  for (auto& n : reversed_nodes) {
+    std::ranges::reverse(n);
+  }
+  auto const flipped = osm::assemble_rings(reversed_nodes, reversed);
+  ASSERT_EQ(1U, flipped.size());
+  ASSERT_EQ(1U, flipped[0].inner_.size());
+  EXPECT_LT(0.0, signed_area(flipped[0].outer_));
+  EXPECT_GT(0.0, signed_area(flipped[0].inner_[0]));
+
+  // Open ring.
+  EXPECT_TRUE(osm::assemble_rings(std::span{nodes}.first(1U),
+                                  std::span{locations}.first(1U))
+                  .empty());
+}
+
+TEST(osm, assemble_areas) {
+  using osm::location;
+  auto const path =
+      std::filesystem::temp_directory_path() / "osm_assemble_areas_test.pbf";
+  auto const node_locations = std::vector<location>{
+      {0, 0},     {0, 1000},  {1000, 1000}, {1000, 0},
+      {100, 100}, {100, 200}, {200, 200},   {200, 100}};
+  auto const ways = std::vector<std::vector<std::int64_t>>{
+      {1, 2, 3}, {3, 4, 1}, {5, 6, 7, 8, 5}, {1, 2, 3}};
+
+  for (auto const locations_on_ways : {false, true}) {
+    {
+      auto w = osm::writer{path, {.n_threads_ = 2U,
+                                  .max_entities_ = 3U,
+                                  .locations_on_ways_ = locations_on_ways}};
+      for (auto i = 0U; i != node_locations.size(); ++i) {
+        w.add_node(i + 1, node_locations[i]);
+      }
+      for (auto i = 0U; i != ways.size(); ++i) {
+        if (locations_on_ways) {
+          auto locations = std::vector<location>{};
+          for (auto const n : ways[i]) {
+            locations.push_back(node_locations[n - 1]);
+          }
+          w.add_way(i + 1, ways[i], locations, osm::tag_list{});
+        } else {
+          w.add_way(i + 1, ways[i]);
+        }
+      }
+      w.add_relation(1,
+                     {{1, "outer", osm::kWay},
+                      {2, "outer", osm::kWay},
+                      {3, "inner", osm::kWay}},
+                     {{"type", "multipolygon"}, {"name", "a"}});
+      w.add_relation(2, {{1, "outer", osm::kWay}, {99, "outer", osm::kWay}},
+                     {{"type", "multipolygon"}});  // missing way
+      w.add_relation(3, {{4, "outer", osm::kWay}},
+                     {{"type", "boundary"}});  // open ring
+      w.add_relation(4, {{1, "", osm::kWay}}, {{"type", "route"}});
+      w.finish();
+    }
+
+    auto areas = std::vector<osm::area>{};
+    auto mutex = std::mutex{};
+    auto const stats = osm::assemble_areas(
+        path, {.read_ = {.n_threads_ = 2U}}, [&](osm::area const& a) {
+          auto const lock = std::scoped_lock{mutex};
+          areas.push_back(a);
+        });
+    EXPECT_EQ(3U, stats.relations_);
+    EXPECT_EQ(1U, stats.assembled_);
+    EXPECT_EQ(1U, stats.incomplete_);
+    EXPECT_EQ(1U, stats.invalid_);
+
+    ASSERT_EQ(1U, areas.size());
+    auto const& a = areas[0];
+    EXPECT_EQ(1, a.relation_id_);
+    EXPECT_EQ((std::vector<std::pair<std::string, std::string>>{
+                  {"type", "multipolygon"}, {"name", "a"}}),
+              a.tags_);
+    ASSERT_EQ(1U, a.polygons_.size());
+    auto const& p = a.polygons_[0];
+    EXPECT_EQ(5U, p.outer_.size());
+    EXPECT_DOUBLE_EQ(1e-8, signed_area(p.outer_));  // (1000 * 1e-7)^2
+    ASSERT_EQ(1U, p.inner_.size());
+    EXPECT_EQ(5U, p.inner_[0].size());
+    EXPECT_DOUBLE_EQ(-1e-10, signed_area(p.inner_[0]));
+  }
+  std::filesystem::remove(path);
+}
+
+TEST(osm, block_cache_evict) {
+  namespace fs = std::filesystem;
+  auto const dir = fs::temp_directory_path() / "osm-block-cache-test";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+
+  // Entries a (oldest), b, c with 100 bytes each (index + data).
+  auto const now = fs::file_time_type::clock::now();
+  auto age = 3;
+  for (auto const name : {"a", "b", "c"}) {
+    std::ofstream{dir / fmt::format("{}.blocks", name)} << std::string(90, 'x');
+    std::ofstream{dir / fmt::format("{}.idx", name)} << std::string(10, 'x');
+    fs::last_write_time(dir / fmt::format("{}.idx", name),
+                        now - std::chrono::minutes{age--});
+  }
+
+  std::ofstream{dir / "a.lock"};
+  std::ofstream{dir / "b.lock"};
+  std::ofstream{dir / "d.lock"};  // failed build
+
+  osm::evict({.dir_ = dir, .max_size_ = 250U});
+  EXPECT_FALSE(fs::exists(dir / "a.idx"));
+  EXPECT_FALSE(fs::exists(dir / "a.blocks"));
+  EXPECT_FALSE(fs::exists(dir / "a.lock"));
+  EXPECT_TRUE(fs::exists(dir / "b.idx"));
+  EXPECT_TRUE(fs::exists(dir / "b.lock"));
+  EXPECT_TRUE(fs::exists(dir / "c.blocks"));
+  EXPECT_FALSE(fs::exists(dir / "d.lock"));
+
+  fs::remove_all(dir);
+}
+
+TEST(osm, block_cache) {
+  namespace fs = std::filesystem;
+  auto const dir = fs::temp_directory_path() / "osm-block-cache-read-test";
+  fs::remove_all(dir);
+  auto const path = write_test_file("osm_block_cache_test.osm.pbf");
+
+  auto const count = [&](osm::read_config const& c) {
+    auto n = std::array<std::atomic_int64_t, 3>{};
+    osm::read(
+        path.string().c_str(), c,
+        [&](std::int64_t const id, geo::latlng const&, auto&&) { n[0] += id; },
+        [&](std::int64_t const id, auto&&, auto&&) { n[1] += id; },
+        [&](std::int64_t const id, auto&&, auto&&) { n[2] += id; });
+    return std::array{n[0].load(), n[1].load(), n[2].load()};
+  };
+  auto const expected = count({.n_threads_ = 2U});
+  EXPECT_EQ((std::array<std::int64_t, 3>{5050, 1275, 55}), expected);
+
+  auto levels = std::vector{0};
+#ifdef OSM_WITH_ZSTD
+  levels.push_back(3);
+#endif
+  for (auto const level : levels) {
+    auto const cache = osm::block_cache_config{.dir_ = dir,
+                                               .zstd_level_ = level};
+    EXPECT_FALSE(osm::read_block_cache(path, cache).has_value());
+    auto const f = osm::ensure_block_cache(path, cache, {.n_threads_ = 2U});
+    ASSERT_TRUE(f.has_value());
+    ASSERT_EQ(23U, (*f)->blobs_.size());  // OSMHeader + 22 data blocks
+
+    auto r = osm::block_cache_reader{.f_ = *f};
+    auto d = osm::decompressor{};
+    auto out = std::string{};
+    auto const first = r.read();
+    ASSERT_TRUE(first.has_value());
+    EXPECT_EQ(osm::blob_type::kHeader, first->type_);
+    for (auto i = 1U; i != 23U; ++i) {
+      auto const b = r.read();
+      ASSERT_TRUE(b.has_value());
+      EXPECT_EQ(i, b->idx_);
+      EXPECT_EQ(level == 0 ? osm::compression::kRaw : osm::compression::kZstd,
+                b->compression_);
+      EXPECT_EQ(b->raw_size_, d.decompress(*b, out).size());
+    }
+    EXPECT_FALSE(r.read().has_value());
+    EXPECT_EQ(r.size(), r.offset());
+
+    EXPECT_EQ(expected, count({.n_threads_ = 2U, .cache_ = cache}));
+    EXPECT_TRUE(osm::read_block_cache(path, cache).has_value());
+
+    // A data file from another build is rejected.
+    auto blocks = fs::path{};
+    for (auto const& e : fs::directory_iterator{dir}) {
+      if (e.path().extension() == ".blocks") {
+        blocks = e.path();
       }
-    }).detach();
+    }
+    ASSERT_FALSE(blocks.empty());
+    {
+      auto file = std::fstream{blocks, std::ios::binary | std::ios::in |
+                                           std::ios::out};
+      file.write("\0\0\0\0\0\0\0\0", 8);
+    }
+    EXPECT_FALSE(osm::read_block_cache(path, cache).has_value());
+    fs::remove_all(dir);
   }
 
-  for (auto& t : pool) {
-    t = std::thread{[&]() {
-      bf::use_scheduling_algorithm<bf::algo::work_stealing>(n_threads + 1U);
-      auto l = std::unique_lock{fin_mutex};
-      fin_cv.wait(l, [&]() { return fin.load(); });
-    }};
+  // A changed PBF file does not use the old entry.
+  auto const cache = osm::block_cache_config{.dir_ = dir};
+  ASSERT_TRUE(osm::ensure_block_cache(path, cache).has_value());
+  write_test_file("osm_block_cache_test.osm.pbf", 50);
+  EXPECT_FALSE(osm::read_block_cache(path, cache).has_value());
+  EXPECT_EQ((std::array<std::int64_t, 3>{1275, 325, 15}),
+            count({.n_threads_ = 2U, .cache_ = cache}));
+
+  fs::remove_all(dir);
+  fs::remove(path);
+}
+
+TEST(osm, buffer_pool) {
+  auto pool = osm::buffer_pool{100U};
+  auto a = pool.acquire(60U);
+  ASSERT_TRUE(a.has_value());
+  a->buf_.resize(60U);
+
+  auto stop = std::stop_source{};
+  auto blocked = std::thread{[&]() {
+    EXPECT_FALSE(pool.acquire(60U, stop.get_token()).has_value());
+  }};
+  stop.request_stop();
+  blocked.join();
+
+  a->reset();
+  EXPECT_EQ(0U, pool.leased());
+  EXPECT_LE(60U, pool.idle());
+
+  auto const big = pool.acquire(500U);  // larger than the budget
+  EXPECT_EQ(500U, pool.leased());
+  EXPECT_LE(60U, big->buf_.capacity());  // reused
+}
+
+TEST(osm, writer_round_trip) {
+  auto const tags_str = [](auto&& tags) {
+    auto s = std::string{};
+    for (auto const [k, v] : tags) {
+      s += fmt::format("{}={};", k, v);
+    }
+    return s;
+  };
+  auto const path =
+      std::filesystem::temp_directory_path() / "osm_writer_test.osm.pbf";
+
+  // Every header flag set and unset, queue size rounded up to 2^N.
+  auto configs = std::vector<osm::writer_config>{
+      {.n_threads_ = 2U,
+       .compression_ = osm::compression::kRaw,
+       .max_entities_ = 7U,
+       .locations_on_ways_ = true},
+      {.n_threads_ = 2U,
+       .queue_size_ = 3U,
+       .compression_ = osm::compression::kZlib,
+       .max_entities_ = 7U,
+       .locations_on_ways_ = true},
+      {.n_threads_ = 2U,
+       .compression_ = osm::compression::kZlib,
+       .max_entities_ = 7U,
+       .sorted_ = false}};
+#ifdef OSM_WITH_ZSTD
+  configs.push_back({.n_threads_ = 2U,
+                     .compression_ = osm::compression::kZstd,
+                     .max_entities_ = 7U});
+#endif
+
+  for (auto const& config : configs) {
+    auto const c = config.compression_;
+    auto const low = config.locations_on_ways_;
+    auto expected = std::vector<std::string>{};
+    {
+      auto w = osm::writer{path, config};
+      for (auto i = 1; i != 50; ++i) {
+        auto const l = osm::location{i * 1000, -i};
+        auto const name = std::to_string(i);
+        if (i % 3 == 0) {
+          w.add_node(i, l);
+          expected.push_back(fmt::format("n{} {} {} ", i, l.lat_, l.lon_));
+        } else {
+          w.add_node(i, l, {{"name", name}, {"", "empty"}});
+          expected.push_back(fmt::format("n{} {} {} name={};=empty;", i,
+                                         l.lat_, l.lon_, name));
+        }
+      }
+      for (auto i = 100; i != 120; ++i) {
+        auto const refs = std::vector<std::int64_t>{1, i - 90, 3};
+        auto const locations = std::vector<osm::location>{
+            {1000, -1}, {(i - 90) * 1000, 90 - i}, {3000, -3}};
+        if (low) {
+          w.add_way(i, refs, locations, {{"highway", "primary"}});
+        } else {
+          w.add_way(i, refs, {{"highway", "primary"}});
+        }
+        expected.push_back(fmt::format("w{} {} {} highway=primary;", i,
+                                       fmt::join(refs, ","),
+                                       low ? (i - 90) * 1000 : 0));
+      }
+      for (auto i = 5; i != 15; ++i) {
+        w.add_relation(i, {{1, "outer", osm::kWay}, {-i, "", osm::kNode}},
+                       {{"type", "multipolygon"}});
+        expected.push_back(
+            fmt::format("r{} 1/outer/1,{}//0, type=multipolygon;", i, -i));
+      }
+      if (config.sorted_) {
+        EXPECT_ANY_THROW(w.add_relation(3, {}));  // not Sort.Type_then_ID
+      } else {
+        w.add_relation(3, {});
+        expected.emplace_back("r3  ");
+      }
+      w.finish();
+    }
+
+    auto const h = osm::read_header(path.string().c_str());
+    EXPECT_EQ(config.sorted_, h.sorted());
+    EXPECT_EQ(low, h.locations_on_ways());
+    EXPECT_TRUE(h.has_feature("DenseNodes"));
+
+    auto r = osm::raw_reader{.file_ = cista::mmap{
+                                 path.string().c_str(),
+                                 cista::mmap::protection::READ}};
+    auto d = osm::decompressor{};
+    auto state = osm::decode_state{};
+    auto out = std::string{};
+    auto n_blocks = 0U;
+    auto actual = std::vector<std::string>{};
+    for (auto b = r.read(); b.has_value(); b = r.read()) {
+      EXPECT_EQ(c, b->compression_);
+      if (b->type_ != osm::blob_type::kData) {
+        continue;
+      }
+      ++n_blocks;
+      osm::decode_primitive<osm::field::kAll | osm::field::kFixedPoint>(
+          d.decompress(*b, out), state,
+          [&](std::int64_t const id, osm::location const l, auto&& tags) {
+            actual.push_back(fmt::format("n{} {} {} {}", id, l.lat_, l.lon_,
+                                         tags_str(tags)));
+          },
+          [&](std::uint64_t const id, std::span<std::int64_t const> refs,
+              std::span<osm::location const> locations, auto&& tags) {
+            ASSERT_EQ(low ? refs.size() : 0U, locations.size());
+            if (low) {
+              EXPECT_EQ((osm::location{3000, -3}), locations.back());
+            }
+            actual.push_back(fmt::format(
+                "w{} {} {} {}", id, fmt::join(refs, ","),
+                low ? locations[1].lat_ : 0, tags_str(tags)));
+          },
+          [&](std::uint64_t const id, auto&& members, auto&& tags) {
+            auto s = fmt::format("r{} ", id);
+            for (auto const [ref, role, type] : members) {
+              s += fmt::format("{}/{}/{},", ref, role, static_cast<int>(type));
+            }
+            actual.push_back(s + " " + tags_str(tags));
+          });
+    }
+    EXPECT_EQ(7U + 3U + 2U, n_blocks);
+    EXPECT_EQ(expected, actual);
   }
+  std::filesystem::remove(path);
+}
 
-  bf::use_scheduling_algorithm<bf::algo::work_stealing>(n_threads + 1U);
+TEST(osm, entities) {
+  auto const path = write_test_file("osm_entities_test.osm.pbf");
+  auto n = std::map<osm::entity_kind, std::int64_t>{};
+  auto last_id = std::int64_t{0};
+  for (auto const& e : osm::entities(path.string(), {.n_threads_ = 2U})) {
+    if (n[e.kind_]++ == 0) {
+      last_id = 0;
+    }
+    EXPECT_LT(last_id, e.id_);  // file order
+    last_id = e.id_;
+    ASSERT_EQ(1U, e.tags_.size());
+    if (e.kind_ == osm::entity_kind::kNodes) {
+      EXPECT_EQ(std::to_string(e.id_), e.tags_[0].value_);
+    } else if (e.kind_ == osm::entity_kind::kWays) {
+      EXPECT_EQ((std::vector{2 * e.id_ - 1, 2 * e.id_}),
+                (std::vector(begin(e.refs_), end(e.refs_))));
+    } else {
+      ASSERT_EQ(1U, e.members_.size());
+      EXPECT_EQ(e.id_, e.members_[0].ref_);
+      EXPECT_EQ("outer", e.members_[0].role_);
+    }
+  }
+  EXPECT_EQ((std::map<osm::entity_kind, std::int64_t>{
+                {osm::entity_kind::kNodes, 100},
+                {osm::entity_kind::kWays, 50},
+                {osm::entity_kind::kRelations, 10}}),
+            n);
 
-  auto buf = std::optional<osm::buf>{};
-  while ((buf = r.read()).has_value()) {
-    ch.push(*buf);
-    pt->update(r.file_.size() - r.rest_.size());
+  auto ways = 0;
+  for (auto const& e : osm::entities(
+           path.string(), {.read_nodes_ = false, .read_relations_ = false})) {
+    EXPECT_EQ(osm::entity_kind::kWays, e.kind_);
+    ++ways;
   }
-  ch.close();
-  fin.store(true);
-  fin_cv.notify_all();
+  EXPECT_EQ(50, ways);
+  std::filesystem::remove(path);
 
-  for (auto& t : pool) {
-    t.join();
+  // Leaving the loop stops reading: no more than the window of queue_size_
+  // blobs plus one is read and decompressed (of 41).
+  auto const big = write_test_file("osm_entities_big_test.osm.pbf", 200'000,
+                                   {.max_entities_ = 8'000U});
+  auto s = osm::stats{};
+  auto const c =
+      osm::read_config{.n_threads_ = 1U, .queue_size_ = 4U, .stats_ = &s};
+  auto r = osm::raw_reader{.file_ = cista::mmap{big.string().c_str(),
+                                                cista::mmap::protection::READ}};
+  for (auto const& b : osm::blocks(r, c)) {
+    EXPECT_FALSE(b.data().empty());
+    break;
+  }
+  auto const latency = s.sample().latency_;
+  auto const decompressed =
+      std::accumulate(begin(latency), end(latency), std::uint64_t{0U});
+  EXPECT_LE(1U, decompressed);
+  EXPECT_GE(5U, decompressed);
+  EXPECT_GT(r.size() / 2U, r.offset());
+  std::filesystem::remove(big);
+}
+
+TEST(osm, snapshot_round_trip) {
+  auto const dir = std::filesystem::temp_directory_path();
+  auto const path = dir / "osm_snapshot_test.osm.pbf";
+  auto const file = dir / "osm_snapshot_test.snapshot";
+  {
+    // Descending IDs: the snapshot has to sort them.
+    auto w = osm::writer{path, {.n_threads_ = 2U,
+                                .max_entities_ = 4U,
+                                .sorted_ = false}};
+    for (auto i = 30; i != 0; --i) {
+      if (i % 2 == 0) {
+        w.add_node(i, osm::location{i * 10, -i},
+                   {{"name", std::to_string(i)}});
+      } else {
+        w.add_node(i, osm::location{i * 10, -i});
+      }
+    }
+    for (auto i = 20; i != 0; --i) {
+      w.add_way(i, {i + 5, i, 30}, {{"highway", "residential"}});
+    }
+    for (auto i = 10; i != 0; --i) {
+      w.add_relation(i, {{i, "outer", osm::kWay}, {i + 1, "", osm::kNode}},
+                     {{"type", "multipolygon"}});
+    }
+    w.finish();
   }
 
+  osm::write_snapshot(osm::build_snapshot(path, {.n_threads_ = 2U}), file);
+  auto const f = osm::read_snapshot(file, path);
+  ASSERT_TRUE(f.has_value());
+  auto const& s = **f;
+  auto const str = [&](std::uint32_t const id) {
+    return std::string{osm::get_string(s, id)};
+  };
+
+  ASSERT_EQ(30U, s.node_ids_.size());
+  for (auto i = 0U; i != s.node_ids_.size(); ++i) {
+    auto const id = static_cast<std::int32_t>(i + 1U);
+    EXPECT_EQ(id, s.node_ids_[i]);
+    EXPECT_EQ((osm::location{id * 10, -id}), osm::node_location(s, i));
+    auto const tags = s.node_tags_.get(i);
+    if (id % 2 == 0) {
+      ASSERT_EQ(1U, tags.size());
+      EXPECT_EQ("name", str(tags[0].key_));
+      EXPECT_EQ(std::to_string(id), str(tags[0].value_));
+    } else {
+      EXPECT_TRUE(tags.empty());
+    }
+  }
+
+  ASSERT_EQ(20U, s.way_ids_.size());
+  auto refs = std::vector<std::int64_t>{};
+  for (auto i = 0U; i != s.way_ids_.size(); ++i) {
+    auto const id = static_cast<std::int64_t>(i + 1U);
+    EXPECT_EQ(id, s.way_ids_[i]);
+    osm::way_refs(s, i, refs);
+    EXPECT_EQ((std::vector<std::int64_t>{id + 5, id, 30}), refs);
+    auto const tags = s.way_tags_.get(i);
+    ASSERT_EQ(1U, tags.size());
+    EXPECT_EQ("highway", str(tags[0].key_));
+    EXPECT_EQ("residential", str(tags[0].value_));
+    EXPECT_EQ(s.way_tags_.get(0U)[0].value_, tags[0].value_);  // interned
+  }
+
+  ASSERT_EQ(10U, s.relation_ids_.size());
+  for (auto i = 0U; i != s.relation_ids_.size(); ++i) {
+    auto const id = static_cast<std::int64_t>(i + 1U);
+    EXPECT_EQ(id, s.relation_ids_[i]);
+    auto const first = s.member_offsets_[i];
+    ASSERT_EQ(2U, s.member_offsets_[i + 1U] - first);
+    EXPECT_EQ(id, s.member_refs_[first]);
+    EXPECT_EQ("outer", str(s.member_roles_[first]));
+    EXPECT_EQ(osm::kWay, s.member_types_[first]);
+    EXPECT_EQ(id + 1, s.member_refs_[first + 1U]);
+    EXPECT_EQ("", str(s.member_roles_[first + 1U]));
+    EXPECT_EQ(osm::kNode, s.member_types_[first + 1U]);
+    auto const tags = s.relation_tags_.get(i);
+    ASSERT_EQ(1U, tags.size());
+    EXPECT_EQ("multipolygon", str(tags[0].value_));
+  }
+
+  EXPECT_EQ(std::optional{std::size_t{6U}}, osm::find(s.way_ids_, 7));
+  EXPECT_FALSE(osm::find(s.way_ids_, 21).has_value());
+
+  // Truncated: the size trailer does not match.
+  auto const truncated = dir / "osm_snapshot_test.truncated";
+  osm::write_snapshot(s, truncated);
+  EXPECT_TRUE(osm::read_snapshot(truncated, path).has_value());
+  std::filesystem::resize_file(truncated,
+                               std::filesystem::file_size(truncated) - 1U);
+  EXPECT_FALSE(osm::read_snapshot(truncated, path).has_value());
+  std::filesystem::remove(truncated);
+  for (auto const& e : std::filesystem::directory_iterator{dir}) {
+    EXPECT_FALSE(e.path().extension() == ".tmp" &&
+                 e.path().string().starts_with(truncated.string()));
+  }
+
+  // Stale: modification time or size of the PBF file changed.
+  auto const mtime = std::filesystem::last_write_time(path);
+  std::filesystem::last_write_time(path, mtime + std::chrono::seconds{1});
+  EXPECT_FALSE(osm::read_snapshot(file, path).has_value());
+  std::filesystem::last_write_time(path, mtime);
+  EXPECT_TRUE(osm::read_snapshot(file, path).has_value());
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) + 1U);
+  std::filesystem::last_write_time(path, mtime);
+  EXPECT_FALSE(osm::read_snapshot(file, path).has_value());
+
+  EXPECT_FALSE(osm::read_snapshot(dir / "osm_no_such.snapshot", path));
+  std::filesystem::remove(path);
+  std::filesystem::remove(file);
+}
+
+TEST(a, b) {
+  auto const path = "/home/felix/Downloads/germany-latest.osm.pbf";
+  if (!std::filesystem::is_regular_file(path)) {
+    GTEST_SKIP() << path << " not found";
+  }
+
+  auto r = osm::raw_reader{
+      .file_ = cista::mmap{path, cista::mmap::protection::READ}};
+
+  auto bars = utl::global_progress_bars{false};
+  auto pt = utl::activate_progress_tracker("parse");
+  pt->in_high(r.rest_.size());
+
+  auto n_nodes = std::atomic_uint64_t{0U};
+  auto n_ways = std::atomic_uint64_t{0U};
+  auto n_rels = std::atomic_uint64_t{0U};
+
+  osm::read(
+      r, {.progress_ = [&](std::size_t const read, std::size_t) {
+        pt->update(read);
+      }},
+      [&](std::int64_t const id, geo::latlng const& pos, auto&& tags) {
+        ++n_nodes;
+      },
+      [&](std::int64_t const id, auto&& refs, auto&& tags) { ++n_ways; },
+      [&](std::int64_t const id, auto&& members, auto&& tags) { ++n_rels; });
+
   std::cout << "number of nodes: " << n_nodes << "\n";
   std::cout << "number of ways: " << n_ways << "\n";
   std::cout << "number of relations: " << n_rels << "\n";
 
-  const osmium::MemoryUsage memory;
-  std::cout << "\nMemory used: " << memory.peak() << " MBytes\n";
-}
\ No newline at end of file
+  std::cout << "\nmemory: " << osm::to_string(osm::get_memory_usage())
+            << ", file resident: "
+            << osm::resident_bytes(r.file_.data(), r.file_.size()) /
+                   (1024U * 1024U)
+            << " MB\n";
+}